@@ -0,0 +1,243 @@
+#ifndef BATCH_CALCULATIONS_HPP_INCLUDED
+#define BATCH_CALCULATIONS_HPP_INCLUDED
+
+#include <Eigen/Core>
+
+#include "MathTypes.hpp"
+#include "SharedCalculations.hpp"
+
+/// Structure of arrays versions of the calculations in SharedCalculations.hpp, for Width frames at once. Every component is an Eigen array with one lane per frame, so that Eigen maps the operations onto
+/// the SIMD instructions the build enables (SSE2, AVX2 or AVX-512 on x86, NEON on ARM). The operations apply in the
+/// same order as in the scalar versions, so the lanes get the same results as those, except for the visual axis,
+/// which avoids the trigonometric functions.
+namespace gazeestimation
+{
+	/// The number of frames the batch estimation paths process at once, two to four SIMD registers of doubles per
+	/// component for the instruction set the build enables.
+#if defined(EIGEN_VECTORIZE_AVX512)
+	const int default_batch_width = 16;
+#elif defined(EIGEN_VECTORIZE_AVX)
+	const int default_batch_width = 8;
+#else
+	const int default_batch_width = 4;
+#endif
+
+	template <typename T, int Width>
+	using Lanes = Eigen::Array<T, Width, 1>;
+
+	/// One three dimensional vector per lane, stored by component.
+	template <typename T, int Width>
+	struct Vec3Lanes
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Lanes<T, Width> x;
+		Lanes<T, Width> y;
+		Lanes<T, Width> z;
+
+		Vec3Lanes() = default;
+
+		Vec3Lanes(const Lanes<T, Width>& x, const Lanes<T, Width>& y, const Lanes<T, Width>& z) :
+			x(x), y(y), z(z) { }
+
+		/// Returns v in every lane.
+		static Vec3Lanes broadcast(const Vec3T<T>& v)
+		{
+			return Vec3Lanes(Lanes<T, Width>::Constant(v[0]), Lanes<T, Width>::Constant(v[1]), Lanes<T, Width>::Constant(v[2]));
+		}
+
+		void set(int lane, const Vec3T<T>& v)
+		{
+			x[lane] = v[0];
+			y[lane] = v[1];
+			z[lane] = v[2];
+		}
+
+		Vec3T<T> get(int lane) const
+		{
+			return Vec3T<T>(x[lane], y[lane], z[lane]);
+		}
+	};
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> operator+(const Vec3Lanes<T, Width>& a, const Vec3Lanes<T, Width>& b)
+	{
+		return Vec3Lanes<T, Width>(a.x + b.x, a.y + b.y, a.z + b.z);
+	}
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> operator-(const Vec3Lanes<T, Width>& a, const Vec3Lanes<T, Width>& b)
+	{
+		return Vec3Lanes<T, Width>(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	/// Scales every lane of a by its own factor.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> operator*(const Lanes<T, Width>& factors, const Vec3Lanes<T, Width>& a)
+	{
+		return Vec3Lanes<T, Width>(factors * a.x, factors * a.y, factors * a.z);
+	}
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> operator*(const T& factor, const Vec3Lanes<T, Width>& a)
+	{
+		return Vec3Lanes<T, Width>(factor * a.x, factor * a.y, factor * a.z);
+	}
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> operator/(const Vec3Lanes<T, Width>& a, const Lanes<T, Width>& divisors)
+	{
+		return Vec3Lanes<T, Width>(a.x / divisors, a.y / divisors, a.z / divisors);
+	}
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> operator/(const Vec3Lanes<T, Width>& a, const T& divisor)
+	{
+		return Vec3Lanes<T, Width>(a.x / divisor, a.y / divisor, a.z / divisor);
+	}
+
+	/// Sums in the order Eigen's dot product of two Vec3 takes with SSE2 or NEON packets of two doubles, (x + y) + z.
+	template <typename T, int Width>
+	inline Lanes<T, Width> dot(const Vec3Lanes<T, Width>& a, const Vec3Lanes<T, Width>& b)
+	{
+		return (a.x * b.x + a.y * b.y) + a.z * b.z;
+	}
+
+	template <typename T, int Width>
+	inline Lanes<T, Width> squared_length(const Vec3Lanes<T, Width>& a)
+	{
+		return dot(a, a);
+	}
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> normalized(const Vec3Lanes<T, Width>& a)
+	{
+		const Lanes<T, Width> length = squared_length(a).sqrt();
+		return a / length;
+	}
+
+	/// \brief Calculates the cornea center from the point of reflection q of the given light per eq. 3.7 for every lane.
+	/// The light and the camera are the same for all lanes.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_cornea_center(const Vec3Lanes<T, Width>& q, const Vec3Lanes<T, Width>& light,
+		const Vec3Lanes<T, Width>& camera_position, const T& R)
+	{
+		const Vec3Lanes<T, Width> l_q_unit = normalized(light - q);
+		const Vec3Lanes<T, Width> o_q_unit = normalized(camera_position - q);
+		return q - R * normalized(l_q_unit + o_q_unit);
+	}
+
+	/// Same as the scalar calculate_cornea_center_derivative for every lane.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_cornea_center_derivative(const Vec3Lanes<T, Width>& q, const Vec3Lanes<T, Width>& q_unit,
+		const Vec3Lanes<T, Width>& light, const Vec3Lanes<T, Width>& camera_position, const T& R)
+	{
+		const Vec3Lanes<T, Width> l_q = light - q;
+		const Vec3Lanes<T, Width> o_q = camera_position - q;
+		const Lanes<T, Width> l_q_length = squared_length(l_q).sqrt();
+		const Lanes<T, Width> o_q_length = squared_length(o_q).sqrt();
+		const Vec3Lanes<T, Width> l_q_unit = l_q / l_q_length;
+		const Vec3Lanes<T, Width> o_q_unit = o_q / o_q_length;
+
+		const Vec3Lanes<T, Width> d_l_q_unit = (dot(l_q_unit, q_unit) * l_q_unit - q_unit) / l_q_length;
+		const Vec3Lanes<T, Width> d_o_q_unit = (dot(o_q_unit, q_unit) * o_q_unit - q_unit) / o_q_length;
+
+		const Vec3Lanes<T, Width> sum = l_q_unit + o_q_unit;
+		const Lanes<T, Width> sum_length = squared_length(sum).sqrt();
+		const Vec3Lanes<T, Width> sum_unit = sum / sum_length;
+		const Vec3Lanes<T, Width> d_sum = d_l_q_unit + d_o_q_unit;
+		const Vec3Lanes<T, Width> d_sum_unit = (d_sum - dot(sum_unit, d_sum) * sum_unit) / sum_length;
+
+		return q_unit - R * d_sum_unit;
+	}
+
+	/// Calculates kr per eq. 3.29 for every lane.
+	template <typename T, int Width>
+	inline Lanes<T, Width> calculate_kr(const Vec3Lanes<T, Width>& camera_position, const Vec3Lanes<T, Width>& image_pupil_center,
+		const Vec3Lanes<T, Width>& cornea_center, const T& R)
+	{
+		const Lanes<T, Width> a = squared_length(camera_position - image_pupil_center);
+		const Lanes<T, Width> b = dot(camera_position - image_pupil_center, camera_position - cornea_center);
+		const Lanes<T, Width> c = squared_length(camera_position - cornea_center) - R * R;
+
+		return (-b - (b * b - a * c).sqrt()) / a;
+	}
+
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_r(const Vec3Lanes<T, Width>& camera_position, const Vec3Lanes<T, Width>& pupil_image_wcs,
+		const Vec3Lanes<T, Width>& cornea_wcs, const T& R)
+	{
+		const Lanes<T, Width> kr = calculate_kr(camera_position, pupil_image_wcs, cornea_wcs, R);
+		return camera_position + kr * (camera_position - pupil_image_wcs);
+	}
+
+	/// Calculates iota per eq 3.33 for every lane.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_iota(const Vec3Lanes<T, Width>& camera_position, const Vec3Lanes<T, Width>& pupil_por_wcs,
+		const Vec3Lanes<T, Width>& center_of_cornea, const T& R, const RefractionConstants<T>& refraction)
+	{
+		const Vec3Lanes<T, Width> zeta = normalized(camera_position - pupil_por_wcs);
+		const Vec3Lanes<T, Width> eta = (pupil_por_wcs - center_of_cornea) / R;
+		const Lanes<T, Width> eta_dot_zeta = dot(eta, zeta);
+
+		const Lanes<T, Width> a = eta_dot_zeta - (refraction.n1_n2_squared_minus_one + eta_dot_zeta * eta_dot_zeta).sqrt();
+		return refraction.n2_n1 * (a * eta - zeta);
+	}
+
+	/// Calculates the pupil center p from its point of refraction per eq. 3.34 for every lane.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_p(const Vec3Lanes<T, Width>& camera_position, const Vec3Lanes<T, Width>& pupil_por_wcs,
+		const Vec3Lanes<T, Width>& center_of_cornea, const EyeModelConstants<T>& eye)
+	{
+		const Vec3Lanes<T, Width> iota = calculate_iota(camera_position, pupil_por_wcs, center_of_cornea, eye.R, eye.refraction);
+		const Lanes<T, Width> rc_dot_iota = dot(pupil_por_wcs - center_of_cornea, iota);
+		const Lanes<T, Width> kp = -rc_dot_iota - (rc_dot_iota * rc_dot_iota - eye.R_squared_minus_K_squared).sqrt();
+		return pupil_por_wcs + kp * iota;
+	}
+
+	/// Calculates the optic axis of a single camera setup for every lane, see the scalar version.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_optic_axis_unit_vector(const Vec3Lanes<T, Width>& pupil_wcs,
+		const Vec3Lanes<T, Width>& camera_position, const Vec3Lanes<T, Width>& center_of_cornea, const EyeModelConstants<T>& eye,
+		bool use_chen_noise_reduction)
+	{
+		const Vec3Lanes<T, Width> pupil_por_wcs = calculate_r(camera_position, pupil_wcs, center_of_cornea, eye.R);
+
+		Vec3Lanes<T, Width> pupil_center_wcs = calculate_p(camera_position, pupil_por_wcs, center_of_cornea, eye);
+
+		if (use_chen_noise_reduction)
+		{
+			const Lanes<T, Width> cxpx = center_of_cornea.x - pupil_center_wcs.x;
+			const Lanes<T, Width> cypy = center_of_cornea.y - pupil_center_wcs.y;
+			pupil_center_wcs.z = center_of_cornea.z - (eye.K * eye.K - cxpx * cxpx - cypy * cypy).sqrt();
+		}
+
+		return normalized(pupil_center_wcs - center_of_cornea);
+	}
+
+	/// \brief Calculates the visual axis from the optical axis and nu_ecs = calculate_nu_ecs(alpha, beta) for every lane.
+	/// Instead of the eye angles of calculate_eye_angles, this takes their sines and cosines from the optical axis
+	/// directly, which kappa = 0 allows, so the result can differ from the scalar version in the last bits.
+	template <typename T, int Width>
+	inline Vec3Lanes<T, Width> calculate_visual_axis_unit_vector(const Vec3Lanes<T, Width>& optical_axis_unit_vector,
+		const Vec3T<T>& nu_ecs)
+	{
+		const Vec3Lanes<T, Width>& o = optical_axis_unit_vector;
+		// theta = -atan(x / z) and phi = asin(y), with the sign of z carried by the sine of theta as in x / z
+		const Lanes<T, Width> horizontal = (o.x * o.x + o.z * o.z).sqrt();
+		const Lanes<T, Width> sign_z = (o.z < T(0)).select(Lanes<T, Width>::Constant(T(-1)), Lanes<T, Width>::Constant(T(1)));
+		const Lanes<T, Width> cos_theta = o.z.abs() / horizontal;
+		const Lanes<T, Width> sin_theta = -sign_z * o.x / horizontal;
+		const Lanes<T, Width>& sin_phi = o.y;
+		const Lanes<T, Width> cos_phi = (T(1) - o.y * o.y).sqrt();
+
+		// the rows of the eye rotation matrix of calculate_eye_rotation_matrix(theta, phi, 0) applied to nu_ecs
+		return Vec3Lanes<T, Width>(
+			-cos_theta * nu_ecs[0] - sin_theta * sin_phi * nu_ecs[1] + sin_theta * cos_phi * nu_ecs[2],
+			cos_phi * nu_ecs[1] + sin_phi * nu_ecs[2],
+			-sin_theta * nu_ecs[0] + cos_theta * sin_phi * nu_ecs[1] - cos_theta * cos_phi * nu_ecs[2]);
+	}
+
+}
+
+#endif
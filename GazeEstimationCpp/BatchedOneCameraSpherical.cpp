@@ -0,0 +1,337 @@
+// All equations are from
+// Remote, Non - Contact Gaze Estimation with Minimal Subject Cooperation
+// Guestrin, Elias Daniel
+// https://tspace.library.utoronto.ca/handle/1807/24349
+#include "BatchedOneCameraSpherical.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "BatchCalculations.hpp"
+#include "PreparedParameters.hpp"
+#include "SharedCalculations.hpp"
+#include "Utils.hpp"
+
+namespace gazeestimation {
+
+	namespace {
+		typedef Lanes<double, default_batch_width> Batch;
+		typedef Vec3Lanes<double, default_batch_width> Vec3Batch;
+		typedef Eigen::Array<bool, default_batch_width, 1> Mask;
+
+		/// the bounds of kq of the generic solver
+		const double min_kq = 2;
+		const double max_kq = 400;
+		/// the step tolerance of the two glint solver in double
+		const double step_tolerance = 1e-10;
+
+		/// The glints of a batch of frames in WCS with the lights they reflect, one slot per light.
+		struct GlintSlots
+		{
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+			int num_slots = 0;
+			/// normalized(o - u) for the glint u of each slot
+			Vec3Batch q_units[max_glints_per_camera];
+			Vec3Batch lights[max_glints_per_camera];
+			/// 1 where the glint of the slot is valid, 0 where it is masked out
+			Batch valid[max_glints_per_camera];
+			Batch num_valid;
+		};
+
+		/// The cornea center of each slot for the given kq per eq. 3.7.
+		void calculate_slot_cornea_centers(const GlintSlots& slots, const Vec3Batch& camera_position, double R, const Batch* ks,
+			Vec3Batch* cs)
+		{
+			for (int i = 0; i < slots.num_slots; i++)
+			{
+				const Vec3Batch q = camera_position + ks[i] * slots.q_units[i];
+				cs[i] = calculate_cornea_center(q, slots.lights[i], camera_position, R);
+			}
+		}
+
+		/// 1/2 of the squared norm of the differences between the cornea centers of all pairs of valid slots, the cost
+		/// of DistanceBetweenCorneasFunctor.
+		Batch calculate_cost(const GlintSlots& slots, const Vec3Batch* cs)
+		{
+			Batch cost = Batch::Zero();
+			for (int i = 0; i < slots.num_slots; i++)
+			{
+				for (int j = 0; j < i; j++)
+				{
+					cost += slots.valid[i] * slots.valid[j] * squared_length(cs[i] - cs[j]);
+				}
+			}
+			return 0.5 * cost;
+		}
+
+		/// \brief Runs the given number of Gauss-Newton iterations for kq on the pairwise differences between the cornea
+		/// centers of the valid slots, the residuals of DistanceBetweenCorneasFunctor. The normal equations are solved by
+		/// elimination without pivoting, as J^T J is positive definite with at least two glints whose rays differ. Masked
+		/// slots get an identity row, so they keep their kq. Steps that are not finite are not taken and fail the lane, kq
+		/// is clamped to the bounds of the generic solver. converged receives whether the last step of each lane was below
+		/// the tolerance.
+		void solve_kq_gauss_newton(const GlintSlots& slots, const Vec3Batch& camera_position, double R, int iterations,
+			Batch* ks, Mask& converged, Mask& failed)
+		{
+			const int n = slots.num_slots;
+			Vec3Batch cs[max_glints_per_camera];
+			Vec3Batch derivatives[max_glints_per_camera];
+			Batch jtj[max_glints_per_camera][max_glints_per_camera];
+			Batch jtr[max_glints_per_camera];
+
+			converged = Mask::Constant(false);
+			failed = Mask::Constant(false);
+			for (int iteration = 0; iteration < iterations; iteration++)
+			{
+				for (int i = 0; i < n; i++)
+				{
+					const Vec3Batch q = camera_position + ks[i] * slots.q_units[i];
+					cs[i] = calculate_cornea_center(q, slots.lights[i], camera_position, R);
+					derivatives[i] = calculate_cornea_center_derivative(q, slots.q_units[i], slots.lights[i], camera_position, R);
+				}
+
+				for (int i = 0; i < n; i++)
+				{
+					jtr[i] = Batch::Zero();
+					for (int j = 0; j < n; j++)
+					{
+						jtj[i][j] = Batch::Zero();
+					}
+				}
+
+				// the residual of pair (i, j) is c_i - c_j, with the jacobian a_i for kq_i and -a_j for kq_j
+				for (int i = 0; i < n; i++)
+				{
+					for (int j = 0; j < i; j++)
+					{
+						const Batch weight = slots.valid[i] * slots.valid[j];
+						const Vec3Batch residual = cs[i] - cs[j];
+						const Batch ab = weight * dot(derivatives[i], derivatives[j]);
+						jtj[i][i] += weight * squared_length(derivatives[i]);
+						jtj[j][j] += weight * squared_length(derivatives[j]);
+						jtj[i][j] -= ab;
+						jtj[j][i] -= ab;
+						jtr[i] += weight * dot(derivatives[i], residual);
+						jtr[j] -= weight * dot(derivatives[j], residual);
+					}
+				}
+
+				for (int i = 0; i < n; i++)
+				{
+					jtj[i][i] += 1 - slots.valid[i];
+				}
+
+				// solve (J^T J) step = -J^T r
+				for (int k = 0; k < n; k++)
+				{
+					for (int i = k + 1; i < n; i++)
+					{
+						const Batch factor = jtj[i][k] / jtj[k][k];
+						for (int j = k + 1; j < n; j++)
+						{
+							jtj[i][j] -= factor * jtj[k][j];
+						}
+						jtr[i] -= factor * jtr[k];
+					}
+				}
+
+				Batch steps[max_glints_per_camera];
+				for (int i = n - 1; i >= 0; i--)
+				{
+					Batch sum = jtr[i];
+					for (int j = i + 1; j < n; j++)
+					{
+						sum += jtj[i][j] * steps[j];
+					}
+					steps[i] = -sum / jtj[i][i];
+				}
+
+				Mask finite = Mask::Constant(true);
+				for (int i = 0; i < n; i++)
+				{
+					finite = finite && steps[i].isFinite();
+				}
+				failed = failed || !finite;
+
+				converged = finite;
+				for (int i = 0; i < n; i++)
+				{
+					converged = converged && (steps[i].abs() < step_tolerance * ks[i]);
+					ks[i] = finite.select(ks[i] + steps[i], ks[i]).max(min_kq).min(max_kq);
+				}
+			}
+		}
+	}
+
+	BatchedOneCamSphericalGE::BatchedOneCamSphericalGE(bool use_chen_noise_reduction, int iterations) :
+		use_chen_noise_reduction(use_chen_noise_reduction),
+		iterations(iterations)
+	{
+
+	}
+
+	void BatchedOneCamSphericalGE::setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters)
+	{
+		telemetry_counters = std::move(counters);
+	}
+
+	std::unique_ptr<BatchedOneCamSphericalGE::GazeEstimationMethod> BatchedOneCamSphericalGE::clone() const
+	{
+		return std::unique_ptr<GazeEstimationMethod>(new BatchedOneCamSphericalGE(*this));
+	}
+
+	DefaultGazeEstimationResult BatchedOneCamSphericalGE::estimate(const PupilCenterGlintInputs& data,
+		const EyeAndCameraParameters& parameters)
+	{
+		DefaultGazeEstimationResult result;
+		estimate_range(&data, &data + 1, &result, parameters);
+		return result;
+	}
+
+	void BatchedOneCamSphericalGE::estimate_range(const PupilCenterGlintInputs* first, const PupilCenterGlintInputs* last,
+		DefaultGazeEstimationResult* results, const EyeAndCameraParameters& parameters)
+	{
+		if (parameters.cameras.size() != 1)
+		{
+			for (; first != last; ++first, ++results)
+			{
+				*results = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfCameras);
+				if (telemetry_counters)
+					telemetry_counters->record(results->telemetry, false);
+			}
+			return;
+		}
+
+		const PreparedParameters prepared(parameters);
+		const PinholeCameraModel& camera = parameters.cameras[0];
+		const Vec3& camera_position = camera.position();
+		const Vec3Batch camera_positions = Vec3Batch::broadcast(camera_position);
+
+		GlintSlots slots;
+		slots.num_slots = static_cast<int>(std::min(parameters.light_positions.size(), max_glints_per_camera));
+		for (int i = 0; i < slots.num_slots; i++)
+		{
+			slots.lights[i] = Vec3Batch::broadcast(parameters.light_positions[i]);
+		}
+
+		while (first != last)
+		{
+			DefaultGazeEstimationResult* const block = results;
+			DefaultGazeEstimationResult* lanes[default_batch_width];
+			const PupilCenterGlintInputs* inputs[default_batch_width];
+			int count = 0;
+			for (; first != last && count < default_batch_width; ++first, ++results)
+			{
+				if (first->data.size() != 1)
+				{
+					*results = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfInputs);
+					continue;
+				}
+
+				const PupilCenterGlintInput::Glints& glints = first->data[0].glints;
+				const int num_glints = std::min(static_cast<int>(glints.size()), slots.num_slots);
+				int valid_glints = 0;
+				for (int i = 0; i < num_glints; i++)
+				{
+					if (glintValid(glints[i]))
+						valid_glints++;
+				}
+
+				if (valid_glints < 2)
+				{
+					*results = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::NotEnoughValidGlints);
+					continue;
+				}
+
+				inputs[count] = first;
+				lanes[count++] = results;
+			}
+
+			if (count > 0)
+			{
+				// unused lanes repeat the first frame, and masked slots the first valid glint of their frame, so that
+				// every lane stays finite
+				Vec3Batch pupil_wcs;
+				for (int lane = 0; lane < default_batch_width; lane++)
+				{
+					const PupilCenterGlintInput& input = inputs[lane < count ? lane : 0]->data[0];
+					Vec3 glints_wcs[max_glints_per_camera];
+					camera.ics_to_wcs(input.glints.begin(), input.glints.end(), glints_wcs);
+
+					const int num_glints = std::min(static_cast<int>(input.glints.size()), slots.num_slots);
+					int first_valid = 0;
+					while (!glintValid(input.glints[first_valid]))
+						first_valid++;
+
+					for (int i = 0; i < slots.num_slots; i++)
+					{
+						const bool valid = i < num_glints && glintValid(input.glints[i]);
+						slots.valid[i][lane] = valid ? 1 : 0;
+						slots.q_units[i].set(lane, normalized(camera_position - glints_wcs[valid ? i : first_valid]));
+					}
+					pupil_wcs.set(lane, camera.ics_to_wcs(input.pupil_center));
+				}
+				slots.num_valid = Batch::Zero();
+				for (int i = 0; i < slots.num_slots; i++)
+				{
+					slots.num_valid += slots.valid[i];
+				}
+
+				Batch ks[max_glints_per_camera];
+				std::fill(ks, ks + slots.num_slots, Batch::Constant(parameters.distance_to_camera_estimate));
+				Mask converged;
+				Mask failed;
+				solve_kq_gauss_newton(slots, camera_positions, parameters.R, iterations, ks, converged, failed);
+
+				Vec3Batch cs[max_glints_per_camera];
+				calculate_slot_cornea_centers(slots, camera_positions, parameters.R, ks, cs);
+				const Batch cost = calculate_cost(slots, cs);
+				Vec3Batch cornea_center = Vec3Batch::broadcast(make_vec3(0, 0, 0));
+				for (int i = 0; i < slots.num_slots; i++)
+				{
+					cornea_center = cornea_center + slots.valid[i] * cs[i];
+				}
+				cornea_center = cornea_center / slots.num_valid;
+
+				const Vec3Batch optic_axis = calculate_optic_axis_unit_vector(pupil_wcs, camera_positions, cornea_center,
+					prepared.eye(), use_chen_noise_reduction);
+				const Vec3Batch visual_axis = calculate_visual_axis_unit_vector(optic_axis, prepared.nu_ecs());
+
+				for (int lane = 0; lane < count; lane++)
+				{
+					DefaultGazeEstimationResult& result = *lanes[lane];
+					if (failed[lane])
+					{
+						// the cornea center and the axes of the lane are not finite or meaningless
+						result = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::SolverFailed);
+					}
+					else
+					{
+						result = DefaultGazeEstimationResult();
+						result.is_valid = true;
+						result.center_of_cornea = cornea_center.get(lane);
+						result.optical_axis = optic_axis.get(lane);
+						result.visual_axis = visual_axis.get(lane);
+					}
+
+					SolverTelemetry& solver = result.telemetry.solver;
+					solver.solver = SolverTelemetry::BatchedSolver;
+					solver.termination = failed[lane] ? SolverTelemetry::Failed
+						: converged[lane] ? SolverTelemetry::Converged : SolverTelemetry::NoConvergence;
+					solver.iterations = iterations;
+					solver.final_cost = cost[lane];
+				}
+			}
+
+			if (telemetry_counters)
+			{
+				for (DefaultGazeEstimationResult* result = block; result != results; ++result)
+				{
+					telemetry_counters->record(result->telemetry, result->is_valid);
+				}
+			}
+		}
+	}
+
+}
@@ -0,0 +1,50 @@
+// Gaze Estimation for one camera and two or more light sources, batched for reprocessing recordings
+// All equations are from
+// Remote, Non - Contact Gaze Estimation with Minimal Subject Cooperation
+// Guestrin, Elias Daniel
+// https://tspace.library.utoronto.ca/handle/1807/24349
+#ifndef BATCHED_ONE_CAMERA_SPHERICAL_HPP_INCLUDED
+#define BATCHED_ONE_CAMERA_SPHERICAL_HPP_INCLUDED
+
+#include "GazeEstimationTypes.hpp"
+
+namespace gazeestimation {
+
+	/// \brief The estimation of OneCamSphericalGE for reprocessing large recordings offline. Frames are estimated
+	/// default_batch_width at a time with the batch calculations, and kq is solved for with a fixed number of Gauss-Newton
+	/// iterations on the residuals of the generic solver for any number of glints, the same for every frame, so that
+	/// there are no branches per frame and no problem setup. Glints of a frame that are invalid are masked out of the
+	/// residuals, so frames with different glints share a batch. There are no filters and no tracking, as those depend on
+	/// the order of the frames, so estimate_batch can split a recording over all cores.
+	class BatchedOneCamSphericalGE : public GazeEstimationMethod<EyeAndCameraParameters, PupilCenterGlintInputs, DefaultGazeEstimationResult>
+	{
+	public:
+		/// Enough for kq to converge from distance_to_camera_estimate for eyes within the usual distances.
+		static const int default_iterations = 8;
+
+		BatchedOneCamSphericalGE() = default;
+		/// \param	iterations	The Gauss-Newton iterations for kq of every frame. Frames whose last step was still above the
+		///						tolerance of the two glint solver have their solver termination set to NoConvergence. Frames
+		///						whose steps stopped being finite are returned as SolverFailed errors.
+		explicit BatchedOneCamSphericalGE(bool use_chen_noise_reduction, int iterations = default_iterations);
+
+		/// \brief Sets the counters every estimate of this and of its clones is recorded in, nullptr to record none.
+		void setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters);
+
+		/// Same as estimate_range with a single frame, which leaves all but one lane unused.
+		DefaultGazeEstimationResult estimate(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters) override;
+		/// Uses the glints of the first light_positions.size() glints of each frame, up to max_glints_per_camera.
+		void estimate_range(const PupilCenterGlintInputs* first, const PupilCenterGlintInputs* last, DefaultGazeEstimationResult* results,
+			const EyeAndCameraParameters& parameters) override;
+		std::unique_ptr<GazeEstimationMethod> clone() const override;
+
+	private:
+		bool use_chen_noise_reduction = false;
+		int iterations = default_iterations;
+
+		std::shared_ptr<TelemetryCounters> telemetry_counters;
+	};
+
+}
+
+#endif
@@ -0,0 +1,730 @@
+/// Benchmarks the estimators, the calibration and the input readers against recordings of the setups of ExampleSetups.hpp.
+///
+/// gaze-estimation-benchmark [--onecamera file] [--calibration file] [--twocamera file] [--synthetic frames]
+///                           [--baseline file] [--save-baseline file] [--tolerance fraction]
+///
+/// --onecamera and --calibration take recordings in the format of input_test.txt, --twocamera one in the format read by
+/// run_twocamera. --synthetic generates the given number of frames per case with SyntheticFrameGenerator, for the one
+/// camera setup with 2, 4 and 8 lights and for the two camera setup with and without a third camera, and also runs the
+/// single precision estimation path on some of them, reporting how far its results are from those in double. The one
+/// camera setups are also run with BatchedOneCamSphericalGE, on the calling thread and with estimate_batch on all
+/// cores, and the one with 2 lights with a GazeLookupTable built for it, and the output stage publishes and logs its
+/// results as GazeRecords, timed on the estimation thread. Cases whose recording is not given or empty are skipped.
+/// Every case reports the p50, p99 and max latency in microseconds per frame (per calibration for the calibration case)
+/// and the throughput per second. --save-baseline writes the results to a file that a later run can compare against
+/// with --baseline. The comparison fails the run if the p50 or p99 latency or the throughput of a case got worse by
+/// more than the tolerance (default 0.1).
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BatchedOneCameraSpherical.hpp"
+#include "ExampleSetups.hpp"
+#include "GazeLookupTable.hpp"
+#include "GazeOutput.hpp"
+#include "GenericCalibration.hpp"
+#include "InputOutputHelpers.hpp"
+#include "OneCameraSpherical.hpp"
+#include "OneCameraSphericalScalar.hpp"
+#include "SyntheticData.hpp"
+#include "TwoCameraSpherical.hpp"
+#include "TwoCameraSphericalScalar.hpp"
+
+using namespace gazeestimation;
+
+namespace {
+
+	typedef std::chrono::steady_clock Clock;
+
+	/// keeps the compiler from removing the work whose results are otherwise unused
+	volatile size_t benchmark_sink = 0;
+
+	struct BenchmarkResult
+	{
+		std::string name;
+		double p50_us;
+		double p99_us;
+		double max_us;
+		double per_second;
+	};
+
+	/// How far the single precision results of a case are from the double results on the same inputs.
+	struct AccuracyResult
+	{
+		std::string name;
+		double mean_visual_axis_deg;
+		double max_visual_axis_deg;
+		double max_cornea_center_cm;
+		/// the number of inputs only one of the two could estimate
+		size_t mismatched;
+	};
+
+	double to_us(Clock::duration duration)
+	{
+		return std::chrono::duration<double, std::micro>(duration).count();
+	}
+
+	/// Nearest rank percentile of sorted values, which must not be empty.
+	double percentile(const std::vector<double>& sorted, double fraction)
+	{
+		const size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+		return sorted[std::max<size_t>(rank, 1) - 1];
+	}
+
+	/// Items per second for items processed in total_us, 0 if the run was too short for the clock to measure.
+	double throughput(double items, double total_us)
+	{
+		return total_us > 0 ? items / (total_us * 1e-6) : 0;
+	}
+
+	/// \param	latencies_us	The time taken per item, at least one. Cases without items are skipped by main.
+	/// \param	per_second		The throughput in items per second.
+	BenchmarkResult summarize(const std::string& name, std::vector<double> latencies_us, double per_second)
+	{
+		std::sort(latencies_us.begin(), latencies_us.end());
+		BenchmarkResult result;
+		result.name = name;
+		result.p50_us = percentile(latencies_us, 0.5);
+		result.p99_us = percentile(latencies_us, 0.99);
+		result.max_us = latencies_us.back();
+		result.per_second = per_second;
+		return result;
+	}
+
+	/// Times every estimate on its own for the latencies, and all of them in one estimate_range for the throughput,
+	/// each after a pass that is not measured.
+	template <class Method>
+	BenchmarkResult benchmark_estimator(const std::string& name, Method& method, const std::vector<PupilCenterGlintInputs>& inputs,
+		const EyeAndCameraParameters& parameters)
+	{
+		std::vector<DefaultGazeEstimationResult> results(inputs.size());
+		method.estimate_range(inputs.data(), inputs.data() + inputs.size(), results.data(), parameters);
+
+		const PreparedParameters prepared(parameters);
+		std::vector<double> latencies_us;
+		latencies_us.reserve(inputs.size());
+		size_t valid = 0;
+		for (const auto& input : inputs)
+		{
+			const Clock::time_point before = Clock::now();
+			const DefaultGazeEstimationResult result = method.estimate(input, prepared);
+			const Clock::time_point after = Clock::now();
+			latencies_us.push_back(to_us(after - before));
+			valid += result.is_valid ? 1 : 0;
+		}
+
+		const Clock::time_point start = Clock::now();
+		method.estimate_range(inputs.data(), inputs.data() + inputs.size(), results.data(), parameters);
+		const double total_us = to_us(Clock::now() - start);
+		for (const auto& result : results)
+		{
+			valid += result.is_valid ? 1 : 0;
+		}
+		benchmark_sink = benchmark_sink + valid;
+
+		return summarize(name, latencies_us, throughput(static_cast<double>(inputs.size()), total_us));
+	}
+
+	/// Times estimate_scalar in single precision per frame for the latencies, and all frames in one pass for the
+	/// throughput, each after a pass that is not measured. accuracy receives the differences to estimate in double.
+	template <class Method>
+	BenchmarkResult benchmark_single_precision(const std::string& name, Method& method, const std::vector<PupilCenterGlintInputs>& inputs,
+		const EyeAndCameraParameters& parameters, AccuracyResult& accuracy)
+	{
+		const EyeAndCameraParametersT<float> parameters_float = parameters.cast<float>();
+		std::vector<DifferentiableGazeEstimationResult<float>> results(inputs.size());
+		std::vector<char> valid(inputs.size());
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			valid[i] = method.estimate_scalar(inputs[i], parameters_float, results[i]);
+		}
+
+		std::vector<double> latencies_us;
+		latencies_us.reserve(inputs.size());
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			const Clock::time_point before = Clock::now();
+			method.estimate_scalar(inputs[i], parameters_float, results[i]);
+			latencies_us.push_back(to_us(Clock::now() - before));
+		}
+
+		const Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			method.estimate_scalar(inputs[i], parameters_float, results[i]);
+		}
+		const double total_us = to_us(Clock::now() - start);
+
+		accuracy = AccuracyResult();
+		accuracy.name = name;
+		const PreparedParameters prepared(parameters);
+		size_t compared = 0;
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			const DefaultGazeEstimationResult reference = method.estimate(inputs[i], prepared);
+			if (reference.is_valid != static_cast<bool>(valid[i]))
+			{
+				accuracy.mismatched++;
+				continue;
+			}
+			if (!reference.is_valid)
+				continue;
+
+			const Vec3 visual_axis = normalized(Vec3(results[i].visual_axis.cast<double>()));
+			const double angle_deg = std::acos(std::min(1.0, dot(visual_axis, reference.visual_axis))) * 180 / 3.141592653589793;
+			accuracy.mean_visual_axis_deg += angle_deg;
+			accuracy.max_visual_axis_deg = std::max(accuracy.max_visual_axis_deg, angle_deg);
+			accuracy.max_cornea_center_cm = std::max(accuracy.max_cornea_center_cm,
+				length(Vec3(results[i].center_of_cornea.cast<double>() - reference.center_of_cornea)));
+			compared++;
+		}
+		accuracy.mean_visual_axis_deg /= static_cast<double>(std::max<size_t>(compared, 1));
+
+		benchmark_sink = benchmark_sink + compared;
+		return summarize(name, latencies_us, throughput(static_cast<double>(inputs.size()), total_us));
+	}
+
+	/// Runs a function that processes items a few times, the latencies are the time per item of each run.
+	template <class Function>
+	BenchmarkResult benchmark_repeated(const std::string& name, unsigned int repetitions, Function function)
+	{
+		function();
+
+		std::vector<double> latencies_us;
+		double total_us = 0;
+		double total_items = 0;
+		for (unsigned int i = 0; i < repetitions; i++)
+		{
+			const Clock::time_point start = Clock::now();
+			const size_t items = function();
+			const double run_us = to_us(Clock::now() - start);
+			latencies_us.push_back(run_us / static_cast<double>(std::max<size_t>(items, 1)));
+			total_us += run_us;
+			total_items += static_cast<double>(items);
+		}
+		return summarize(name, latencies_us, throughput(total_items, total_us));
+	}
+
+	std::vector<BenchmarkResult> benchmark_calibration(const std::vector<std::pair<PupilCenterGlintInputs, Vec2>>& calibration_data)
+	{
+		typedef GenericCalibration<EyeAndCameraParameters, PupilCenterGlintInputs, DefaultGazeEstimationResult> Calibration;
+		const ExampleSetup setup = make_onecamera_setup();
+
+		Calibration::CalibrationDataMap calibrate_against;
+		for (const auto& sample : calibration_data)
+		{
+			calibrate_against.push_back(std::make_pair(sample.first,
+				make_vec3(sample.second[0] * setup.screen_pixel_size_x, -sample.second[1] * setup.screen_pixel_size_y, 0)));
+		}
+
+		const std::vector<std::vector<double>> initial_values = {
+			{ setup.parameters.alpha },
+			{ setup.parameters.beta },
+			{ setup.parameters.R },
+			{ setup.parameters.K },
+			{ setup.parameters.cameras[0].camera_angle_y() },
+			{ setup.parameters.cameras[0].camera_angle_z() } };
+		const std::vector<std::vector<std::pair<double, double>>> bounds = {
+			{ std::make_pair(deg_to_rad(-10), deg_to_rad(10)) },
+			{ std::make_pair(deg_to_rad(-5), deg_to_rad(5)) },
+			{ std::make_pair(0.3, 2.0) },
+			{ std::make_pair(0.2, 1.5) },
+			{ std::make_pair(deg_to_rad(-8), deg_to_rad(8)) },
+			{ std::make_pair(deg_to_rad(-5), deg_to_rad(5)) } };
+
+		const double z_shift = setup.z_shift;
+		const Vec3 wcs_offset = setup.wcs_offset;
+		auto result_processor = [z_shift, wcs_offset](const DefaultGazeEstimationResult& result) -> Vec3 {
+			return calculate_point_of_interest(result.center_of_cornea, result.visual_axis, z_shift) - wcs_offset;
+		};
+
+		std::vector<BenchmarkResult> results;
+		results.push_back(benchmark_repeated("calibrate_numeric", 3, [&]() {
+			OneCamSphericalGE estimation;
+			EyeAndCameraParameters parameters = setup.parameters;
+			Calibration calibration;
+
+			// without the report of the solver, which would drown the results
+			const auto result = calibration.calibrate(estimation, parameters, six_variable_calibration_applicator, result_processor,
+				calibrate_against, initial_values, bounds, 0, false);
+
+			benchmark_sink = benchmark_sink + result.size();
+			return static_cast<size_t>(1);
+		}));
+
+		// the wall time of a whole multi-start calibration, to compare with the single start above
+		const unsigned int num_starts = 8;
+		results.push_back(benchmark_repeated("calibrate_numeric_multistart8", 3, [&]() {
+			OneCamSphericalGE estimation;
+			Calibration calibration;
+			const auto result = calibration.calibrate_multistart(estimation, setup.parameters, six_variable_calibration_applicator,
+				result_processor, calibrate_against, initial_values, bounds, num_starts);
+
+			benchmark_sink = benchmark_sink + result.best_start;
+			return static_cast<size_t>(1);
+		}));
+		return results;
+	}
+
+	std::vector<BenchmarkResult> benchmark_readers(const std::string& name, const std::string& filename, CsvFrameReader::Layout layout)
+	{
+		std::vector<BenchmarkResult> results;
+
+		if (layout == CsvFrameReader::OneCamera)
+		{
+			results.push_back(benchmark_repeated(name + "_read_input_file", 5, [&]() {
+				return read_input_file(std::wstring(filename.begin(), filename.end())).size();
+			}));
+		}
+
+		results.push_back(benchmark_repeated(name + "_csv_frame_reader", 5, [&]() {
+			CsvFrameReader reader(filename.c_str(), layout);
+			CsvFrameReader::Frame frame;
+			size_t frames = 0;
+			while (reader.next(frame))
+			{
+				frames++;
+			}
+			return frames;
+		}));
+
+		const std::string binary_filename = filename + ".benchmark.bin";
+		convert_csv_to_binary_recording(filename.c_str(), layout, binary_filename.c_str());
+		results.push_back(benchmark_repeated(name + "_binary_recording_reader", 5, [&]() {
+			BinaryRecordingReader reader(binary_filename.c_str());
+			PupilCenterGlintInputs data;
+			Vec2 truth;
+			for (size_t i = 0; i < reader.num_frames(); i++)
+			{
+				reader.frame(i, data, &truth);
+			}
+			benchmark_sink = benchmark_sink + data.data.size();
+			return reader.num_frames();
+		}));
+		std::remove(binary_filename.c_str());
+
+		return results;
+	}
+
+	std::vector<PupilCenterGlintInputs> read_inputs(const std::string& filename, CsvFrameReader::Layout layout)
+	{
+		std::vector<PupilCenterGlintInputs> inputs;
+		CsvFrameReader reader(filename.c_str(), layout);
+		CsvFrameReader::Frame frame;
+		while (reader.next(frame))
+		{
+			inputs.push_back(frame.first);
+		}
+		return inputs;
+	}
+
+	/// Generates num_frames frames of the setup for eyes in front of the cameras looking at the screen area given in the
+	/// coordinates of the truth of the setup.
+	std::vector<PupilCenterGlintInputs> generate_inputs(const ExampleSetup& setup, const Vec2& truth_min, const Vec2& truth_max,
+		size_t num_frames)
+	{
+		SyntheticFrameGenerator generator(setup.parameters, make_synthetic_scene(setup, truth_min, truth_max));
+		std::vector<PupilCenterGlintInputs> inputs(num_frames);
+		SyntheticFrameTruth truth;
+		for (auto& input : inputs)
+		{
+			generator.next(input, truth);
+		}
+		return inputs;
+	}
+
+	/// The one camera setup with num_lights lights evenly spaced on an ellipse around the camera, starting with the two
+	/// lights of the setup.
+	ExampleSetup make_onecamera_setup_with_lights(unsigned int num_lights)
+	{
+		ExampleSetup setup = make_onecamera_setup();
+		const Vec3 camera_position = setup.parameters.cameras[0].position();
+		setup.parameters.light_positions.clear();
+		for (unsigned int i = 0; i < num_lights; i++)
+		{
+			const double angle = 2 * 3.141592653589793 * i / num_lights;
+			setup.parameters.light_positions.push_back(camera_position + make_vec3(13 * std::cos(angle), 8 * std::sin(angle), 0));
+		}
+		return setup;
+	}
+
+	/// The two camera setup with a third camera of the same kind centered between the two, which looks up at the eye.
+	ExampleSetup make_threecamera_setup()
+	{
+		ExampleSetup setup = make_twocamera_setup();
+		PinholeCameraModel camera = setup.parameters.cameras[0];
+		camera.set_position(make_vec3(0, -21, 2) + setup.wcs_offset);
+		camera.set_camera_angles(deg_to_rad(-27.70716514), 0, 0);
+		setup.parameters.cameras.push_back(camera);
+		return setup;
+	}
+
+	std::vector<BenchmarkResult> benchmark_synthetic(size_t num_frames, std::vector<AccuracyResult>& accuracy)
+	{
+		std::vector<BenchmarkResult> results;
+		const Vec2 onecamera_truth_min = make_vec2(0, 0);
+		const Vec2 onecamera_truth_max = make_vec2(1680, 1050);
+		WorkerPool pool;
+
+		for (unsigned int num_lights : { 2u, 4u, 8u })
+		{
+			const ExampleSetup setup = make_onecamera_setup_with_lights(num_lights);
+			const std::vector<PupilCenterGlintInputs> inputs = generate_inputs(setup, onecamera_truth_min, onecamera_truth_max, num_frames);
+			OneCamSphericalGE estimation(false);
+			results.push_back(benchmark_estimator("synthetic_onecamera_lights" + std::to_string(num_lights), estimation, inputs, 
+				setup.parameters));
+			if (num_lights > 2)
+			{
+				OneCamSphericalGE common_center(false);
+				common_center.setCorneaResiduals(OneCamSphericalGE::CommonCenterResiduals);
+				results.push_back(benchmark_estimator("synthetic_onecamera_lights" + std::to_string(num_lights) + "_common_center",
+					common_center, inputs, setup.parameters));
+			}
+			if (num_lights == 8)
+			{
+				// the tail latency with the solve of each frame stopped after 50 us, a twentieth of a frame at 1 kHz
+				OneCamSphericalGE budgeted(false);
+				SolverBudget budget;
+				budget.frame_deadline_seconds = 50e-6;
+				budgeted.setSolverBudget(budget);
+				results.push_back(benchmark_estimator("synthetic_onecamera_lights" + std::to_string(num_lights) + "_deadline",
+					budgeted, inputs, setup.parameters));
+			}
+
+			// the batched estimator estimates whole ranges only, so its latencies are per frame of a range
+			BatchedOneCamSphericalGE batched;
+			std::vector<DefaultGazeEstimationResult> batched_results(inputs.size());
+			results.push_back(benchmark_repeated("synthetic_onecamera_lights" + std::to_string(num_lights) + "_batched", 3, [&]() {
+				batched.estimate_range(inputs.data(), inputs.data() + inputs.size(), batched_results.data(), setup.parameters);
+				return inputs.size();
+			}));
+			results.push_back(benchmark_repeated("synthetic_onecamera_lights" + std::to_string(num_lights) + "_batched_pool", 3, [&]() {
+				batched.estimate_batch(inputs.data(), inputs.data() + inputs.size(), batched_results.data(), setup.parameters, pool);
+				return inputs.size();
+			}));
+
+			if (num_lights == 2)
+			{
+				// the solver the single precision path can run in float throughout
+				OneCamSphericalGE newton(false, OneCamSphericalGE::TwoGlintNewtonSolver);
+				results.push_back(benchmark_estimator("synthetic_onecamera_lights2_newton", newton, inputs, setup.parameters));
+				accuracy.push_back(AccuracyResult());
+				results.push_back(benchmark_single_precision("synthetic_onecamera_lights2_newton_float", newton, inputs,
+					setup.parameters, accuracy.back()));
+
+				const double z_shift = setup.z_shift;
+				const Vec3 wcs_offset = setup.wcs_offset;
+				const GazeLookupTable table = GazeLookupTable::build(newton, setup.parameters,
+					[z_shift, wcs_offset](const DefaultGazeEstimationResult& result) -> Vec3 {
+						return calculate_point_of_interest(result.center_of_cornea, result.visual_axis, z_shift) - wcs_offset;
+					},
+					make_synthetic_scene(setup, onecamera_truth_min, onecamera_truth_max));
+				results.push_back(benchmark_repeated("synthetic_onecamera_lights2_lookup_table", 3, [&]() {
+					Vec3 point;
+					size_t found = 0;
+					for (const auto& input : inputs)
+					{
+						found += table.lookup(input, point) ? 1 : 0;
+					}
+					benchmark_sink = benchmark_sink + found;
+					return inputs.size();
+				}));
+			}
+		}
+
+		{
+			const ExampleSetup setup = make_twocamera_setup();
+			const std::vector<PupilCenterGlintInputs> inputs = generate_inputs(setup, make_vec2(-20, -12), make_vec2(20, 12), num_frames);
+			TwoCamSphericalGE estimation(TwoCamSphericalGE::ExplicitRefraction2, TwoCamSphericalGE::TwoLightSolver);
+			results.push_back(benchmark_estimator("synthetic_twocamera_refraction2", estimation, inputs, setup.parameters));
+			accuracy.push_back(AccuracyResult());
+			results.push_back(benchmark_single_precision("synthetic_twocamera_refraction2_float", estimation, inputs,
+				setup.parameters, accuracy.back()));
+		}
+
+		{
+			const ExampleSetup setup = make_threecamera_setup();
+			const std::vector<PupilCenterGlintInputs> inputs = generate_inputs(setup, make_vec2(-20, -12), make_vec2(20, 12), num_frames);
+			TwoCamSphericalGE refraction1(TwoCamSphericalGE::ExplicitRefraction1);
+			results.push_back(benchmark_estimator("synthetic_threecamera_refraction1", refraction1, inputs, setup.parameters));
+			TwoCamSphericalGE refraction2(TwoCamSphericalGE::ExplicitRefraction2);
+			results.push_back(benchmark_estimator("synthetic_threecamera_refraction2", refraction2, inputs, setup.parameters));
+		}
+
+		{
+			const ExampleSetup setup = make_onecamera_setup();
+			const std::vector<PupilCenterGlintInputs> inputs = generate_inputs(setup, onecamera_truth_min, onecamera_truth_max, num_frames);
+			OneCamSphericalGE estimation(false, OneCamSphericalGE::TwoGlintNewtonSolver);
+			std::vector<GazeRecord> records;
+			for (size_t i = 0; i < inputs.size(); i++)
+			{
+				const DefaultGazeEstimationResult result = estimation.estimate(inputs[i], setup.parameters);
+				records.push_back(make_gaze_record(result, 
+					calculate_point_of_interest(result.center_of_cornea, result.visual_axis, setup.z_shift), i, i));
+			}
+
+			SharedGazePublisher publisher("gaze-estimation-benchmark");
+			results.push_back(benchmark_repeated("synthetic_gaze_record_publish", 3, [&]() {
+				for (const auto& record : records)
+				{
+					publisher.publish(record);
+				}
+				return records.size();
+			}));
+
+			// room for all repetitions, so that the writer thread falling behind does not turn writes into drops
+			const std::string filename = "gaze-estimation-benchmark.gazeout";
+			{
+				AsyncGazeRecordWriter writer(filename.c_str(), 4 * records.size());
+				results.push_back(benchmark_repeated("synthetic_gaze_record_async_write", 3, [&]() {
+					for (const auto& record : records)
+					{
+						writer.write(record);
+					}
+					return records.size();
+				}));
+			}
+			std::remove(filename.c_str());
+		}
+
+		const ExampleSetup setup = make_onecamera_setup();
+		results.push_back(benchmark_repeated("synthetic_generator", 3, [&]() {
+			return generate_inputs(setup, onecamera_truth_min, onecamera_truth_max, num_frames).size();
+		}));
+
+		return results;
+	}
+
+	std::map<std::string, BenchmarkResult> read_baseline(const std::string& filename)
+	{
+		std::map<std::string, BenchmarkResult> baseline;
+		std::ifstream input(filename);
+		std::string line;
+		while (std::getline(input, line))
+		{
+			std::istringstream fields(line);
+			BenchmarkResult result;
+			if (fields >> result.name >> result.p50_us >> result.p99_us >> result.max_us >> result.per_second)
+			{
+				baseline[result.name] = result;
+			}
+		}
+		return baseline;
+	}
+
+	void write_baseline(const std::string& filename, const std::vector<BenchmarkResult>& results)
+	{
+		std::ofstream output(filename);
+		for (const auto& result : results)
+		{
+			output << result.name << "\t" << result.p50_us << "\t" << result.p99_us << "\t" << result.max_us << "\t"
+				<< result.per_second << "\n";
+		}
+	}
+
+	/// Returns the relative change of value against the baseline, positive where value is worse. A baseline of 0 has
+	/// nothing to compare against and gives 0.
+	double relative_change(double value, double baseline, bool higher_is_better)
+	{
+		if (baseline == 0)
+			return 0;
+		return higher_is_better ? 1 - value / baseline : value / baseline - 1;
+	}
+
+	/// Parses all of value as a count. Throws std::invalid_argument or std::out_of_range if it is not one.
+	size_t parse_count(const std::string& value)
+	{
+		// std::stoul wraps negative values around instead of rejecting them
+		if (value.find('-') != std::string::npos)
+			throw std::invalid_argument(value);
+		size_t parsed = 0;
+		const unsigned long count = std::stoul(value, &parsed);
+		if (parsed != value.size())
+			throw std::invalid_argument(value);
+		return static_cast<size_t>(count);
+	}
+
+	/// Parses all of value as a number. Throws std::invalid_argument or std::out_of_range if it is not one.
+	double parse_number(const std::string& value)
+	{
+		size_t parsed = 0;
+		const double number = std::stod(value, &parsed);
+		if (parsed != value.size())
+			throw std::invalid_argument(value);
+		return number;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::string onecamera_filename;
+	std::string calibration_filename;
+	std::string twocamera_filename;
+	size_t synthetic_frames = 0;
+	std::string baseline_filename;
+	std::string save_baseline_filename;
+	double tolerance = 0.1;
+
+	for (int i = 1; i < argc; i += 2)
+	{
+		const std::string option = argv[i];
+		if (i + 1 == argc)
+		{
+			std::cerr << "missing value for option " << option << std::endl;
+			return 2;
+		}
+		const std::string value = argv[i + 1];
+		try
+		{
+			if (option == "--onecamera")
+				onecamera_filename = value;
+			else if (option == "--calibration")
+				calibration_filename = value;
+			else if (option == "--twocamera")
+				twocamera_filename = value;
+			else if (option == "--synthetic")
+				synthetic_frames = parse_count(value);
+			else if (option == "--baseline")
+				baseline_filename = value;
+			else if (option == "--save-baseline")
+				save_baseline_filename = value;
+			else if (option == "--tolerance")
+				tolerance = parse_number(value);
+			else
+			{
+				std::cerr << "unknown option " << option << std::endl;
+				return 2;
+			}
+		}
+		catch (const std::logic_error&)
+		{
+			std::cerr << "invalid value " << value << " for option " << option << std::endl;
+			return 2;
+		}
+	}
+
+	std::vector<BenchmarkResult> results;
+	std::vector<AccuracyResult> accuracy;
+
+	if (!onecamera_filename.empty())
+	{
+		const ExampleSetup setup = make_onecamera_setup();
+		const std::vector<PupilCenterGlintInputs> inputs = read_inputs(onecamera_filename, CsvFrameReader::OneCamera);
+
+		if (inputs.empty())
+		{
+			std::cerr << "no frames in " << onecamera_filename << ", skipping its cases" << std::endl;
+		}
+		else
+		{
+			OneCamSphericalGE plain(false);
+			results.push_back(benchmark_estimator("onecamera", plain, inputs, setup.parameters));
+			OneCamSphericalGE chen(true);
+			results.push_back(benchmark_estimator("onecamera_chen", chen, inputs, setup.parameters));
+
+			const std::vector<BenchmarkResult> reader_results =
+				benchmark_readers("onecamera", onecamera_filename, CsvFrameReader::OneCamera);
+			results.insert(results.end(), reader_results.begin(), reader_results.end());
+		}
+	}
+
+	if (!calibration_filename.empty())
+	{
+		const std::vector<std::pair<PupilCenterGlintInputs, Vec2>> calibration_data =
+			read_input_file(std::wstring(calibration_filename.begin(), calibration_filename.end()));
+		if (calibration_data.empty())
+		{
+			std::cerr << "no frames in " << calibration_filename << ", skipping its cases" << std::endl;
+		}
+		else
+		{
+			const std::vector<BenchmarkResult> calibration_results = benchmark_calibration(calibration_data);
+			results.insert(results.end(), calibration_results.begin(), calibration_results.end());
+		}
+	}
+
+	if (!twocamera_filename.empty())
+	{
+		const ExampleSetup setup = make_twocamera_setup();
+		const std::vector<PupilCenterGlintInputs> inputs = read_inputs(twocamera_filename, CsvFrameReader::TwoCameras);
+
+		if (inputs.empty())
+		{
+			std::cerr << "no frames in " << twocamera_filename << ", skipping its cases" << std::endl;
+		}
+		else
+		{
+			TwoCamSphericalGE refraction1(TwoCamSphericalGE::ExplicitRefraction1, TwoCamSphericalGE::TwoLightSolver);
+			results.push_back(benchmark_estimator("twocamera_refraction1", refraction1, inputs, setup.parameters));
+			TwoCamSphericalGE refraction2(TwoCamSphericalGE::ExplicitRefraction2, TwoCamSphericalGE::TwoLightSolver);
+			results.push_back(benchmark_estimator("twocamera_refraction2", refraction2, inputs, setup.parameters));
+
+			const std::vector<BenchmarkResult> reader_results =
+				benchmark_readers("twocamera", twocamera_filename, CsvFrameReader::TwoCameras);
+			results.insert(results.end(), reader_results.begin(), reader_results.end());
+		}
+	}
+
+	if (synthetic_frames > 0)
+	{
+		const std::vector<BenchmarkResult> synthetic_results = benchmark_synthetic(synthetic_frames, accuracy);
+		results.insert(results.end(), synthetic_results.begin(), synthetic_results.end());
+	}
+
+	if (results.empty())
+	{
+		std::cerr << "no recordings with frames or synthetic frames given, see the top of Benchmark.cpp for the options" << std::endl;
+		return 2;
+	}
+
+	const std::map<std::string, BenchmarkResult> baseline = baseline_filename.empty()
+		? std::map<std::string, BenchmarkResult>() : read_baseline(baseline_filename);
+
+	bool regressed = false;
+	std::printf("%-44s %12s %12s %12s %14s\n", "case", "p50 us", "p99 us", "max us", "per second");
+	for (const auto& result : results)
+	{
+		std::printf("%-44s %12.2f %12.2f %12.2f %14.1f", result.name.c_str(), result.p50_us, result.p99_us, result.max_us, result.per_second);
+
+		const auto base = baseline.find(result.name);
+		if (base != baseline.end())
+		{
+			const double p50_change = relative_change(result.p50_us, base->second.p50_us, false);
+			const double p99_change = relative_change(result.p99_us, base->second.p99_us, false);
+			const double throughput_change = relative_change(result.per_second, base->second.per_second, true);
+			const bool case_regressed = p50_change > tolerance || p99_change > tolerance || throughput_change > tolerance;
+			regressed = regressed || case_regressed;
+			std::printf("   p50 %+6.1f%% p99 %+6.1f%% throughput %+6.1f%%%s", 100 * p50_change, 100 * p99_change,
+				-100 * throughput_change, case_regressed ? "   REGRESSION" : "");
+		}
+		std::printf("\n");
+	}
+
+	if (!accuracy.empty())
+	{
+		std::printf("\n%-44s %12s %12s %14s %10s\n", "single precision against double", "mean deg", "max deg", "max cornea cm",
+			"mismatched");
+		for (const auto& result : accuracy)
+		{
+			std::printf("%-44s %12.4f %12.4f %14.6f %10zu\n", result.name.c_str(), result.mean_visual_axis_deg,
+				result.max_visual_axis_deg, result.max_cornea_center_cm, result.mismatched);
+		}
+	}
+
+	if (!save_baseline_filename.empty())
+	{
+		write_baseline(save_baseline_filename, results);
+	}
+
+	return regressed ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+#ifndef BINARY_RECORDING_HPP_INCLUDED
+#define BINARY_RECORDING_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "GazeEstimationTypes.hpp"
+
+/// \brief The fixed size header of a binary recording, followed by num_frames records of record_size() doubles each:
+/// truth x, y if has_truth, then per camera pupil x, y and glints_per_camera glints x, y.
+/// All values are in the byte order of the machine that wrote them, i.e. little endian for the targets we build for.
+struct BinaryRecordingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_cameras;
+	uint32_t glints_per_camera;
+	uint32_t has_truth;
+	uint64_t num_frames;
+
+	static const uint32_t current_version = 1;
+
+	size_t record_size() const
+	{
+		return (has_truth ? 2 : 0) + num_cameras * (2 + 2 * static_cast<size_t>(glints_per_camera));
+	}
+};
+
+static_assert(sizeof(BinaryRecordingHeader) == 32, "the records must start 8 byte aligned after the header");
+
+inline const char* binary_recording_magic()
+{
+	return "GAZEREC";
+}
+
+/// \brief Writes a binary recording frame by frame. The number of frames in the header is written by finish(),
+/// which the destructor calls if it has not been called before.
+class BinaryRecordingWriter
+{
+public:
+	/// Throws std::runtime_error if the file cannot be written.
+	BinaryRecordingWriter(const char* filename, unsigned int num_cameras, unsigned int glints_per_camera, bool has_truth) :
+		output(filename, std::ios::binary | std::ios::trunc)
+	{
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, binary_recording_magic(), sizeof(header.magic));
+		header.version = BinaryRecordingHeader::current_version;
+		header.num_cameras = num_cameras;
+		header.glints_per_camera = glints_per_camera;
+		header.has_truth = has_truth ? 1 : 0;
+		record.resize(header.record_size());
+
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (!output)
+			throw std::runtime_error(std::string("Couldn't write to ") + filename);
+	}
+
+	~BinaryRecordingWriter()
+	{
+		try
+		{
+			finish();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	BinaryRecordingWriter(const BinaryRecordingWriter&) = delete;
+	BinaryRecordingWriter& operator=(const BinaryRecordingWriter&) = delete;
+
+	/// Appends a frame. truth is ignored if the recording has none. Throws std::invalid_argument if the frame does not 
+	/// have the number of cameras and glints of the recording, std::runtime_error if writing fails.
+	void write(const gazeestimation::PupilCenterGlintInputs& data, const gazeestimation::Vec2& truth)
+	{
+		if (data.data.size() != header.num_cameras)
+			throw std::invalid_argument("frame does not have the number of cameras of the recording");
+
+		size_t index = 0;
+		if (header.has_truth)
+		{
+			record[index++] = truth[0];
+			record[index++] = truth[1];
+		}
+		for (const auto& camera : data.data)
+		{
+			if (camera.glints.size() != header.glints_per_camera)
+				throw std::invalid_argument("frame does not have the number of glints of the recording");
+
+			record[index++] = camera.pupil_center[0];
+			record[index++] = camera.pupil_center[1];
+			for (const auto& glint : camera.glints)
+			{
+				record[index++] = glint[0];
+				record[index++] = glint[1];
+			}
+		}
+
+		output.write(reinterpret_cast<const char*>(record.data()), record.size() * sizeof(double));
+		if (!output)
+			throw std::runtime_error("Couldn't write frame to the recording");
+		header.num_frames++;
+	}
+
+	/// Writes the number of frames into the header and closes the file. Throws std::runtime_error if that fails.
+	void finish()
+	{
+		if (!output.is_open())
+			return;
+
+		output.seekp(0);
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output.close();
+		if (!output)
+			throw std::runtime_error("Couldn't finish the recording");
+	}
+
+private:
+	std::ofstream output;
+	BinaryRecordingHeader header;
+	std::vector<double> record;
+};
+
+/// \brief Gives random access to the frames of a binary recording through a memory mapping of the file.
+/// Frames are copied out of the records as they are, nothing needs to be parsed.
+class BinaryRecordingReader
+{
+public:
+	/// Throws boost::interprocess::interprocess_exception if the file cannot be mapped and std::runtime_error if it is
+	/// not a complete recording of the current version.
+	explicit BinaryRecordingReader(const char* filename) :
+		mapping(filename, boost::interprocess::read_only),
+		region(mapping, boost::interprocess::read_only)
+	{
+		if (region.get_size() < sizeof(BinaryRecordingHeader))
+			throw std::runtime_error(std::string(filename) + " is not a binary recording");
+
+		std::memcpy(&header, region.get_address(), sizeof(header));
+		if (std::memcmp(header.magic, binary_recording_magic(), sizeof(header.magic)) != 0 
+			|| header.version != BinaryRecordingHeader::current_version || header.record_size() == 0)
+			throw std::runtime_error(std::string(filename) + " is not a binary recording of version "
+				+ std::to_string(BinaryRecordingHeader::current_version));
+
+		if (header.num_cameras > gazeestimation::max_cameras || header.glints_per_camera > gazeestimation::max_glints_per_camera)
+			throw std::runtime_error(std::string(filename) + " has more cameras or glints than supported");
+
+		if ((region.get_size() - sizeof(header)) / sizeof(double) / header.record_size() < header.num_frames)
+			throw std::runtime_error(std::string(filename) + " is truncated");
+
+		records = reinterpret_cast<const double*>(static_cast<const char*>(region.get_address()) + sizeof(header));
+	}
+
+	size_t num_frames() const
+	{
+		return static_cast<size_t>(header.num_frames);
+	}
+
+	unsigned int num_cameras() const
+	{
+		return header.num_cameras;
+	}
+
+	unsigned int glints_per_camera() const
+	{
+		return header.glints_per_camera;
+	}
+
+	bool has_truth() const
+	{
+		return header.has_truth != 0;
+	}
+
+	/// Returns the raw record of frame index, see BinaryRecordingHeader for its layout.
+	const double* record(size_t index) const
+	{
+		return records + index * header.record_size();
+	}
+
+	/// Copies frame index into data, reusing the storage it already has, and its truth into truth unless it is null 
+	/// or the recording has no truth.
+	void frame(size_t index, gazeestimation::PupilCenterGlintInputs& data, gazeestimation::Vec2* truth) const
+	{
+		const double* values = record(index);
+		if (header.has_truth)
+		{
+			if (truth)
+			{
+				*truth = gazeestimation::make_vec2(values[0], values[1]);
+			}
+			values += 2;
+		}
+
+		data.data.resize(header.num_cameras);
+		for (auto& camera : data.data)
+		{
+			camera.pupil_center = gazeestimation::make_vec2(values[0], values[1]);
+			values += 2;
+			camera.glints.resize(header.glints_per_camera);
+			for (auto& glint : camera.glints)
+			{
+				glint = gazeestimation::make_vec2(values[0], values[1]);
+				values += 2;
+			}
+		}
+	}
+
+private:
+	boost::interprocess::file_mapping mapping;
+	boost::interprocess::mapped_region region;
+	BinaryRecordingHeader header;
+	const double* records = nullptr;
+};
+
+#endif
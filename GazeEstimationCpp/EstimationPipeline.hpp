@@ -0,0 +1,240 @@
+#ifndef ESTIMATION_PIPELINE_HPP_INCLUDED
+#define ESTIMATION_PIPELINE_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "GazeEstimationTypes.hpp"
+#include "RingBuffer.hpp"
+
+namespace gazeestimation {
+
+	/// \brief Streams frames from a capture thread to estimator threads. The capture thread pushes frames into a
+	/// lock-free ring, each estimator thread takes frames out of it and estimates them with its own clone of the method,
+	/// and results are handed to a callback. If the estimators fall behind, frames are dropped according to the overflow
+	/// policy instead of the capture thread having to wait, so the latency from capture to result stays bounded.
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	class EstimationPipeline
+	{
+	public:
+		typedef GazeEstimationMethod<Parameters, InputData, GazeEstimationResult> Method;
+		/// \brief Receives the sequence number push returned for a frame and the result of the frame. Called on the
+		/// estimator threads, with several estimator threads concurrently and not necessarily in the order of the frames.
+		/// A RingBuffer can be used as an output ring here if there is a single estimator thread.
+		typedef std::function<void(uint64_t, const GazeEstimationResult&)> ResultCallback;
+
+		/// What push does if the ring is full.
+		enum OverflowPolicy
+		{
+			/// drop the oldest queued frame in favour of the new one
+			DropOldest = 0,
+			/// drop the new frame
+			DropNewest
+		};
+
+		/// \param	method	Cloned once per estimator thread. Methods that track state between frames should be run with
+		///					a single estimator thread, so that each clone sees consecutive frames.
+		/// \param	parameters	Copied, used for all frames.
+		/// \param	capacity	The number of frames the ring holds, at least 2.
+		EstimationPipeline(const Method& method, const Parameters& parameters, ResultCallback callback, size_t capacity,
+			unsigned int num_threads = 1, OverflowPolicy policy = DropOldest);
+		/// Stops the estimator threads, see stop.
+		~EstimationPipeline();
+
+		EstimationPipeline(const EstimationPipeline&) = delete;
+		EstimationPipeline& operator=(const EstimationPipeline&) = delete;
+
+		/// \brief Queues a frame, only to be called from a single capture thread. Returns the sequence number of the frame,
+		/// counting from 0 in the order of the calls, also for frames that end up dropped.
+		uint64_t push(const InputData& data);
+
+		/// \brief Estimates the frames that are still queued, then joins the estimator threads. Frames pushed afterwards
+		/// are dropped. Call this from the capture thread or once it no longer pushes.
+		void stop();
+
+		/// The number of frames pushed so far.
+		uint64_t pushed_frames() const;
+		/// The number of frames that were dropped because the ring was full or the pipeline stopped.
+		uint64_t dropped_frames() const;
+		/// The number of frames whose result was handed to the callback.
+		uint64_t estimated_frames() const;
+
+	private:
+		struct Frame
+		{
+			uint64_t sequence;
+			InputData data;
+		};
+
+		void work(Method& method);
+
+		const Parameters parameters;
+		const ResultCallback callback;
+		const OverflowPolicy policy;
+
+		RingBuffer<Frame> frames;
+		std::vector<std::unique_ptr<Method>> methods;
+		std::vector<std::thread> workers;
+
+		std::atomic<uint64_t> next_sequence{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+		std::atomic<uint64_t> estimated{ 0 };
+		std::atomic<bool> stopping{ false };
+
+		// only taken to wake up estimator threads that found the ring empty, never on the way of a frame otherwise
+		std::mutex wake_mutex;
+		std::condition_variable frame_available;
+		std::atomic<unsigned int> sleeping_workers{ 0 };
+	};
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	EstimationPipeline<Parameters, InputData, GazeEstimationResult>::EstimationPipeline(const Method& method,
+		const Parameters& parameters, ResultCallback callback, size_t capacity, unsigned int num_threads, OverflowPolicy policy) :
+		parameters(parameters),
+		callback(std::move(callback)),
+		policy(policy),
+		frames(capacity)
+	{
+		if (num_threads == 0)
+			throw std::invalid_argument("EstimationPipeline needs at least one estimator thread.");
+
+		for (unsigned int i = 0; i < num_threads; i++)
+		{
+			std::unique_ptr<Method> clone = method.clone();
+			if (!clone)
+				throw std::invalid_argument("EstimationPipeline needs a method that can be cloned.");
+			methods.push_back(std::move(clone));
+		}
+
+		for (auto& clone : methods)
+		{
+			Method& worker_method = *clone;
+			workers.emplace_back([this, &worker_method] { work(worker_method); });
+		}
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	EstimationPipeline<Parameters, InputData, GazeEstimationResult>::~EstimationPipeline()
+	{
+		stop();
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	uint64_t EstimationPipeline<Parameters, InputData, GazeEstimationResult>::push(const InputData& data)
+	{
+		const uint64_t sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+		if (stopping.load())
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return sequence;
+		}
+
+		Frame frame;
+		frame.sequence = sequence;
+		frame.data = data;
+		if (policy == DropOldest)
+		{
+			if (frames.push_overwrite(frame))
+				dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		else if (!frames.try_push(frame))
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return sequence;
+		}
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping_workers.load() > 0)
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			frame_available.notify_one();
+		}
+		return sequence;
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	void EstimationPipeline<Parameters, InputData, GazeEstimationResult>::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			stopping.store(true);
+		}
+		frame_available.notify_all();
+
+		for (auto& worker : workers)
+		{
+			if (worker.joinable())
+				worker.join();
+		}
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	uint64_t EstimationPipeline<Parameters, InputData, GazeEstimationResult>::pushed_frames() const
+	{
+		return next_sequence.load(std::memory_order_relaxed);
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	uint64_t EstimationPipeline<Parameters, InputData, GazeEstimationResult>::dropped_frames() const
+	{
+		return dropped.load(std::memory_order_relaxed);
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	uint64_t EstimationPipeline<Parameters, InputData, GazeEstimationResult>::estimated_frames() const
+	{
+		return estimated.load(std::memory_order_relaxed);
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	void EstimationPipeline<Parameters, InputData, GazeEstimationResult>::work(Method& method)
+	{
+		const int spins_before_sleeping = 64;
+		Frame frame;
+		int idle_spins = 0;
+		for (;;)
+		{
+			if (frames.try_pop(frame))
+			{
+				idle_spins = 0;
+				const GazeEstimationResult result = method.estimate(frame.data, parameters);
+				estimated.fetch_add(1, std::memory_order_relaxed);
+				if (callback)
+					callback(frame.sequence, result);
+				continue;
+			}
+
+			if (stopping.load())
+				return;
+
+			if (idle_spins++ < spins_before_sleeping)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			// announce the sleep before checking the ring again, so that a push either sees a sleeping worker or
+			// is seen by the check
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			sleeping_workers.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (frames.empty() && !stopping.load())
+			{
+				frame_available.wait_for(lock, std::chrono::milliseconds(10));
+			}
+			sleeping_workers.fetch_sub(1);
+			idle_spins = 0;
+		}
+	}
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef EXAMPLE_SETUPS_HPP_INCLUDED
+#define EXAMPLE_SETUPS_HPP_INCLUDED
+
+#include "GazeEstimationTypes.hpp"
+#include "InputOutputHelpers.hpp"
+#include "PinholeCameraModel.hpp"
+#include "SyntheticData.hpp"
+
+/// The recording setups the sample client and the benchmark run against, with the constants of the scenes the
+/// recordings were made in.
+namespace gazeestimation {
+
+	/// The parameters of a setup together with what is needed to get from an estimate to the point on the screen.
+	struct ExampleSetup
+	{
+		EyeAndCameraParameters parameters;
+		/// subtracted from points in the WCS to get to the coordinate system the truth is in
+		Vec3 wcs_offset;
+		/// the z coordinate of the screen plane in the WCS
+		double z_shift;
+		/// cm per screen pixel, for truth given in screen pixels
+		double screen_pixel_size_x;
+		double screen_pixel_size_y;
+	};
+
+	/// Intersects the visual axis with the screen plane z = z_shift.
+	template <typename T>
+	Vec3T<T> calculate_point_of_interest(const Vec3T<T>& cornea_center, const Vec3T<T>& visual_axis_unit_vector, const T& z_shift)
+	{
+		const T kg = (z_shift - cornea_center[2]) / visual_axis_unit_vector[2];
+		return cornea_center + kg * visual_axis_unit_vector;
+	}
+
+	/// The one camera, two light setup of input_calibration.txt and input_test.txt, with truth in screen pixels.
+	inline ExampleSetup make_onecamera_setup()
+	{
+		ExampleSetup setup;
+		EyeAndCameraParameters& parameters = setup.parameters;
+		parameters.alpha = deg_to_rad(-5);
+		parameters.beta = deg_to_rad(1.5);
+		parameters.R = 0.78;
+		parameters.K = 0.42;
+		parameters.n1 = 1.3375;
+		parameters.n2 = 1;
+		parameters.D = 0.53;
+
+		// keeping in mind that wcs has its origin at the camera position for these
+		const Vec3 actual_camera_position = make_vec3(24.5, -35, 10);
+		setup.wcs_offset = -make_vec3(24.5, -35, 10);
+
+		PinholeCameraModel camera;
+		camera.set_principal_point(299.5, 399.5);
+		camera.set_pixel_size_cm(2.4 * 1e-6, 2.4 * 1e-6);
+		camera.set_effective_focal_length_cm(0.0119144);
+		camera.set_position(actual_camera_position + setup.wcs_offset);
+		camera.set_camera_angles(deg_to_rad(8), 0, 0);
+		parameters.cameras.push_back(camera);
+
+		parameters.light_positions.push_back(actual_camera_position + make_vec3(13, 0, 0) + setup.wcs_offset);
+		parameters.light_positions.push_back(actual_camera_position + make_vec3(-13, 0, 0) + setup.wcs_offset);
+
+		parameters.distance_to_camera_estimate = 10;
+
+		// additional scene parameters to get poi in pixels
+		const double display_surface_size_cm_x = 48.7;
+		const double display_surface_size_cm_y = 27.4;
+		const double screen_resolution_x = 1680;
+		const double screen_resolution_y = 1050;
+
+		setup.screen_pixel_size_x = display_surface_size_cm_x / screen_resolution_x;
+		setup.screen_pixel_size_y = display_surface_size_cm_y / screen_resolution_y;
+
+		setup.z_shift = -actual_camera_position[2];
+		return setup;
+	}
+
+	/// The two camera, two light setup of the generated two camera recordings, with truth in cm on the screen plane.
+	inline ExampleSetup make_twocamera_setup()
+	{
+		ExampleSetup setup;
+		EyeAndCameraParameters& parameters = setup.parameters;
+		parameters.alpha = deg_to_rad(-5);
+		parameters.beta = deg_to_rad(1.5);
+		parameters.R = 0.78;
+		parameters.K = 0.42;
+		parameters.n1 = 1.3375;
+		parameters.n2 = 1;
+		parameters.D = 0.53;
+
+		// keeping in mind that wcs has its origin at the camera position for these
+		setup.wcs_offset = make_vec3(0, 0, 0);//-make_vec3(24.5, -35, 10);
+
+		{
+			PinholeCameraModel camera;
+			camera.set_principal_point(695.5, 449.5);
+			camera.set_pixel_size_cm(4.65 * 1e-6, 4.65 * 1e-6);
+			camera.set_effective_focal_length_cm(0.0350170102672);
+			const Vec3 actual_camera_position = make_vec3(-10, -21, 2);
+			camera.set_position(actual_camera_position + setup.wcs_offset);
+			camera.set_camera_angles(deg_to_rad(-27.70716514), deg_to_rad(9.01932243), 0);
+			parameters.cameras.push_back(camera);
+		}
+		{
+			PinholeCameraModel camera;
+			camera.set_principal_point(695.5, 449.5);
+			camera.set_pixel_size_cm(4.65 * 1e-6, 4.65 * 1e-6);
+			camera.set_effective_focal_length_cm(0.0350170102672);
+			const Vec3 actual_camera_position = make_vec3(10, -21, 2);
+			camera.set_position(actual_camera_position + setup.wcs_offset);
+			camera.set_camera_angles(deg_to_rad(-27.70716514), deg_to_rad(-9.01932243), 0);
+			parameters.cameras.push_back(camera);
+		}
+
+		parameters.distance_to_camera_estimate = 100;
+
+		parameters.light_positions.push_back(make_vec3(-25, 10, 0) + setup.wcs_offset);
+		parameters.light_positions.push_back(make_vec3(25, 10, 0) + setup.wcs_offset);
+
+		setup.z_shift = 0;
+		setup.screen_pixel_size_x = 1;
+		setup.screen_pixel_size_y = 1;
+		return setup;
+	}
+
+	/// The point on the screen plane of the truth of a setup, e.g. for the truth of input_test.txt with the one camera setup.
+	inline Vec3 truth_to_wcs(const ExampleSetup& setup, const Vec2& truth)
+	{
+		return make_vec3(truth[0] * setup.screen_pixel_size_x, -truth[1] * setup.screen_pixel_size_y, setup.z_shift) + setup.wcs_offset;
+	}
+
+	/// \brief A scene for generating frames of a setup: eyes within eye_extent cm around the point distance cm in front of
+	/// the cameras (averaged over the cameras), looking at the part [truth_min, truth_max] of the screen in the coordinates
+	/// of the truth of the setup.
+	inline SyntheticFrameGenerator::Scene make_synthetic_scene(const ExampleSetup& setup, const Vec2& truth_min, const Vec2& truth_max,
+		double distance = 60, double eye_extent = 2)
+	{
+		Vec3 eye_center = make_vec3(0, 0, 0);
+		for (const auto& camera : setup.parameters.cameras)
+		{
+			eye_center += camera.ccs_to_wcs(make_vec3(0, 0, distance));
+		}
+		eye_center /= static_cast<double>(setup.parameters.cameras.size());
+
+		const Vec3 corner1 = truth_to_wcs(setup, truth_min);
+		const Vec3 corner2 = truth_to_wcs(setup, truth_max);
+
+		SyntheticFrameGenerator::Scene scene;
+		scene.eye_min = eye_center - make_vec3(eye_extent, eye_extent, eye_extent);
+		scene.eye_max = eye_center + make_vec3(eye_extent, eye_extent, eye_extent);
+		scene.target_min = corner1.cwiseMin(corner2);
+		scene.target_max = corner1.cwiseMax(corner2);
+		return scene;
+	}
+
+	/// Calibrates against alpha, beta, R, K, camera_rotation_y, camera_rotation_z
+	inline void six_variable_calibration_applicator(EyeAndCameraParameters& params, double const* const* variables)
+	{
+		params.alpha = variables[0][0];
+		params.beta = variables[1][0];
+		params.R = variables[2][0];
+		params.K = variables[3][0];
+
+		// numeric differentiation changes one variable at a time, only recalculate the rotation if the angles changed
+		PinholeCameraModel& camera = params.cameras[0];
+		if (camera.camera_angle_y() != variables[4][0] || camera.camera_angle_z() != variables[5][0])
+		{
+			camera.set_camera_angles(camera.camera_angle_x(), variables[4][0], variables[5][0]);
+		}
+	}
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef FIXED_CAPACITY_VECTOR_HPP_INCLUDED
+#define FIXED_CAPACITY_VECTOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace gazeestimation {
+
+	/// \brief A vector with inline storage for up to Capacity elements, so that it never allocates. Supports the
+	/// subset of the std::vector interface used for the input types. All Capacity elements are always constructed,
+	/// copies copy all of them.
+	template <typename T, size_t Capacity>
+	class FixedCapacityVector
+	{
+	public:
+		typedef T value_type;
+		typedef size_t size_type;
+		typedef T* iterator;
+		typedef const T* const_iterator;
+
+		FixedCapacityVector() : count(0) { }
+
+		/// Throws std::length_error if there are more than Capacity values.
+		FixedCapacityVector(std::initializer_list<T> values) : count(0)
+		{
+			for (const auto& value : values)
+			{
+				push_back(value);
+			}
+		}
+
+		size_t size() const
+		{
+			return count;
+		}
+
+		static size_t capacity()
+		{
+			return Capacity;
+		}
+
+		bool empty() const
+		{
+			return count == 0;
+		}
+
+		T& operator[](size_t index)
+		{
+			return elements[index];
+		}
+
+		const T& operator[](size_t index) const
+		{
+			return elements[index];
+		}
+
+		T* data()
+		{
+			return elements;
+		}
+
+		const T* data() const
+		{
+			return elements;
+		}
+
+		iterator begin()
+		{
+			return elements;
+		}
+
+		iterator end()
+		{
+			return elements + count;
+		}
+
+		const_iterator begin() const
+		{
+			return elements;
+		}
+
+		const_iterator end() const
+		{
+			return elements + count;
+		}
+
+		/// Throws std::length_error if the vector is full.
+		void push_back(const T& value)
+		{
+			if (count == Capacity)
+				throw std::length_error("FixedCapacityVector is full");
+			elements[count++] = value;
+		}
+
+		/// Elements added by this are reset to T(). Throws std::length_error if size is larger than Capacity.
+		void resize(size_t size)
+		{
+			if (size > Capacity)
+				throw std::length_error("FixedCapacityVector cannot hold that many elements");
+			for (size_t i = count; i < size; i++)
+			{
+				elements[i] = T();
+			}
+			count = size;
+		}
+
+		void clear()
+		{
+			count = 0;
+		}
+
+	private:
+		T elements[Capacity];
+		size_t count;
+	};
+
+}
+
+#endif
@@ -2,15 +2,19 @@
 
 namespace gazeestimation
 {
+	EstimationCache::~EstimationCache() {}
+
+	EstimationSession::~EstimationSession() {}
+
 	DefaultGazeEstimationResult::DefaultGazeEstimationResult():
 		is_valid(false),
 		is_error(false),
 		center_of_cornea(0, 0, 0),
 		visual_axis(0, 0, 0),
 		optical_axis(0, 0, 0),
-		error("") { }
+		error(NoError) { }
 
-	DefaultGazeEstimationResult DefaultGazeEstimationResult::make_error(std::string error)
+	DefaultGazeEstimationResult DefaultGazeEstimationResult::make_error(Error error)
 	{
 		DefaultGazeEstimationResult res;
 		res.is_valid = false;
@@ -18,4 +22,27 @@ namespace gazeestimation
 		res.error = error;
 		return res;
 	}
+
+	const char* DefaultGazeEstimationResult::error_description(Error error)
+	{
+		switch (error)
+		{
+		case NoError:
+			return "no error";
+		case InvalidConfiguration:
+			return "configured optic axis reconstruction method does not exist.";
+		case WrongNumberOfInputs:
+			return "the frame does not have pupil center/glint info for the number of cameras of this method.";
+		case WrongNumberOfCameras:
+			return "the parameters do not have the number of cameras of this method.";
+		case NotEnoughValidGlints:
+			return "there need to be at least 2 valid glints present.";
+		case WrongNumberOfGlints:
+			return "a camera does not have a glint per light.";
+		case SolverFailed:
+			return "the solver for the cornea center failed.";
+		default:
+			return "unknown error";
+		}
+	}
 }
@@ -5,12 +5,18 @@
 
 #include "MathTypes.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
+#include "FixedCapacityVector.hpp"
 #include "PinholeCameraModel.hpp"
+#include "Telemetry.hpp"
+#include "WorkerPool.hpp"
 
 namespace gazeestimation{
-	class PinholeCameraModel;
 
 class DefaultGazeEstimationResult
 {
@@ -21,20 +27,125 @@ public:
 	Vec3 visual_axis;
 	Vec3 optical_axis;
 
-	std::string error;
+	/// Why no estimate could be made, so that results own no heap memory and can be reused per frame.
+	enum Error
+	{
+		NoError = 0,
+		/// the method was configured with an option it does not implement
+		InvalidConfiguration,
+		/// the frame does not have pupil center/glint info for the number of cameras the method needs
+		WrongNumberOfInputs,
+		/// the parameters do not have the number of cameras the method needs
+		WrongNumberOfCameras,
+		/// too few glints of a camera are valid, e.g. during a blink
+		NotEnoughValidGlints,
+		/// the solver for the cornea center found no usable solution, the telemetry of the result tells how it went
+		SolverFailed,
+		/// a camera does not have a glint, valid or not, per light
+		WrongNumberOfGlints
+	};
+
+	Error error;
+
+	/// How the solve of this frame went and, if the estimator times its stages, how long they took.
+	FrameTelemetry telemetry;
 
 	explicit DefaultGazeEstimationResult();
 
-	static DefaultGazeEstimationResult make_error(std::string error);
+	/// Returns an invalid result with the given error. Estimation methods report invalid frames this way 
+	/// instead of throwing, as those are expected to happen regularly.
+	static DefaultGazeEstimationResult make_error(Error error);
+
+	/// Returns a human readable description of the given error.
+	static const char* error_description(Error error);
+};
+
+/// \brief Limits on the numerical solve for the cornea center of a frame, for when a late estimate is worth less than a
+/// less accurate one. A solve that reaches the iteration cap or the deadline stops at its best iterate so far, which is
+/// used as the solution and marked in the telemetry, see SolverTelemetry::budget_exhausted. The specialized solvers
+/// stop after a few iterations anyway and are not limited. 0 leaves a limit at the default of the estimator.
+struct SolverBudget
+{
+	typedef std::chrono::steady_clock Clock;
+
+	/// wall time in seconds from the start of the cornea center stage of a frame after which its solve stops
+	double frame_deadline_seconds = 0;
+	/// iterations of the generic solver per frame
+	int max_iterations = 0;
+	/// the tolerances of ceres, whose defaults are 1e-6, 1e-10 and 1e-8
+	double function_tolerance = 0;
+	double gradient_tolerance = 0;
+	double parameter_tolerance = 0;
+
+	/// The point in time the solve of a frame whose cornea center stage starts now has to stop, Clock::time_point::max()
+	/// without a deadline.
+	Clock::time_point deadline() const
+	{
+		if (!(frame_deadline_seconds > 0))
+			return Clock::time_point::max();
+		return Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frame_deadline_seconds));
+	}
 };
 
 
+/// \brief The intermediate results of estimating a single input, see GazeEstimationMethod::estimate_cached. Each method
+/// that supports caching has its own kind of cache, callers only hold on to it.
+class EstimationCache
+{
+public:
+	virtual ~EstimationCache();
+};
+
+/// \brief The state an estimator keeps for a single stream of consecutive frames, e.g. the solution tracked from the
+/// previous frame, the filters and the reusable solver problems, see GazeEstimationMethod::make_session. Each method
+/// that supports sessions has its own kind of session.
+class EstimationSession
+{
+public:
+	virtual ~EstimationSession();
+};
+
 template <class Parameters, class InputData, class GazeEstimationResult>
 class GazeEstimationMethod
 {
 public:
 	virtual ~GazeEstimationMethod();
 	virtual GazeEstimationResult estimate(const InputData& data, const Parameters& parameters) = 0;
+
+	/// \brief Returns an independent copy of this method that may be used concurrently with this one, or nullptr if 
+	/// this method cannot be copied.
+	virtual std::unique_ptr<GazeEstimationMethod> clone() const;
+
+	/// \brief Estimates all inputs in [first, last) in order into results. Methods can override this to do work that 
+	/// only depends on parameters once for all of the inputs instead of once per estimate.
+	virtual void estimate_range(const InputData* first, const InputData* last, GazeEstimationResult* results, 
+		const Parameters& parameters);
+
+	/// \brief Estimates all inputs in [first, last) into results, which must have room for last - first results.
+	/// The inputs are split into one contiguous part per worker of pool, and each part is estimated in order by its
+	/// own clone of this method. If this method cannot be cloned, everything is estimated in order on the calling thread.
+	void estimate_batch(const InputData* first, const InputData* last, GazeEstimationResult* results, 
+		const Parameters& parameters, WorkerPool& pool);
+
+	/// \brief Returns an empty cache for estimate_cached, or nullptr if this method does not cache anything.
+	virtual std::unique_ptr<EstimationCache> make_cache() const;
+
+	/// \brief Same as estimate, for repeatedly estimating the same input with parameters that change in between, as 
+	/// calibration does. Methods that split estimation into stages keep the result of each stage in cache together with
+	/// the parameters it depends on, and only recompute the stages whose parameters changed since the previous call.
+	/// cache must come from make_cache of this method and be used for a single input only.
+	virtual GazeEstimationResult estimate_cached(const InputData& data, const Parameters& parameters, EstimationCache& cache);
+
+	/// \brief Returns a new session for estimate_in_session, or nullptr if this method keeps its state in itself only.
+	virtual std::unique_ptr<EstimationSession> make_session() const;
+
+	/// \brief Same as estimate, with the state between frames kept in session instead of in this method, so that a single
+	/// method serves any number of streams, e.g. the trackers of several participants, concurrently from any threads
+	/// without being copied or locked. Each session is for one stream of consecutive frames and must only be used by one
+	/// thread at a time. session must come from make_session of this method, which must not be reconfigured meanwhile.
+	/// Throws std::logic_error if this method does not support sessions.
+	virtual GazeEstimationResult estimate_in_session(const InputData& data, const Parameters& parameters,
+		EstimationSession& session) const;
 };
 
 
@@ -49,37 +160,157 @@ public:
 template <class Parameters, class InputData, class GazeEstimationResult>
 GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::~GazeEstimationMethod() {}
 
+template <class Parameters, class InputData, class GazeEstimationResult>
+std::unique_ptr<GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>> 
+	GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::clone() const
+{
+	return nullptr;
+}
+
+template <class Parameters, class InputData, class GazeEstimationResult>
+std::unique_ptr<EstimationCache> GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::make_cache() const
+{
+	return nullptr;
+}
+
+template <class Parameters, class InputData, class GazeEstimationResult>
+GazeEstimationResult GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::estimate_cached(const InputData& data,
+	const Parameters& parameters, EstimationCache& cache)
+{
+	return estimate(data, parameters);
+}
+
+template <class Parameters, class InputData, class GazeEstimationResult>
+std::unique_ptr<EstimationSession> GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::make_session() const
+{
+	return nullptr;
+}
+
+template <class Parameters, class InputData, class GazeEstimationResult>
+GazeEstimationResult GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::estimate_in_session(const InputData& data,
+	const Parameters& parameters, EstimationSession& session) const
+{
+	throw std::logic_error("This gaze estimation method does not support sessions.");
+}
+
+template <class Parameters, class InputData, class GazeEstimationResult>
+void GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::estimate_range(const InputData* first, const InputData* last,
+	GazeEstimationResult* results, const Parameters& parameters)
+{
+	for (; first != last; ++first, ++results)
+	{
+		*results = estimate(*first, parameters);
+	}
+}
+
+template <class Parameters, class InputData, class GazeEstimationResult>
+void GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>::estimate_batch(const InputData* first, const InputData* last, 
+	GazeEstimationResult* results, const Parameters& parameters, WorkerPool& pool)
+{
+	const size_t count = last - first;
+	const size_t num_parts = std::min<size_t>(pool.size(), count);
+
+	std::vector<std::unique_ptr<GazeEstimationMethod>> methods;
+	if (num_parts > 1)
+	{
+		for (size_t i = 0; i < num_parts; i++)
+		{
+			std::unique_ptr<GazeEstimationMethod> method = clone();
+			if (!method)
+				break;
+			methods.push_back(std::move(method));
+		}
+	}
+
+	if (methods.size() < 2)
+	{
+		estimate_range(first, last, results, parameters);
+		return;
+	}
+
+	pool.run(methods.size(), [&](size_t part)
+	{
+		const size_t begin = count * part / methods.size();
+		const size_t end = count * (part + 1) / methods.size();
+		methods[part]->estimate_range(first + begin, first + end, results + begin, parameters);
+	});
+}
+
 template <class CalibratedParameters>
 CalibrationMethod<CalibratedParameters>::~CalibrationMethod() {}
 
+/// The most glints per camera and cameras per frame the input types have room for. The input storage is inline so 
+/// that filling in a frame never allocates.
+const size_t max_glints_per_camera = 8;
+const size_t max_cameras = 4;
+
 struct PupilCenterGlintInput
 {
+	typedef FixedCapacityVector<Vec2, max_glints_per_camera> Glints;
+
 	Vec2 pupil_center;
-	std::vector<Vec2> glints;	
+	Glints glints;
 };
 
 struct PupilCenterGlintInputs
 {
-	std::vector<PupilCenterGlintInput> data;
+	FixedCapacityVector<PupilCenterGlintInput, max_cameras> data;
 };
 
-struct EyeAndCameraParameters
+/// The parameters with a generic scalar type, see EyeAndCameraParameters for the usual double version.
+template <typename T>
+struct EyeAndCameraParametersT
 {
 	// eye parameters
-	double alpha;
-	double beta;
-	double R; // R in cm
-	double K; // K in cm
-	double n1;
-	double n2;
-	double D; // D in cm
+	T alpha;
+	T beta;
+	T R; // R in cm
+	T K; // K in cm
+	T n1;
+	T n2;
+	T D; // D in cm
 
-	std::vector<PinholeCameraModel> cameras;
+	std::vector<PinholeCameraModelT<T>> cameras;
 
 	// lights
-	std::vector<Vec3> light_positions; // light positions (ordered!, this is important for glint association)
+	std::vector<Vec3T<T>> light_positions; // light positions (ordered!, this is important for glint association)
 
-	double distance_to_camera_estimate; // initial guess for the eye-camera distance
+	T distance_to_camera_estimate; // initial guess for the eye-camera distance
+
+	/// Returns a copy of these parameters with scalar type U.
+	template <typename U>
+	EyeAndCameraParametersT<U> cast() const
+	{
+		EyeAndCameraParametersT<U> parameters;
+		parameters.alpha = U(alpha);
+		parameters.beta = U(beta);
+		parameters.R = U(R);
+		parameters.K = U(K);
+		parameters.n1 = U(n1);
+		parameters.n2 = U(n2);
+		parameters.D = U(D);
+		for (const auto& camera : cameras)
+		{
+			parameters.cameras.push_back(camera.template cast<U>());
+		}
+		for (const auto& light : light_positions)
+		{
+			parameters.light_positions.push_back(light.template cast<U>());
+		}
+		parameters.distance_to_camera_estimate = U(distance_to_camera_estimate);
+		return parameters;
+	}
+};
+
+typedef EyeAndCameraParametersT<double> EyeAndCameraParameters;
+
+/// The result of the scalar generic estimation, e.g. for automatic differentiation or in single precision.
+template <typename T>
+struct DifferentiableGazeEstimationResult
+{
+	Vec3T<T> center_of_cornea;
+	Vec3T<T> visual_axis;
+	Vec3T<T> optical_axis;
 };
 
 }
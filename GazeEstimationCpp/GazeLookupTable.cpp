@@ -0,0 +1,245 @@
+#include "GazeLookupTable.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <Eigen/SparseCholesky>
+#include <Eigen/SparseCore>
+
+#include "Utils.hpp"
+
+namespace gazeestimation {
+
+	namespace {
+		/// The cell of a coordinate in grid units along an axis with the given number of nodes, and the position within it.
+		void locate(double t, int nodes, int& cell, double& fraction)
+		{
+			cell = std::min(static_cast<int>(std::floor(t)), nodes - 2);
+			fraction = t - cell;
+		}
+	}
+
+	bool GazeLookupTable::calculate_features(const PupilCenterGlintInputs& data, Vec3& features)
+	{
+		if (data.data.size() != 1)
+			return false;
+		const PupilCenterGlintInput& input = data.data[0];
+		if (input.glints.size() < 2 || !glintValid(input.glints[0]) || !glintValid(input.glints[1]))
+			return false;
+
+		const Vec2 midpoint = 0.5 * (input.glints[0] + input.glints[1]);
+		const double glint_distance = std::sqrt(squared_length_vec2(input.glints[1] - input.glints[0]));
+		if (!(glint_distance > 0))
+			return false;
+
+		const Vec2 pupil_glint = (input.pupil_center - midpoint) / glint_distance;
+		features = make_vec3(pupil_glint[0], pupil_glint[1], glint_distance);
+		return true;
+	}
+
+	GazeLookupTable GazeLookupTable::build(const OneCamSphericalGE& estimation, const EyeAndCameraParameters& parameters,
+		ResultProcessor processor, const SyntheticFrameGenerator::Scene& scene, const Options& options)
+	{
+		if (parameters.cameras.size() != 1 || parameters.light_positions.size() < 2)
+			throw std::invalid_argument("GazeLookupTable needs parameters with a single camera and at least two lights.");
+		if (options.pupil_glint_nodes < 2 || options.depth_nodes < 2)
+			throw std::invalid_argument("GazeLookupTable needs at least two nodes along every feature.");
+
+		SyntheticFrameGenerator generator(parameters, scene, options.seed);
+		std::vector<PupilCenterGlintInputs> frames(options.num_samples);
+		SyntheticFrameTruth truth;
+		for (auto& frame : frames)
+		{
+			generator.next(frame, truth);
+		}
+
+		OneCamSphericalGE sampler(estimation);
+		sampler.setTracking(false);
+		sampler.setCorneaCenterReuse(0);
+		sampler.setCorneaCenterFilter(nullptr);
+		sampler.setPupilCenterFilter(nullptr);
+		sampler.setTelemetryCounters(nullptr);
+		std::vector<DefaultGazeEstimationResult> results(frames.size());
+		sampler.estimate_range(frames.data(), frames.data() + frames.size(), results.data(), parameters);
+
+		std::vector<Vec3> features;
+		std::vector<Vec3> points;
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			Vec3 sample_features;
+			if (!results[i].is_valid || !calculate_features(frames[i], sample_features))
+				continue;
+			const Vec3 point = processor(results[i]);
+			if (!point.allFinite())
+				continue;
+			features.push_back(sample_features);
+			points.push_back(point);
+		}
+		if (features.empty())
+			throw std::runtime_error("GazeLookupTable: none of the sampled frames could be estimated.");
+
+		GazeLookupTable table;
+		table.parameters = parameters;
+		table.processor = std::move(processor);
+		table.nodes[0] = options.pupil_glint_nodes;
+		table.nodes[1] = options.pupil_glint_nodes;
+		table.nodes[2] = options.depth_nodes;
+		table.actual_features_min = features[0];
+		table.actual_features_max = features[0];
+		for (const auto& sample_features : features)
+		{
+			table.actual_features_min = table.actual_features_min.cwiseMin(sample_features);
+			table.actual_features_max = table.actual_features_max.cwiseMax(sample_features);
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const double extent = table.actual_features_max[axis] - table.actual_features_min[axis];
+			table.cells_per_unit[axis] = extent > 0 ? (table.nodes[axis] - 1) / extent : 0;
+		}
+
+		// least squares fit of the node values to the samples, with the second differences along each axis as a
+		// regularizer in grid units, as in gridfit
+		const int num_nodes = table.nodes[0] * table.nodes[1] * table.nodes[2];
+		typedef Eigen::Triplet<double> Entry;
+		std::vector<Entry> entries;
+		Eigen::MatrixX3d right_hand_side = Eigen::MatrixX3d::Zero(features.size(), 3);
+		int row = 0;
+		for (size_t sample = 0; sample < features.size(); sample++, row++)
+		{
+			const Vec3 t = (features[sample] - table.actual_features_min).cwiseProduct(table.cells_per_unit);
+			int cell[3];
+			double fraction[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				locate(t[axis], table.nodes[axis], cell[axis], fraction[axis]);
+			}
+			for (int corner = 0; corner < 8; corner++)
+			{
+				double weight = 1;
+				int index[3];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					const int upper = (corner >> axis) & 1;
+					index[axis] = cell[axis] + upper;
+					weight *= upper ? fraction[axis] : 1 - fraction[axis];
+				}
+				entries.push_back(Entry(row, static_cast<int>(table.node_index(index[0], index[1], index[2])), weight));
+			}
+			right_hand_side.row(row) = points[sample].transpose();
+		}
+
+		const double smoothing = options.smoothing * std::sqrt(static_cast<double>(features.size()) / num_nodes);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int k = 0; k < table.nodes[2]; k++)
+			{
+				for (int j = 0; j < table.nodes[1]; j++)
+				{
+					for (int i = 0; i < table.nodes[0]; i++)
+					{
+						int index[3] = { i, j, k };
+						if (index[axis] == 0 || index[axis] == table.nodes[axis] - 1)
+							continue;
+						for (int offset = -1; offset <= 1; offset++)
+						{
+							int neighbour[3] = { i, j, k };
+							neighbour[axis] += offset;
+							entries.push_back(Entry(row, static_cast<int>(table.node_index(neighbour[0], neighbour[1], neighbour[2])),
+								offset == 0 ? -2 * smoothing : smoothing));
+						}
+						row++;
+					}
+				}
+			}
+		}
+
+		Eigen::SparseMatrix<double> design(row, num_nodes);
+		design.setFromTriplets(entries.begin(), entries.end());
+		right_hand_side.conservativeResize(row, 3);
+		right_hand_side.bottomRows(row - features.size()).setZero();
+
+		const Eigen::SparseMatrix<double> normal = design.transpose() * design;
+		Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver(normal);
+		if (solver.info() != Eigen::Success)
+			throw std::runtime_error("GazeLookupTable: the grid could not be fit to the samples.");
+		const Eigen::MatrixX3d solution = solver.solve(design.transpose() * right_hand_side);
+
+		table.values.resize(num_nodes);
+		for (int node = 0; node < num_nodes; node++)
+		{
+			table.values[node] = solution.row(node).transpose();
+		}
+		return table;
+	}
+
+	GazeLookupTable GazeLookupTable::build(const OneCamSphericalGE& estimation, const EyeAndCameraParameters& parameters,
+		ResultProcessor processor, const SyntheticFrameGenerator::Scene& scene)
+	{
+		return build(estimation, parameters, std::move(processor), scene, Options());
+	}
+
+	bool GazeLookupTable::lookup(const PupilCenterGlintInputs& data, Vec3& point) const
+	{
+		Vec3 features;
+		if (!calculate_features(data, features))
+			return false;
+
+		const Vec3 t = (features - actual_features_min).cwiseProduct(cells_per_unit);
+		int cell[3];
+		double fraction[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (!(t[axis] >= 0 && t[axis] <= nodes[axis] - 1))
+				return false;
+			locate(t[axis], nodes[axis], cell[axis], fraction[axis]);
+		}
+
+		// interpolate along the first feature, then the second, then the depth
+		Vec3 along_j[2];
+		for (int dk = 0; dk < 2; dk++)
+		{
+			Vec3 along_i[2];
+			for (int dj = 0; dj < 2; dj++)
+			{
+				const size_t index = node_index(cell[0], cell[1] + dj, cell[2] + dk);
+				along_i[dj] = values[index] + fraction[0] * (values[index + 1] - values[index]);
+			}
+			along_j[dk] = along_i[0] + fraction[1] * (along_i[1] - along_i[0]);
+		}
+		point = along_j[0] + fraction[2] * (along_j[1] - along_j[0]);
+		return true;
+	}
+
+	bool GazeLookupTable::estimate_point(const PupilCenterGlintInputs& data, OneCamSphericalGE& estimation, Vec3& point,
+		bool* from_table) const
+	{
+		const bool found = lookup(data, point);
+		if (from_table)
+			*from_table = found;
+		if (found)
+			return true;
+
+		const DefaultGazeEstimationResult result = estimation.estimate(data, parameters);
+		if (!result.is_valid)
+			return false;
+		point = processor(result);
+		return true;
+	}
+
+	const Vec3& GazeLookupTable::features_min() const
+	{
+		return actual_features_min;
+	}
+
+	const Vec3& GazeLookupTable::features_max() const
+	{
+		return actual_features_max;
+	}
+
+	size_t GazeLookupTable::node_index(int i, int j, int k) const
+	{
+		return (static_cast<size_t>(k) * nodes[1] + j) * nodes[0] + i;
+	}
+
+}
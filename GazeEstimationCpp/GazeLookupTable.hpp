@@ -0,0 +1,88 @@
+#ifndef GAZE_LOOKUP_TABLE_HPP_INCLUDED
+#define GAZE_LOOKUP_TABLE_HPP_INCLUDED
+
+#include <functional>
+#include <vector>
+
+#include "GazeEstimationTypes.hpp"
+#include "OneCameraSpherical.hpp"
+#include "SyntheticData.hpp"
+
+namespace gazeestimation {
+
+	/// \brief A surrogate of OneCamSphericalGE for a calibrated setup that maps features of the pupil and the glints of
+	/// a frame straight to the point of interest, by trilinear interpolation in a grid, for when latency matters more
+	/// than accuracy. The grid is fit to frames generated with SyntheticFrameGenerator over a head box and estimated with
+	/// the full model, so it follows the model, averaged over the head positions of the box that give the same features.
+	/// Frames whose features are outside of the grid are left to the full model.
+	class GazeLookupTable
+	{
+	public:
+		/// Maps the result of an estimate to the point of interest, as the result processor of GenericCalibration does.
+		typedef std::function<Vec3(const DefaultGazeEstimationResult&)> ResultProcessor;
+
+		struct Options
+		{
+			/// grid nodes along each component of the pupil glint vector
+			int pupil_glint_nodes = 16;
+			/// grid nodes along the glint distance
+			int depth_nodes = 6;
+			size_t num_samples = 20000;
+			/// \brief Weight of the second differences between neighbouring nodes against the samples, which smooths the
+			/// fit and keeps nodes without samples nearby defined.
+			double smoothing = 0.1;
+			unsigned int seed = 0;
+		};
+
+		/// \brief The features a frame is looked up with: the vector from the midpoint of the glints of the first two lights
+		/// to the pupil center, divided by the distance between those glints, and that distance in pixels, which gets
+		/// smaller the further the eye is away. Returns false if the frame does not have a single camera or one of the two
+		/// glints is invalid.
+		static bool calculate_features(const PupilCenterGlintInputs& data, Vec3& features);
+
+		/// \brief Builds the table for the given parameters, e.g. those GenericCalibration::calibrate returned, from
+		/// options.num_samples frames of eyes within the eye box of scene looking at its target box. estimation is copied,
+		/// with tracking, the cornea center reuse and the filters disabled as the frames are unrelated, and without its
+		/// telemetry counters, so the samples are not counted as estimates of the caller. Throws std::invalid_argument if
+		/// the parameters do not have a single camera and at least two lights or the options have fewer than two nodes
+		/// along a feature, std::runtime_error if no frame could be estimated.
+		static GazeLookupTable build(const OneCamSphericalGE& estimation, const EyeAndCameraParameters& parameters,
+			ResultProcessor processor, const SyntheticFrameGenerator::Scene& scene, const Options& options);
+		/// Same as build with the default options.
+		static GazeLookupTable build(const OneCamSphericalGE& estimation, const EyeAndCameraParameters& parameters,
+			ResultProcessor processor, const SyntheticFrameGenerator::Scene& scene);
+
+		/// \brief Interpolates the point of interest of the frame from the grid. Returns false if the features of the frame
+		/// cannot be calculated or are outside of the grid.
+		bool lookup(const PupilCenterGlintInputs& data, Vec3& point) const;
+
+		/// \brief Same as lookup, falling back to estimation with the parameters the table was built for and the result
+		/// processor if the frame is outside of the grid. Returns false if neither gives a point. from_table receives
+		/// whether the point came from the table unless it is null.
+		bool estimate_point(const PupilCenterGlintInputs& data, OneCamSphericalGE& estimation, Vec3& point,
+			bool* from_table = nullptr) const;
+
+		/// The corners of the grid in feature space.
+		const Vec3& features_min() const;
+		const Vec3& features_max() const;
+
+	private:
+		GazeLookupTable() = default;
+
+		size_t node_index(int i, int j, int k) const;
+
+		EyeAndCameraParameters parameters;
+		ResultProcessor processor;
+
+		int nodes[3];
+		Vec3 actual_features_min;
+		Vec3 actual_features_max;
+		/// grid cells per unit of each feature
+		Vec3 cells_per_unit;
+		/// the point of interest per node, with the first feature varying fastest
+		std::vector<Vec3> values;
+	};
+
+}
+
+#endif
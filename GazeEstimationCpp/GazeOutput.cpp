@@ -0,0 +1,333 @@
+#include "GazeOutput.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace gazeestimation {
+
+	namespace {
+		/// the words of a record, copied one by one with relaxed atomics so that a reader racing the publisher reads
+		/// torn values, which it then discards, instead of causing undefined behaviour
+		const size_t record_words = sizeof(GazeRecord) / sizeof(uint64_t);
+
+		const char* shared_gaze_magic()
+		{
+			return "GAZESHM";
+		}
+
+		const char* gaze_record_file_magic()
+		{
+			return "GAZEOUT";
+		}
+
+		static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the segment needs lock-free, thus address-free, 64 bit atomics");
+	}
+
+	struct SharedGazeSlot
+	{
+		/// 2 n once the record has been written n times, odd while it is being written
+		std::atomic<uint64_t> sequence;
+		std::atomic<uint64_t> words[record_words];
+	};
+
+	struct SharedGazeSegment
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+		uint64_t capacity;
+		/// the number of records published so far, on a cache line of its own as every reader polls it
+		alignas(64) std::atomic<uint64_t> published;
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+
+		static const uint32_t current_version = 1;
+
+		SharedGazeSlot* slots()
+		{
+			return reinterpret_cast<SharedGazeSlot*>(this + 1);
+		}
+
+		const SharedGazeSlot* slots() const
+		{
+			return reinterpret_cast<const SharedGazeSlot*>(this + 1);
+		}
+
+		static size_t size(size_t capacity)
+		{
+			return sizeof(SharedGazeSegment) + capacity * sizeof(SharedGazeSlot);
+		}
+
+		/// \brief Copies the record out of slot if it holds the one with the expected sequence number, retrying while the
+		/// publisher is writing it, a few hundred nanoseconds at most, but not forever in case the publisher died in
+		/// the middle of a record.
+		bool read(const SharedGazeSlot& slot, uint64_t expected_sequence, GazeRecord& record) const
+		{
+			const int max_attempts = 1000;
+			uint64_t words[record_words];
+			for (int attempt = 0; attempt < max_attempts; attempt++)
+			{
+				const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+				if (before & 1)
+					continue;
+				if (before != expected_sequence)
+					return false;
+
+				for (size_t i = 0; i < record_words; i++)
+				{
+					words[i] = slot.words[i].load(std::memory_order_relaxed);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.sequence.load(std::memory_order_relaxed) == before)
+				{
+					std::memcpy(&record, words, sizeof(record));
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	GazeRecord make_gaze_record(const DefaultGazeEstimationResult& result, const Vec3& point_of_interest,
+		uint64_t timestamp_ns, uint64_t frame)
+	{
+		GazeRecord record;
+		record.timestamp_ns = timestamp_ns;
+		record.frame = frame;
+		record.valid = result.is_valid ? 1 : 0;
+		record.error = static_cast<uint32_t>(result.error);
+		for (int i = 0; i < 3; i++)
+		{
+			record.cornea_center[i] = result.center_of_cornea[i];
+			record.optical_axis[i] = result.optical_axis[i];
+			record.visual_axis[i] = result.visual_axis[i];
+			record.point_of_interest[i] = point_of_interest[i];
+		}
+		return record;
+	}
+
+	SharedGazePublisher::SharedGazePublisher(const char* name, size_t capacity) :
+		name(name)
+	{
+		if (capacity == 0)
+			throw std::invalid_argument("SharedGazePublisher needs a capacity of at least 1.");
+
+		boost::interprocess::shared_memory_object::remove(name);
+		memory = boost::interprocess::shared_memory_object(boost::interprocess::create_only, name,
+			boost::interprocess::read_write);
+		memory.truncate(static_cast<boost::interprocess::offset_t>(SharedGazeSegment::size(capacity)));
+		region = boost::interprocess::mapped_region(memory, boost::interprocess::read_write);
+
+		segment = new (region.get_address()) SharedGazeSegment();
+		std::memcpy(segment->magic, shared_gaze_magic(), sizeof(segment->magic));
+		segment->version = SharedGazeSegment::current_version;
+		segment->record_size = sizeof(GazeRecord);
+		segment->capacity = capacity;
+		segment->published.store(0, std::memory_order_relaxed);
+		SharedGazeSlot* slots = segment->slots();
+		for (size_t i = 0; i < capacity; i++)
+		{
+			SharedGazeSlot* slot = new (&slots[i]) SharedGazeSlot();
+			slot->sequence.store(0, std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	SharedGazePublisher::~SharedGazePublisher()
+	{
+		boost::interprocess::shared_memory_object::remove(name.c_str());
+	}
+
+	void SharedGazePublisher::publish(const GazeRecord& record)
+	{
+		uint64_t words[record_words];
+		std::memcpy(words, &record, sizeof(record));
+
+		const uint64_t index = segment->published.load(std::memory_order_relaxed);
+		SharedGazeSlot& slot = segment->slots()[index % segment->capacity];
+		const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+		slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+		// the odd sequence number has to be visible before any of the new words
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < record_words; i++)
+		{
+			slot.words[i].store(words[i], std::memory_order_relaxed);
+		}
+		slot.sequence.store(sequence + 2, std::memory_order_release);
+		segment->published.store(index + 1, std::memory_order_release);
+	}
+
+	uint64_t SharedGazePublisher::published_records() const
+	{
+		return segment->published.load(std::memory_order_relaxed);
+	}
+
+	// mapped read_write even though nothing is written, as 64 bit atomic loads on x86 can be a locked compare exchange,
+	// which faults on a read only page
+	SharedGazeSubscriber::SharedGazeSubscriber(const char* name) :
+		memory(boost::interprocess::open_only, name, boost::interprocess::read_write),
+		region(memory, boost::interprocess::read_write)
+	{
+		segment = static_cast<const SharedGazeSegment*>(region.get_address());
+		if (region.get_size() < sizeof(SharedGazeSegment)
+			|| std::memcmp(segment->magic, shared_gaze_magic(), sizeof(segment->magic)) != 0
+			|| segment->version != SharedGazeSegment::current_version || segment->record_size != sizeof(GazeRecord)
+			|| region.get_size() < SharedGazeSegment::size(segment->capacity))
+			throw std::runtime_error(std::string(name) + " is not a gaze segment of version "
+				+ std::to_string(SharedGazeSegment::current_version));
+	}
+
+	bool SharedGazeSubscriber::latest(GazeRecord& record) const
+	{
+		// the second attempt is for the publisher having gone around the ring during the first
+		for (int attempt = 0; attempt < 2; attempt++)
+		{
+			const uint64_t published = segment->published.load(std::memory_order_acquire);
+			if (published == 0)
+				return false;
+			if (read(published - 1, record))
+				return true;
+		}
+		return false;
+	}
+
+	bool SharedGazeSubscriber::read(uint64_t index, GazeRecord& record) const
+	{
+		if (index >= segment->published.load(std::memory_order_acquire))
+			return false;
+
+		const SharedGazeSlot& slot = segment->slots()[index % segment->capacity];
+		return segment->read(slot, 2 * (index / segment->capacity + 1), record);
+	}
+
+	uint64_t SharedGazeSubscriber::published_records() const
+	{
+		return segment->published.load(std::memory_order_acquire);
+	}
+
+	size_t SharedGazeSubscriber::capacity() const
+	{
+		return static_cast<size_t>(segment->capacity);
+	}
+
+	AsyncGazeRecordWriter::AsyncGazeRecordWriter(const char* filename, size_t capacity) :
+		records(capacity),
+		output(filename, std::ios::binary | std::ios::trunc)
+	{
+		GazeRecordFileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, gaze_record_file_magic(), sizeof(header.magic));
+		header.version = GazeRecordFileHeader::current_version;
+		header.record_size = sizeof(GazeRecord);
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (!output)
+			throw std::runtime_error(std::string("Couldn't write to ") + filename);
+
+		writer = std::thread([this] { work(); });
+	}
+
+	AsyncGazeRecordWriter::~AsyncGazeRecordWriter()
+	{
+		try
+		{
+			finish();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	bool AsyncGazeRecordWriter::write(const GazeRecord& record)
+	{
+		if (stopping.load(std::memory_order_relaxed) || !records.try_push(record))
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	void AsyncGazeRecordWriter::finish()
+	{
+		stopping.store(true);
+		if (writer.joinable())
+			writer.join();
+		if (output.is_open())
+		{
+			output.close();
+			if (!output)
+				failed.store(true);
+		}
+		if (failed.load())
+			throw std::runtime_error("Couldn't write the gaze records");
+	}
+
+	uint64_t AsyncGazeRecordWriter::written_records() const
+	{
+		return written.load(std::memory_order_relaxed);
+	}
+
+	uint64_t AsyncGazeRecordWriter::dropped_records() const
+	{
+		return dropped.load(std::memory_order_relaxed);
+	}
+
+	void AsyncGazeRecordWriter::work()
+	{
+		const size_t block_size = 256;
+		std::vector<GazeRecord> block;
+		block.reserve(block_size);
+		GazeRecord record;
+		for (;;)
+		{
+			// read stopping first, so that records written before it was set are still in the ring
+			const bool stop = stopping.load();
+			while (block.size() < block_size && records.try_pop(record))
+			{
+				block.push_back(record);
+			}
+
+			if (!block.empty())
+			{
+				output.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(GazeRecord));
+				if (!output)
+				{
+					failed.store(true);
+					return;
+				}
+				written.fetch_add(block.size(), std::memory_order_relaxed);
+				const bool full_block = block.size() == block_size;
+				block.clear();
+				if (full_block)
+					continue;
+				// the ring ran empty, so the file is current up to the latest record
+				output.flush();
+			}
+
+			if (stop)
+				return;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	std::vector<GazeRecord> read_gaze_records(const char* filename)
+	{
+		std::ifstream input(filename, std::ios::binary);
+		GazeRecordFileHeader header;
+		if (!input.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| std::memcmp(header.magic, gaze_record_file_magic(), sizeof(header.magic)) != 0
+			|| header.version != GazeRecordFileHeader::current_version || header.record_size != sizeof(GazeRecord))
+			throw std::runtime_error(std::string(filename) + " is not a file of gaze records of version "
+				+ std::to_string(GazeRecordFileHeader::current_version));
+
+		std::vector<GazeRecord> records;
+		GazeRecord record;
+		while (input.read(reinterpret_cast<char*>(&record), sizeof(record)))
+		{
+			records.push_back(record);
+		}
+		return records;
+	}
+
+}
@@ -0,0 +1,163 @@
+#ifndef GAZE_OUTPUT_HPP_INCLUDED
+#define GAZE_OUTPUT_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include "GazeEstimationTypes.hpp"
+#include "RingBuffer.hpp"
+
+namespace gazeestimation {
+
+	/// \brief A gaze estimate as a fixed size record without heap memory, so that it can be copied into shared memory and
+	/// files as it is instead of being formatted. All values are in the byte order of the machine that made it.
+	struct GazeRecord
+	{
+		/// e.g. the capture time of the frame in nanoseconds
+		uint64_t timestamp_ns;
+		/// e.g. the sequence number EstimationPipeline::push returned for the frame
+		uint64_t frame;
+		/// 1 if the estimate is valid, 0 otherwise
+		uint32_t valid;
+		/// DefaultGazeEstimationResult::Error
+		uint32_t error;
+		double cornea_center[3];
+		double optical_axis[3];
+		double visual_axis[3];
+		/// e.g. the point on the screen, as the result processor of the calibration gives it
+		double point_of_interest[3];
+	};
+
+	static_assert(sizeof(GazeRecord) % sizeof(uint64_t) == 0, "records are copied as 64 bit words");
+
+	GazeRecord make_gaze_record(const DefaultGazeEstimationResult& result, const Vec3& point_of_interest,
+		uint64_t timestamp_ns, uint64_t frame);
+
+	/// The layout of the shared memory segment of SharedGazePublisher, defined in GazeOutput.cpp.
+	struct SharedGazeSegment;
+
+	/// \brief Publishes gaze records into a named shared memory segment, so that consumers in other processes, e.g. a
+	/// stimulus renderer, can read the latest record or every record without a syscall. The segment holds a ring of
+	/// slots, each guarded by a seqlock: the publisher makes the sequence number of a slot odd while it writes the record
+	/// and even again once it is done, and readers retry if the number was odd or changed while they copied the record
+	/// out. The publisher never waits for readers and readers never write to the segment.
+	class SharedGazePublisher
+	{
+	public:
+		/// Enough to not lose records at 1 kHz if a reader that wants every record is late by a frame of 60 Hz.
+		static const size_t default_capacity = 64;
+
+		/// \brief Creates the segment, replacing one of the same name. Throws std::invalid_argument if capacity is 0 and
+		/// boost::interprocess::interprocess_exception if the segment cannot be created.
+		explicit SharedGazePublisher(const char* name, size_t capacity = default_capacity);
+		/// Removes the segment. Readers that have it open keep reading the records published so far.
+		~SharedGazePublisher();
+
+		SharedGazePublisher(const SharedGazePublisher&) = delete;
+		SharedGazePublisher& operator=(const SharedGazePublisher&) = delete;
+
+		/// Only to be called from a single thread. Overwrites the oldest record once the ring is full.
+		void publish(const GazeRecord& record);
+
+		uint64_t published_records() const;
+
+	private:
+		const std::string name;
+		boost::interprocess::shared_memory_object memory;
+		boost::interprocess::mapped_region region;
+		SharedGazeSegment* segment;
+	};
+
+	/// Reads the records of a SharedGazePublisher, possibly in another process, from any number of threads.
+	class SharedGazeSubscriber
+	{
+	public:
+		/// \brief Opens the segment of a publisher that has been constructed, with write access although it only reads
+		/// from it. Throws boost::interprocess::interprocess_exception if there is none and std::runtime_error if it is
+		/// not a segment of this version.
+		explicit SharedGazeSubscriber(const char* name);
+
+		/// \brief Copies the latest record into record and returns true, or returns false if none has been published yet
+		/// or the publisher stopped in the middle of writing it.
+		bool latest(GazeRecord& record) const;
+		/// \brief Copies the record with the given index, counting from 0 in the order they were published, into record.
+		/// Returns false if it has not been published yet, has already been overwritten or is incomplete as the publisher
+		/// stopped in the middle of writing it.
+		bool read(uint64_t index, GazeRecord& record) const;
+
+		uint64_t published_records() const;
+		size_t capacity() const;
+
+	private:
+		boost::interprocess::shared_memory_object memory;
+		boost::interprocess::mapped_region region;
+		const SharedGazeSegment* segment;
+	};
+
+	/// \brief Logs gaze records to a binary file from a thread of its own. write only copies the record into a lock-free
+	/// ring, so the estimation thread neither formats nor waits for the file, and the writer thread appends the records in
+	/// blocks. The writer thread polls the ring instead of being woken up, so write makes no syscall either. Records are
+	/// dropped and counted if the ring is full.
+	/// The file is a GazeRecordFileHeader followed by the records, see read_gaze_records.
+	class AsyncGazeRecordWriter
+	{
+	public:
+		static const size_t default_capacity = 4096;
+
+		/// Throws std::runtime_error if the file cannot be written and std::invalid_argument if capacity is less than 2.
+		explicit AsyncGazeRecordWriter(const char* filename, size_t capacity = default_capacity);
+		/// Finishes the file, see finish, without throwing.
+		~AsyncGazeRecordWriter();
+
+		AsyncGazeRecordWriter(const AsyncGazeRecordWriter&) = delete;
+		AsyncGazeRecordWriter& operator=(const AsyncGazeRecordWriter&) = delete;
+
+		/// Only to be called from a single thread. Returns false if the ring is full and the record was dropped.
+		bool write(const GazeRecord& record);
+
+		/// \brief Writes the records that are still queued, stops the writer thread and closes the file. Records written
+		/// afterwards are dropped. Throws std::runtime_error if writing to the file failed.
+		void finish();
+
+		uint64_t written_records() const;
+		uint64_t dropped_records() const;
+
+	private:
+		void work();
+
+		RingBuffer<GazeRecord> records;
+		std::ofstream output;
+		std::thread writer;
+
+		std::atomic<bool> stopping{ false };
+		std::atomic<bool> failed{ false };
+		std::atomic<uint64_t> written{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+	};
+
+	/// The fixed size header of a file of AsyncGazeRecordWriter.
+	struct GazeRecordFileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+
+		static const uint32_t current_version = 1;
+	};
+
+	static_assert(sizeof(GazeRecordFileHeader) == 16, "the records must start 8 byte aligned after the header");
+
+	/// \brief Reads the records of a file of AsyncGazeRecordWriter, ignoring a record that was cut off. Throws
+	/// std::runtime_error if the file cannot be read or is not a file of records of this version.
+	std::vector<GazeRecord> read_gaze_records(const char* filename);
+
+}
+
+#endif
@@ -2,7 +2,15 @@
 #define GENERIC_CALIBRATION_HPP_INCLUDED
 
 #include "GazeEstimationTypes.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
 #include "Utils.hpp"
 #include <ceres/ceres.h>
 
@@ -13,69 +21,159 @@ namespace gazeestimation {
 	{
 	public:
 		typedef std::vector<std::pair<InputData, Vec3>> CalibrationDataMap;
-		typedef std::function<Parameters(Parameters, double const* const*)> ParameterApplicator;
+		/// Sets the calibrated variables on the given parameters in place. Every residual block applies the variables to
+		/// its own copy of the parameters, so the parameters are not copied per evaluation.
+		typedef std::function<void(Parameters&, double const* const*)> ParameterApplicator;
 		typedef std::function<Vec3(const GazeEstimationResult&)> ResultProcessor;
+
+		/// The outcome of a single start of calibrate_multistart.
+		struct CalibrationStart
+		{
+			std::vector<std::vector<double>> initial_values;
+			std::vector<std::vector<double>> values;
+			double initial_cost = 0;
+			double final_cost = 0;
+			int iterations = 0;
+			/// whether the solver considers values usable, see ceres::Solver::Summary::IsSolutionUsable
+			bool usable = false;
+		};
+
+		struct MultiStartResult
+		{
+			/// the values of the best start
+			std::vector<std::vector<double>> values;
+			/// the index of the best start in starts
+			size_t best_start = 0;
+			std::vector<CalibrationStart> starts;
+		};
+
 	private:
+		/// \brief Returns a pointer to each block of values for the parameter blocks of the problem, valid as long as values
+		/// is not resized, so that the variables are freed with values.
+		static std::vector<double*> make_variables(std::vector<std::vector<double>>& values);
+
+		/// \brief Adds a residual block per sample to problem, each with its own clone of estimation if it can be cloned.
+		/// Returns whether all blocks have their own clone and can thus be evaluated concurrently.
+		static bool add_residual_blocks(ceres::Problem& problem,
+			GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
+			const Parameters& parameters,
+			ParameterApplicator applicator,
+			ResultProcessor result_processor,
+			const CalibrationDataMap& data,
+			const std::vector<std::vector<double>>& initial_values,
+			std::vector<double*>& variables);
+
+		/// Bounds the variables, runs the solver and returns the final values. The report of the solver is printed to
+		/// std::cout if print_report is true.
+		static std::vector<std::vector<double>> solve(ceres::Problem& problem,
+			const std::vector<double*>& variables,
+			const std::vector<std::vector<double>>& initial_values,
+			const std::vector<std::vector<std::pair<double, double>>>& bounds,
+			unsigned int num_threads,
+			ceres::Solver::Summary& summary,
+			bool print_report = true);
 
 	public:
+		/// Each calibration sample is its own residual block. If estimation can be cloned, every block gets its own clone 
+		/// and the blocks are evaluated on num_threads threads (0 for one per hardware thread), otherwise on one thread.
+		/// The report of the solver is printed to std::cout if print_report is true.
 		std::vector<std::vector<double>> calibrate(GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
 			Parameters& parameters,
 			ParameterApplicator applicator,
 			ResultProcessor result_processor,
 			CalibrationDataMap& data,
 			std::vector<std::vector<double>> initial_values,
-			std::vector<std::vector<std::pair<double, double>>> bounds);
+			std::vector<std::vector<std::pair<double, double>>> bounds,
+			unsigned int num_threads = 0,
+			bool print_report = true);
+
+		/// \brief Same as calibrate, solved from num_starts starting points to not depend on a single one ending up in a
+		/// poor local minimum. The first start is initial_values, the others draw every bounded variable uniformly from
+		/// its bounds with the given seed and keep the initial value of the unbounded ones. The best start is the usable
+		/// one with the lowest final cost, or the one with the lowest final cost if none is usable.
+		/// If estimation can be cloned, the starts are solved concurrently on num_threads threads (0 for one per hardware
+		/// thread), each with its own clones, otherwise one after another. Nothing is printed.
+		MultiStartResult calibrate_multistart(GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
+			const Parameters& parameters,
+			ParameterApplicator applicator,
+			ResultProcessor result_processor,
+			const CalibrationDataMap& data,
+			const std::vector<std::vector<double>>& initial_values,
+			const std::vector<std::vector<std::pair<double, double>>>& bounds,
+			unsigned int num_starts,
+			unsigned int seed = 0,
+			unsigned int num_threads = 0);
+
+		/// \brief Same as calibrate, with derivatives from automatic differentiation instead of numeric differentiation.
+		/// Model combines applicator, estimation and result processor for any scalar type T:
+		/// template <typename T> bool operator()(const InputData& data, T const* const* variables, Vec3T<T>& estimate) const
+		/// sets estimate to what is compared with the truth of the sample and returns false if data cannot be estimated.
+		/// All residual blocks share model and are evaluated on num_threads threads (0 for one per hardware thread).
+		template <class Model>
+		std::vector<std::vector<double>> calibrate_autodiff(const Model& model,
+			CalibrationDataMap& data,
+			std::vector<std::vector<double>> initial_values,
+			std::vector<std::vector<std::pair<double, double>>> bounds,
+			unsigned int num_threads = 0);
 
 	};
 
+	/// The error of the estimate for a single calibration sample.
 	template <class Parameters, class InputData, class GazeEstimationResult>
 	class CalibrationErrorFunctor
 	{
 	private:
 		GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>* const gaze_estimation;
-		const typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::CalibrationDataMap* const data;
+		const std::pair<InputData, Vec3>* const sample;
 		typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::ParameterApplicator applicator;
 		typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::ResultProcessor result_processor;
-		const Parameters parameters;
+		/// the parameters with the variables of the latest evaluation applied
+		mutable Parameters our_parameters;
+		/// owns gaze_estimation if this functor has its own copy of the method
+		std::unique_ptr<GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>> owned_estimation;
+		/// the stages of the latest estimate of the sample, so that changing a variable only recomputes the stages that
+		/// depend on it, null if the method does not cache
+		std::unique_ptr<EstimationCache> cache;
 
 	public:
 
+		/// \param	gaze_estimation	The method used for this sample. Ownership is taken if owned is true.
 		CalibrationErrorFunctor(GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>* const gaze_estimation,
-			const typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::CalibrationDataMap* const data,
+			bool owned,
+			const std::pair<InputData, Vec3>* const sample,
 			typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::ParameterApplicator applicator,
 			typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::ResultProcessor result_proccessor,
-			const Parameters parameters
+			const Parameters& parameters
 		) :
 			gaze_estimation(gaze_estimation),
-			data(data),
+			sample(sample),
 			applicator(applicator),
 			result_processor(result_proccessor),
-			parameters(parameters)
+			our_parameters(parameters),
+			owned_estimation(owned ? gaze_estimation : nullptr),
+			cache(gaze_estimation->make_cache())
 		{
 
 		}
 
+		/// Returns false if the sample cannot be estimated with the variables, so that ceres rejects them instead of
+		/// fitting to the default filled result.
 		bool operator()(double const* const* variables, double* residual) const {
 
-			Parameters our_parameters = applicator(parameters, variables);
+			applicator(our_parameters, variables);
 
-			double error = 0;
-			Vec3 error_vec = make_vec3(0,0,0);
-			int index = 0;
-			for (auto It = data->begin(); It != data->end(); ++It)
-			{
-				InputData data_in = (*It).first;
-				Vec3 truth = (*It).second;
-
-				GazeEstimationResult result = gaze_estimation->estimate(data_in, our_parameters);
-				const Vec3 estimate = result_processor(result);
-				const Vec3 diff = truth - estimate;
-								
-				residual[index++] = diff[0];
-				residual[index++] = diff[1];
-				residual[index++] = diff[2];
-			}
+			const GazeEstimationResult result = cache 
+				? gaze_estimation->estimate_cached(sample->first, our_parameters, *cache)
+				: gaze_estimation->estimate(sample->first, our_parameters);
+			if (!result.is_valid)
+				return false;
 
+			const Vec3 estimate = result_processor(result);
+			const Vec3 diff = sample->second - estimate;
+
+			residual[0] = diff[0];
+			residual[1] = diff[1];
+			residual[2] = diff[2];
 
 			return true;
 		}
@@ -83,39 +181,58 @@ namespace gazeestimation {
 
 
 
-	template <class Parameters, class InputData, class GazeEstimationResult>
-	std::vector<std::vector<double>> GenericCalibration<Parameters, InputData, GazeEstimationResult>::calibrate(
-		GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
-		Parameters& parameters,
-		ParameterApplicator applicator,
-		ResultProcessor result_processor,
-		CalibrationDataMap& data,
-		std::vector<std::vector<double>> initial_values,
-		std::vector<std::vector<std::pair<double, double>>> bounds)
+	/// The error of the estimate of a model for a single calibration sample, see GenericCalibration::calibrate_autodiff.
+	template <class Model, class InputData>
+	class AutoDiffCalibrationErrorFunctor
 	{
-		assert(bounds.size() == initial_values.size());
+	private:
+		const Model* const model;
+		const std::pair<InputData, Vec3>* const sample;
 
-		ceres::Problem problem;
-		auto cost_function = new ceres::DynamicNumericDiffCostFunction<CalibrationErrorFunctor<Parameters, InputData, GazeEstimationResult>, ceres::CENTRAL>
-			(new CalibrationErrorFunctor<Parameters, InputData, GazeEstimationResult>(&estimation, &data, applicator, result_processor, parameters));
-		for (int i = 0; i < initial_values.size(); i++)
+	public:
+		AutoDiffCalibrationErrorFunctor(const Model* const model, const std::pair<InputData, Vec3>* const sample) :
+			model(model),
+			sample(sample)
 		{
-			cost_function->AddParameterBlock(initial_values[i].size());
+
 		}
-		cost_function->SetNumResiduals(data.size() * 3);
 
+		template <typename T>
+		bool operator()(T const* const* variables, T* residual) const {
+			Vec3T<T> estimate;
+			if (!(*model)(sample->first, variables, estimate))
+				return false;
+
+			residual[0] = T(sample->second[0]) - estimate[0];
+			residual[1] = T(sample->second[1]) - estimate[1];
+			residual[2] = T(sample->second[2]) - estimate[2];
+
+			return true;
+		}
+	};
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	std::vector<double*> GenericCalibration<Parameters, InputData, GazeEstimationResult>::make_variables(
+		std::vector<std::vector<double>>& values)
+	{
 		std::vector<double*> variables;
-		for(unsigned int i = 0; i < initial_values.size(); i++)
+		for(unsigned int i = 0; i < values.size(); i++)
 		{
-			double* element = new double[initial_values[i].size()];
-			for(int j = 0; j < initial_values[i].size(); j++)
-			{
-				element[j] = initial_values[i][j];
-			}
-			variables.push_back(element);
+			variables.push_back(values[i].data());
 		}
-		problem.AddResidualBlock(cost_function, nullptr, variables);
+		return variables;
+	}
 
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	std::vector<std::vector<double>> GenericCalibration<Parameters, InputData, GazeEstimationResult>::solve(
+		ceres::Problem& problem,
+		const std::vector<double*>& variables,
+		const std::vector<std::vector<double>>& initial_values,
+		const std::vector<std::vector<std::pair<double, double>>>& bounds,
+		unsigned int num_threads,
+		ceres::Solver::Summary& summary,
+		bool print_report)
+	{
 		for(unsigned int i = 0; i < initial_values.size(); i++)
 		{
 			for (unsigned int j = 0; j < bounds[i].size(); j++) {
@@ -133,13 +250,16 @@ namespace gazeestimation {
 		options.max_num_iterations = 1e4;
 		//	options.min_line_search_step_size = 1e-3;
 		//	options.use_nonmonotonic_steps = true;
+		options.num_threads = num_threads;
 
-		ceres::Solver::Summary summary;
 		Solve(options, &problem, &summary);
-		std::cout << summary.FullReport() << std::endl;
-		std::cout << std::endl;
-		std::cout << summary.IsSolutionUsable() << std::endl;
-		std::cout << std::endl;
+		if (print_report)
+		{
+			std::cout << summary.FullReport() << std::endl;
+			std::cout << std::endl;
+			std::cout << summary.IsSolutionUsable() << std::endl;
+			std::cout << std::endl;
+		}
 
 		std::vector<std::vector<double>> result;
 		for(unsigned int i = 0; i < variables.size(); i++)
@@ -151,10 +271,220 @@ namespace gazeestimation {
 			}
 			result.push_back(this_variable);
 		}
-		//TODO: Memory deallocation
 		return result;
 	}
 
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	bool GenericCalibration<Parameters, InputData, GazeEstimationResult>::add_residual_blocks(
+		ceres::Problem& problem,
+		GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
+		const Parameters& parameters,
+		ParameterApplicator applicator,
+		ResultProcessor result_processor,
+		const CalibrationDataMap& data,
+		const std::vector<std::vector<double>>& initial_values,
+		std::vector<double*>& variables)
+	{
+		typedef CalibrationErrorFunctor<Parameters, InputData, GazeEstimationResult> ErrorFunctor;
+
+		// one residual block per sample, each with its own copy of the method so that they can be evaluated concurrently
+		bool all_cloned = true;
+		for (const auto& sample : data)
+		{
+			std::unique_ptr<GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>> clone = estimation.clone();
+			all_cloned = all_cloned && clone;
+			const bool owned = static_cast<bool>(clone);
+			auto method = owned ? clone.release() : &estimation;
+
+			auto cost_function = new ceres::DynamicNumericDiffCostFunction<ErrorFunctor, ceres::CENTRAL>(
+				new ErrorFunctor(method, owned, &sample, applicator, result_processor, parameters));
+			for (unsigned int i = 0; i < initial_values.size(); i++)
+			{
+				cost_function->AddParameterBlock(initial_values[i].size());
+			}
+			cost_function->SetNumResiduals(3);
+			problem.AddResidualBlock(cost_function, nullptr, variables);
+		}
+		return all_cloned;
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	std::vector<std::vector<double>> GenericCalibration<Parameters, InputData, GazeEstimationResult>::calibrate(
+		GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
+		Parameters& parameters,
+		ParameterApplicator applicator,
+		ResultProcessor result_processor,
+		CalibrationDataMap& data,
+		std::vector<std::vector<double>> initial_values,
+		std::vector<std::vector<std::pair<double, double>>> bounds,
+		unsigned int num_threads,
+		bool print_report)
+	{
+		assert(bounds.size() == initial_values.size());
+
+		if (num_threads == 0)
+		{
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		// the variables live in values, which outlives the problem
+		std::vector<std::vector<double>> values = initial_values;
+		ceres::Problem problem;
+		std::vector<double*> variables = make_variables(values);
+		const bool all_cloned = add_residual_blocks(problem, estimation, parameters, applicator, result_processor, data,
+			initial_values, variables);
+
+		ceres::Solver::Summary summary;
+		return solve(problem, variables, initial_values, bounds, all_cloned ? num_threads : 1, summary, print_report);
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	typename GenericCalibration<Parameters, InputData, GazeEstimationResult>::MultiStartResult 
+		GenericCalibration<Parameters, InputData, GazeEstimationResult>::calibrate_multistart(
+		GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>& estimation,
+		const Parameters& parameters,
+		ParameterApplicator applicator,
+		ResultProcessor result_processor,
+		const CalibrationDataMap& data,
+		const std::vector<std::vector<double>>& initial_values,
+		const std::vector<std::vector<std::pair<double, double>>>& bounds,
+		unsigned int num_starts,
+		unsigned int seed,
+		unsigned int num_threads)
+	{
+		assert(bounds.size() == initial_values.size());
+
+		if (num_threads == 0)
+		{
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		num_starts = std::max(1u, num_starts);
+
+		MultiStartResult result;
+		result.starts.resize(num_starts);
+		result.starts[0].initial_values = initial_values;
+		std::mt19937 random(seed);
+		for (unsigned int start = 1; start < num_starts; start++)
+		{
+			std::vector<std::vector<double>> start_values = initial_values;
+			for (unsigned int i = 0; i < start_values.size(); i++)
+			{
+				for (unsigned int j = 0; j < bounds[i].size() && j < start_values[i].size(); j++)
+				{
+					std::uniform_real_distribution<double> within_bounds(bounds[i][j].first, bounds[i][j].second);
+					start_values[i][j] = within_bounds(random);
+				}
+			}
+			result.starts[start].initial_values = start_values;
+		}
+
+		// without clones every start would share estimation, so the starts can only run one after another
+		std::unique_ptr<GazeEstimationMethod<Parameters, InputData, GazeEstimationResult>> probe = estimation.clone();
+		const unsigned int num_workers = probe ? std::min(num_threads, num_starts) : 1;
+		// threads left over once every start has one evaluate the residual blocks of the starts
+		const unsigned int threads_per_start = probe ? std::max(1u, num_threads / num_workers) : 1;
+		probe.reset();
+
+		std::atomic<unsigned int> next_start{ 0 };
+		std::exception_ptr error;
+		std::mutex error_mutex;
+		const auto work = [&]()
+		{
+			for (unsigned int start = next_start++; start < num_starts; start = next_start++)
+			{
+				try
+				{
+					CalibrationStart& outcome = result.starts[start];
+					std::vector<std::vector<double>> values = outcome.initial_values;
+					ceres::Problem problem;
+					std::vector<double*> variables = make_variables(values);
+					add_residual_blocks(problem, estimation, parameters, applicator, result_processor, data,
+						outcome.initial_values, variables);
+
+					ceres::Solver::Summary summary;
+					outcome.values = solve(problem, variables, outcome.initial_values, bounds, threads_per_start, summary, false);
+					outcome.initial_cost = summary.initial_cost;
+					outcome.final_cost = summary.final_cost;
+					outcome.iterations = static_cast<int>(summary.iterations.size());
+					outcome.usable = summary.IsSolutionUsable();
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (unsigned int i = 1; i < num_workers; i++)
+		{
+			workers.emplace_back(work);
+		}
+		work();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		if (error)
+			std::rethrow_exception(error);
+
+		double best_cost = std::numeric_limits<double>::infinity();
+		bool best_usable = false;
+		for (size_t start = 0; start < result.starts.size(); start++)
+		{
+			const CalibrationStart& outcome = result.starts[start];
+			const bool better = (outcome.usable && !best_usable) 
+				|| (outcome.usable == best_usable && outcome.final_cost < best_cost);
+			if (better || start == 0)
+			{
+				result.best_start = start;
+				best_cost = outcome.final_cost;
+				best_usable = outcome.usable;
+			}
+		}
+		result.values = result.starts[result.best_start].values;
+		return result;
+	}
+
+	template <class Parameters, class InputData, class GazeEstimationResult>
+	template <class Model>
+	std::vector<std::vector<double>> GenericCalibration<Parameters, InputData, GazeEstimationResult>::calibrate_autodiff(
+		const Model& model,
+		CalibrationDataMap& data,
+		std::vector<std::vector<double>> initial_values,
+		std::vector<std::vector<std::pair<double, double>>> bounds,
+		unsigned int num_threads)
+	{
+		assert(bounds.size() == initial_values.size());
+
+		typedef AutoDiffCalibrationErrorFunctor<Model, InputData> ErrorFunctor;
+
+		if (num_threads == 0)
+		{
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		std::vector<std::vector<double>> values = initial_values;
+		ceres::Problem problem;
+		std::vector<double*> variables = make_variables(values);
+
+		for (const auto& sample : data)
+		{
+			auto cost_function = new ceres::DynamicAutoDiffCostFunction<ErrorFunctor>(new ErrorFunctor(&model, &sample));
+			for (unsigned int i = 0; i < initial_values.size(); i++)
+			{
+				cost_function->AddParameterBlock(initial_values[i].size());
+			}
+			cost_function->SetNumResiduals(3);
+			problem.AddResidualBlock(cost_function, nullptr, variables);
+		}
+
+		ceres::Solver::Summary summary;
+		return solve(problem, variables, initial_values, bounds, num_threads, summary);
+	}
+
 }
 
 #endif
\ No newline at end of file
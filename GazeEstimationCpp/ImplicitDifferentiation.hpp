@@ -0,0 +1,61 @@
+#ifndef IMPLICIT_DIFFERENTIATION_HPP_INCLUDED
+#define IMPLICIT_DIFFERENTIATION_HPP_INCLUDED
+
+#include "MathTypes.hpp"
+
+#include <vector>
+
+#include <Eigen/Cholesky>
+#include <ceres/ceres.h>
+
+/// Helpers for scalar generic code that solves an inner problem in double and then needs the derivatives of its
+/// solution in the scalar type of the outer problem, e.g. the jet type of automatic differentiation.
+namespace gazeestimation {
+
+	inline double value_of(double x)
+	{
+		return x;
+	}
+
+	/// Returns the value of x without its derivatives.
+	template <int N>
+	inline double value_of(const ceres::Jet<double, N>& x)
+	{
+		return x.a;
+	}
+
+	template <typename T>
+	inline Vec3 value_of(const Vec3T<T>& x)
+	{
+		return make_vec3(value_of(x[0]), value_of(x[1]), value_of(x[2]));
+	}
+
+	inline void apply_implicit_derivatives(const Eigen::MatrixXd& hessian, const double* gradient, double* x)
+	{
+		// doubles carry no derivatives
+	}
+
+	/// \brief Gives the minimizer x of f(x, theta) its derivatives with respect to theta.
+	/// By the implicit function theorem on df/dx = 0, dx/dtheta = -(d^2f/dx^2)^-1 d^2f/(dx dtheta).
+	/// \param	hessian		d^2f/dx^2 at the solution.
+	/// \param	gradient	df/dx at the solution with x held constant, so its derivatives are d^2f/(dx dtheta).
+	/// \param	x			The solution, receives the derivatives.
+	template <int N>
+	void apply_implicit_derivatives(const Eigen::MatrixXd& hessian, const ceres::Jet<double, N>* gradient, ceres::Jet<double, N>* x)
+	{
+		Eigen::Matrix<double, Eigen::Dynamic, N> mixed(hessian.rows(), N);
+		for (Eigen::Index i = 0; i < hessian.rows(); i++)
+		{
+			mixed.row(i) = gradient[i].v.transpose();
+		}
+
+		const Eigen::Matrix<double, Eigen::Dynamic, N> derivatives = hessian.ldlt().solve(mixed);
+		for (Eigen::Index i = 0; i < hessian.rows(); i++)
+		{
+			x[i].v = -derivatives.row(i).transpose();
+		}
+	}
+
+}
+
+#endif
@@ -1,10 +1,17 @@
 #ifndef INPUT_OUTPUT_HELPERS_INCLUDED
 #define INPUT_OUTPUT_HELPERS_INCLUDED
 
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <stdexcept>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/tokenizer.hpp>
 
+#include "BinaryRecording.hpp"
 #include "GazeEstimationTypes.hpp"
 #include "GenericCalibration.hpp"
 
@@ -90,6 +97,185 @@ inline std::vector<std::pair<gazeestimation::PupilCenterGlintInputs, gazeestimat
 }
 
 
+/// \brief Reads the frames of a csv recording one at a time from a memory mapping of the file, without copying the file 
+/// or splitting its lines into strings. Fields are plain numbers, quoting and escaping are not supported.
+class CsvFrameReader
+{
+public:
+	/// The supported column layouts.
+	enum Layout
+	{
+		/// truth x, y, pupil x, y, glint 1 x, y, two unused columns, glint 2 x, y, as read by read_input_file
+		OneCamera = 0,
+		/// truth x, y, an unused column, number of cameras, number of lights, then all pupils and then all glints
+		/// camera by camera, as read by read_input_file_twocameras
+		TwoCameras
+	};
+
+	/// (input data, truth)
+	typedef std::pair<gazeestimation::PupilCenterGlintInputs, gazeestimation::Vec2> Frame;
+
+	/// Throws boost::interprocess::interprocess_exception if the file cannot be mapped, e.g. because it does not exist
+	/// or is empty.
+	CsvFrameReader(const char* filename, Layout layout) :
+		mapping(filename, boost::interprocess::read_only),
+		region(mapping, boost::interprocess::read_only),
+		position(static_cast<const char*>(region.get_address())),
+		end(position + region.get_size()),
+		layout(layout)
+	{
+		
+	}
+
+	/// \brief Reads the next frame into frame, reusing the storage it already has. Empty lines are skipped.
+	/// Returns false at the end of the file, throws std::invalid_argument if a line cannot be parsed.
+	bool next(Frame& frame)
+	{
+		while (position < end)
+		{
+			const char* line_end = static_cast<const char*>(std::memchr(position, '\n', end - position));
+			if (!line_end)
+				line_end = end;
+
+			split_fields(position, line_end);
+			position = line_end < end ? line_end + 1 : end;
+			line_number++;
+
+			if (fields.size() == 1 && is_blank(fields[0].first, fields[0].second))
+				continue;
+
+			if (layout == OneCamera)
+				parse_one_camera(frame);
+			else
+				parse_two_cameras(frame);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	typedef std::pair<const char*, const char*> Field;
+
+	void split_fields(const char* begin, const char* line_end)
+	{
+		fields.clear();
+		const char* field_begin = begin;
+		for (const char* c = begin; c < line_end; c++)
+		{
+			if (*c == ',')
+			{
+				fields.push_back(Field(field_begin, c));
+				field_begin = c + 1;
+			}
+		}
+		fields.push_back(Field(field_begin, line_end));
+	}
+
+	static bool is_blank(const char* begin, const char* field_end)
+	{
+		for (const char* c = begin; c < field_end; c++)
+		{
+			if (*c != ' ' && *c != '\t' && *c != '\r')
+				return false;
+		}
+		return true;
+	}
+
+	/// Parses field index like std::stod does. The field is copied into a small buffer first, as the mapping is not 
+	/// null terminated.
+	double number(size_t index) const
+	{
+		if (index >= fields.size())
+			throw std::invalid_argument("missing column " + std::to_string(index) + " in line " + std::to_string(line_number));
+
+		char buffer[64];
+		const size_t length = fields[index].second - fields[index].first;
+		if (length >= sizeof(buffer))
+			throw std::invalid_argument("column " + std::to_string(index) + " too long in line " + std::to_string(line_number));
+		std::memcpy(buffer, fields[index].first, length);
+		buffer[length] = '\0';
+
+		char* parsed_end = nullptr;
+		const double value = std::strtod(buffer, &parsed_end);
+		if (parsed_end == buffer || !is_blank(parsed_end, buffer + length))
+			throw std::invalid_argument("no number in column " + std::to_string(index) + " in line " + std::to_string(line_number));
+		return value;
+	}
+
+	void parse_one_camera(Frame& frame) const
+	{
+		frame.first.data.resize(1);
+		gazeestimation::PupilCenterGlintInput& pcgi = frame.first.data[0];
+		pcgi.pupil_center = gazeestimation::make_vec2(number(2), number(3));
+		pcgi.glints.resize(2);
+		pcgi.glints[0] = gazeestimation::make_vec2(number(4), number(5));
+		pcgi.glints[1] = gazeestimation::make_vec2(number(8), number(9));
+		frame.second = gazeestimation::make_vec2(number(0), number(1));
+	}
+
+	void parse_two_cameras(Frame& frame) const
+	{
+		const int num_cameras = static_cast<int>(number(3));
+		const int num_lights = static_cast<int>(number(4));
+		if (num_cameras < 1 || num_cameras > static_cast<int>(gazeestimation::max_cameras)
+			|| num_lights < 0 || num_lights > static_cast<int>(gazeestimation::max_glints_per_camera))
+			throw std::invalid_argument("unsupported number of cameras or lights in line " + std::to_string(line_number));
+
+		const int start_of_vars = 5;
+		const int start_of_glints = start_of_vars + num_cameras * 2;
+		frame.first.data.resize(num_cameras);
+		for (int i = 0; i < num_cameras; i++)
+		{
+			const int pupil_index = start_of_vars + i * 2;
+			gazeestimation::PupilCenterGlintInput& pcgi = frame.first.data[i];
+			pcgi.pupil_center = gazeestimation::make_vec2(number(pupil_index), number(pupil_index + 1));
+			pcgi.glints.resize(num_lights);
+			for (int j = 0; j < num_lights; j++)
+			{
+				const int glint_index = start_of_glints + num_lights * 2 * i + j * 2;
+				pcgi.glints[j] = gazeestimation::make_vec2(number(glint_index), number(glint_index + 1));
+			}
+		}
+		frame.second = gazeestimation::make_vec2(number(0), number(1));
+	}
+
+	boost::interprocess::file_mapping mapping;
+	boost::interprocess::mapped_region region;
+	const char* position;
+	const char* end;
+	Layout layout;
+
+	/// the fields of the current line, kept to reuse its storage
+	std::vector<Field> fields;
+	size_t line_number = 0;
+};
+
+/// \brief Converts a csv recording into a binary recording with truth. The number of cameras and glints is taken from 
+/// the first frame, all other frames must match it. Returns the number of frames written, nothing is written if there
+/// are none. Throws std::invalid_argument if the first frame has no cameras.
+inline size_t convert_csv_to_binary_recording(const char* csv_filename, CsvFrameReader::Layout layout, const char* binary_filename)
+{
+	CsvFrameReader reader(csv_filename, layout);
+	CsvFrameReader::Frame frame;
+	if (!reader.next(frame))
+		return 0;
+	if (frame.first.data.empty())
+		throw std::invalid_argument("the first frame of the recording has no cameras");
+
+	BinaryRecordingWriter writer(binary_filename, static_cast<unsigned int>(frame.first.data.size()), 
+		static_cast<unsigned int>(frame.first.data[0].glints.size()), true);
+	size_t num_frames = 0;
+	do
+	{
+		writer.write(frame.first, frame.second);
+		num_frames++;
+	} while (reader.next(frame));
+
+	writer.finish();
+	return num_frames;
+}
+
+
 inline double deg_to_rad(double a)
 {
 	return a * 3.141592653589793 / 180.;
@@ -104,6 +290,8 @@ inline std::string gaze_estimation_result_to_string(const gazeestimation::Defaul
 {
 	std::stringstream ss("");
 	ss << "Valid: " << r.is_valid << "\n";
+	if (r.is_error)
+		ss << "Error: " << gazeestimation::DefaultGazeEstimationResult::error_description(r.error) << "\n";
 	ss << "Center of Cornea\t" << gazeestimation::vec3_to_string(r.center_of_cornea) << "\n";
 	ss << "Optical Axis\t" << gazeestimation::vec3_to_string(r.optical_axis) << "\n";
 	ss << "Visual Axis\t" << gazeestimation::vec3_to_string(r.visual_axis) << "\n";
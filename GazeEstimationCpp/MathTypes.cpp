@@ -4,19 +4,39 @@
 
 namespace gazeestimation
 {
-	Vec3 shortest_line_segment(const Vec3& o1, const Vec3& d1, const Vec3& o2, const Vec3& d2)
+	template <typename T>
+	Vec3T<T> shortest_line_segment(const Vec3T<T>& o1, const Vec3T<T>& d1, const Vec3T<T>& o2, const Vec3T<T>& d2)
 	{
-		Eigen::Matrix3Xd mat1(3,2);
-		mat1 << d1[0], d2[0],
-			d1[1], d2[1],
-			d1[2], d2[2];
-		Eigen::Matrix2d mat2_original;
-		mat2_original << (dot(d1, d1)), -dot(d1, d2),
-			-dot(d1, d2), dot(d2, d2);
-		auto mat2_inverse = mat2_original.inverse();
-		Eigen::Matrix2Xd mat3(2, 1);
-		mat3 << -dot(d1, o1 - o2),
-			dot(d2, o1 - o2);
-		return 0.5 * mat1 * mat2_inverse * mat3 + 0.5 * (o1 + o2);
+		// solves the 2x2 normal equations for a and b by Cramer's rule
+		const T d11 = dot(d1, d1);
+		const T d12 = dot(d1, d2);
+		const T d22 = dot(d2, d2);
+		const T e1 = -dot(d1, o1 - o2);
+		const T e2 = dot(d2, o1 - o2);
+		const T determinant = d11 * d22 - d12 * d12;
+		const T a = (d22 * e1 + d12 * e2) / determinant;
+		const T b = (d12 * e1 + d11 * e2) / determinant;
+		return T(0.5) * (o1 + a * d1 + o2 + b * d2);
 	}
+
+	template <typename T>
+	Vec3T<T> closest_point_to_lines(const Vec3T<T>* origins, const Vec3T<T>* directions, size_t count)
+	{
+		// sum over the lines of the projections onto the plane normal to each line, applied to the points and the origins
+		Mat3x3T<T> A = Mat3x3T<T>::Zero();
+		Vec3T<T> b(T(0), T(0), T(0));
+		for (size_t i = 0; i < count; i++)
+		{
+			const Vec3T<T> d = normalized(directions[i]);
+			const Mat3x3T<T> projection = Mat3x3T<T>::Identity() - d * d.transpose();
+			A += projection;
+			b += projection * origins[i];
+		}
+		return A.ldlt().solve(b);
+	}
+
+	template Vec3 shortest_line_segment<double>(const Vec3& o1, const Vec3& d1, const Vec3& o2, const Vec3& d2);
+	template Vec3f shortest_line_segment<float>(const Vec3f& o1, const Vec3f& d1, const Vec3f& o2, const Vec3f& d2);
+	template Vec3 closest_point_to_lines<double>(const Vec3* origins, const Vec3* directions, size_t count);
+	template Vec3f closest_point_to_lines<float>(const Vec3f* origins, const Vec3f* directions, size_t count);
 }
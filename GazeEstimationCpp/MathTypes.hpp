@@ -2,6 +2,7 @@
 #define MATH_TYPES_HPP_INCLUDED
 
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 
 namespace gazeestimation {
 
@@ -13,6 +14,17 @@ namespace gazeestimation {
 	typedef Eigen::Vector3d Vec3;
 	typedef Eigen::Matrix3d Mat3x3;
 
+	/// Counterparts of the types above for a generic scalar type, e.g. the jet type the optimization backend uses
+	/// for automatic differentiation, or float for the single precision estimation path (see
+	/// OneCamSphericalGE::estimate_scalar). The functions below are generic in the scalar type as well.
+	template <typename T> using Vec2T = Eigen::Matrix<T, 2, 1>;
+	template <typename T> using Vec3T = Eigen::Matrix<T, 3, 1>;
+	template <typename T> using Mat3x3T = Eigen::Matrix<T, 3, 3>;
+
+	typedef Vec2T<float> Vec2f;
+	typedef Vec3T<float> Vec3f;
+	typedef Mat3x3T<float> Mat3x3f;
+
 	inline Vec2 make_vec2(double a, double b)
 	{
 		return Vec2(a, b);
@@ -23,37 +35,38 @@ namespace gazeestimation {
 		return Vec3(a, b, c);
 	}
 
-	inline Mat3x3 mat_prod(const Mat3x3& a, const Mat3x3& b)
+	template <typename T>
+	inline Mat3x3T<T> mat_prod(const Mat3x3T<T>& a, const Mat3x3T<T>& b)
 	{
 		return a * b;
 	}
 
-	inline double dot(const Vec3& a, const Vec3& b)
+	template <typename A, typename B>
+	inline typename A::Scalar dot(const Eigen::MatrixBase<A>& a, const Eigen::MatrixBase<B>& b)
 	{
 		return a.dot(b);
 	}
 
-	inline Vec3 mat3vec3_prod(const Mat3x3& a, const Vec3& b)
+	template <typename T>
+	inline Vec3T<T> mat3vec3_prod(const Mat3x3T<T>& a, const Vec3T<T>& b)
 	{
 		return a * b;
 	}
 
-	inline Vec3 normalized(const Vec3& a)
+	template <typename A>
+	inline typename Eigen::MatrixBase<A>::PlainObject normalized(const Eigen::MatrixBase<A>& a)
 	{
 		return a.normalized();
 	}
 
-	inline double length(const Vec3& a)
-	{
-		return a.norm();
-	}
-
-	inline double length(const Vec2& a)
+	template <typename A>
+	inline typename A::Scalar length(const Eigen::MatrixBase<A>& a)
 	{
 		return a.norm();
 	}
 
-	inline double squared_length(const Vec3& a)
+	template <typename A>
+	inline typename A::Scalar squared_length(const Eigen::MatrixBase<A>& a)
 	{
 		return a.squaredNorm();
 	}
@@ -82,28 +95,43 @@ namespace gazeestimation {
 		return Eigen::Matrix3d::Identity();
 	}
 
-	inline Mat3x3 calculate_extrinsic_rotation_matrix(double alpha, double beta, double gamma)
+	template <typename T>
+	inline Mat3x3T<T> calculate_extrinsic_rotation_matrix(const T& alpha, const T& beta, const T& gamma)
 	{
-		Mat3x3 Rx, Ry, Rz;
-		Rx << 1, 0, 0,
-			0, std::cos(alpha), -std::sin(alpha),
-			0, std::sin(alpha), std::cos(alpha);
-		Ry << std::cos(beta), 0, std::sin(beta),
-			0, 1, 0,
-			-std::sin(beta), 0, std::cos(beta);
-		Rz << std::cos(gamma), -std::sin(gamma), 0,
-			std::sin(gamma), std::cos(gamma), 0,
-			0, 0, 1;
+		using std::cos;
+		using std::sin;
+		const T zero(0);
+		const T one(1);
+
+		Mat3x3T<T> Rx, Ry, Rz;
+		Rx << one, zero, zero,
+			zero, cos(alpha), -sin(alpha),
+			zero, sin(alpha), cos(alpha);
+		Ry << cos(beta), zero, sin(beta),
+			zero, one, zero,
+			-sin(beta), zero, cos(beta);
+		Rz << cos(gamma), -sin(gamma), zero,
+			sin(gamma), cos(gamma), zero,
+			zero, zero, one;
 		return mat_prod(Rz, mat_prod(Ry, Rx));
 	}
 
-	inline Vec3 cross_product(const Vec3& a, const Vec3& b)
+	template <typename A, typename B>
+	inline Vec3T<typename A::Scalar> cross_product(const Eigen::MatrixBase<A>& a, const Eigen::MatrixBase<B>& b)
 	{
 		return a.cross(b);
 	}
 
 	/// Returns the midpoint of the shortest segment between the two lines o1+a * d1 and o2 + b * d2;
-	Vec3 shortest_line_segment(const Vec3& o1, const Vec3& d1, const Vec3& o2, const Vec3& d2);
+	/// Instantiated for double and float in MathTypes.cpp.
+	template <typename T>
+	Vec3T<T> shortest_line_segment(const Vec3T<T>& o1, const Vec3T<T>& d1, const Vec3T<T>& o2, const Vec3T<T>& d2);
+
+	/// \brief Returns the point with the least sum of squared distances to the lines origins[i] + a * directions[i], which
+	/// for two lines is the midpoint of shortest_line_segment. Works on 3x3 normal equations whatever the number of lines,
+	/// which must be at least 2 and not all parallel. Instantiated for double and float in MathTypes.cpp.
+	template <typename T>
+	Vec3T<T> closest_point_to_lines(const Vec3T<T>* origins, const Vec3T<T>* directions, size_t count);
 }
 
 #endif
\ No newline at end of file
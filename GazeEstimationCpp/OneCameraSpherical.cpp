@@ -7,11 +7,17 @@
 // J Chen, Y Tong, W Gray, Q Ji - Proceedings of the 2008 symposium on Eye tracking , 2008
 #include "OneCameraSpherical.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <utility>
 
 #include <ceres/ceres.h>
 
+#include "BatchCalculations.hpp"
+#include "OneCameraSphericalScalar.hpp"
 #include "PinholeCameraModel.hpp"
+#include "SolverUtils.hpp"
 #include "Utils.hpp"
 #include "SharedCalculations.hpp"
 
@@ -19,205 +25,735 @@
 namespace gazeestimation {
 
 
-	Vec3 calculate_q(double kq, const Vec3& o, const Vec3& u)
+	/// The data the cornea residuals for kq are evaluated on.
+	struct KqResidualInputs
 	{
-		return o + kq * normalized(o - u);
-	}
+		std::vector<Vec3> glints;
+		std::vector<Vec3> lights;
+		Vec3 camera_position;
+		double R = 0;
+	};
 
-	Vec3 calculate_cornea_center(const Vec3& q, const Vec3& light, const Vec3& camera_position, const double R)
+	/// The residuals between the cornea centers resulting from each glint, with the number of glints fixed at 
+	/// compile time so that the optimization backend can use fixed size automatic differentiation. 
+	/// Expects all kq in a single parameter block.
+	template <int NumGlints>
+	class DistanceBetweenCorneasFunctor
 	{
-		const Vec3 l_q_unit = normalized(light - q);
-		const Vec3 o_q_unit = normalized(camera_position - q);
-		return q - R * normalized(l_q_unit + o_q_unit);
-	}
+	private:
+		const KqResidualInputs* const inputs;
 
-	class DistanceBetweenCorneasFunctor
+	public:
+		enum { NumResiduals = 3 * NumGlints * (NumGlints - 1) / 2 };
+
+		explicit DistanceBetweenCorneasFunctor(const KqResidualInputs* const inputs) : inputs(inputs) {}
+
+		template <typename T>
+		bool operator()(const T* const kq, T* residual) const {
+			Vec3T<T> cs[NumGlints];
+
+			for (int i = 0; i < NumGlints; i++)
+			{
+				const Vec3T<T> q = calculate_q(kq[i], inputs->camera_position, inputs->glints[i]);
+				cs[i] = calculate_cornea_center(q, inputs->lights[i], inputs->camera_position, inputs->R);
+			}
+
+			cornea_center_differences(cs, NumGlints, residual);
+			return true;
+		}
+	};
+
+	/// Same as DistanceBetweenCorneasFunctor, for glint counts that have no fixed size instantiation.
+	class DynamicDistanceBetweenCorneasFunctor
 	{
 	private:
-		const std::vector<Vec3>* const glints;
-		const std::vector<Vec3>* const lights;
-		double R;
-		const Vec3 camera_position;
+		const KqResidualInputs* const inputs;
 
 	public:
-		DistanceBetweenCorneasFunctor(const std::vector<Vec3>* const glints, const std::vector<Vec3>* const lights, double r,
-			Vec3 camera_position)
-			: glints(glints),
-			lights(lights),
-			R(r),
-			camera_position(std::move(camera_position)) {}
+		explicit DynamicDistanceBetweenCorneasFunctor(const KqResidualInputs* const inputs) : inputs(inputs) {}
 
-		bool operator()(double const* const* variables, double* residual) const {
-			std::vector<Vec3> cs;
+		template <typename T>
+		bool operator()(T const* const* variables, T* residual) const {
+			std::vector<Vec3T<T>> cs;
 
-			for (unsigned int i = 0; i < glints->size(); i++)
+			for (unsigned int i = 0; i < inputs->glints.size(); i++)
 			{
-				double kq = variables[i][0];
-				Vec3 q = calculate_q(kq, camera_position, (*glints)[i]);
-				Vec3 c = calculate_cornea_center(q, (*lights)[i], camera_position, R);
-				cs.push_back(c);
+				const Vec3T<T> q = calculate_q(variables[0][i], inputs->camera_position, inputs->glints[i]);
+				cs.push_back(calculate_cornea_center(q, inputs->lights[i], inputs->camera_position, inputs->R));
 			}
 
-			size_t index = 0;
-			for(int i = 0; i < glints->size(); i++)
+			cornea_center_differences(cs.data(), cs.size(), residual);
+			return true;
+		}
+	};
+
+	/// \brief The residuals between the cornea center resulting from each glint and a common center, with the number of
+	/// glints fixed at compile time. At the solution the common center is the average of the cornea centers, so kq is
+	/// the same as with DistanceBetweenCorneasFunctor, from 3 * NumGlints residuals instead of a number that grows with
+	/// the square of NumGlints. Expects all kq in the first parameter block and the common center in the second.
+	template <int NumGlints>
+	class DistanceToCommonCenterFunctor
+	{
+	private:
+		const KqResidualInputs* const inputs;
+
+	public:
+		enum { NumResiduals = 3 * NumGlints };
+
+		explicit DistanceToCommonCenterFunctor(const KqResidualInputs* const inputs) : inputs(inputs) {}
+
+		template <typename T>
+		bool operator()(const T* const kq, const T* const center, T* residual) const {
+			Vec3T<T> cs[NumGlints];
+
+			for (int i = 0; i < NumGlints; i++)
 			{
-				for(int j = 0; j < i; j++)
-				{
-					Vec3 d = cs[i] - cs[j];
-					residual[index++] = d[0];
-					residual[index++] = d[1];
-					residual[index++] = d[2];
-				}
+				const Vec3T<T> q = calculate_q(kq[i], inputs->camera_position, inputs->glints[i]);
+				cs[i] = calculate_cornea_center(q, inputs->lights[i], inputs->camera_position, inputs->R);
 			}
-			
-			//std::cout << *x << "," << *y << " | " << residual[0] <<   std::endl;;
+
+			cornea_center_deviations(cs, NumGlints, center, residual);
 			return true;
 		}
 	};
 
-	Vec3 calculate_cornea_center_wcs(const std::vector<Vec3>* const glints,
-		const std::vector<Vec3>* const lights,
-		const Vec3& camera_position, double R, double camera_eye_distance_estimate)
+	/// Same as DistanceToCommonCenterFunctor, for glint counts that have no fixed size instantiation.
+	class DynamicDistanceToCommonCenterFunctor
 	{
-		auto distanceCorneas = new DistanceBetweenCorneasFunctor(glints, lights, R, camera_position);
+	private:
+		const KqResidualInputs* const inputs;
 
-		ceres::Problem problem;
-		//ceres::CostFunction* cost_function = new ceres::NumericDiffCostFunction<DistanceBetweenCorneasFunctor, ceres::CENTRAL, 3, 1, 1>(distanceCorneas);
-		auto cost_function = new ceres::DynamicNumericDiffCostFunction<DistanceBetweenCorneasFunctor, ceres::CENTRAL>(distanceCorneas);
-		
-		for (unsigned int i = 0; i < glints->size(); i++)
+	public:
+		explicit DynamicDistanceToCommonCenterFunctor(const KqResidualInputs* const inputs) : inputs(inputs) {}
+
+		template <typename T>
+		bool operator()(T const* const* variables, T* residual) const {
+			std::vector<Vec3T<T>> cs;
+
+			for (unsigned int i = 0; i < inputs->glints.size(); i++)
+			{
+				const Vec3T<T> q = calculate_q(variables[0][i], inputs->camera_position, inputs->glints[i]);
+				cs.push_back(calculate_cornea_center(q, inputs->lights[i], inputs->camera_position, inputs->R));
+			}
+
+			cornea_center_deviations(cs.data(), cs.size(), variables[1], residual);
+			return true;
+		}
+	};
+
+	template <int NumGlints>
+	ceres::CostFunction* make_fixed_size_common_center_cost_function(const KqResidualInputs* const inputs)
+	{
+		typedef DistanceToCommonCenterFunctor<NumGlints> Functor;
+		return new ceres::AutoDiffCostFunction<Functor, Functor::NumResiduals, NumGlints, 3>(new Functor(inputs));
+	}
+
+	/// \brief Returns the cost function of the common center residuals, using a fixed size one where one exists for this
+	/// number of glints. It has fixed size instantiations up to 8 glints, as it is meant for setups with many lights.
+	ceres::CostFunction* make_common_center_cost_function(const KqResidualInputs* const inputs)
+	{
+		switch (inputs->glints.size())
+		{
+		case 2:
+			return make_fixed_size_common_center_cost_function<2>(inputs);
+		case 3:
+			return make_fixed_size_common_center_cost_function<3>(inputs);
+		case 4:
+			return make_fixed_size_common_center_cost_function<4>(inputs);
+		case 5:
+			return make_fixed_size_common_center_cost_function<5>(inputs);
+		case 6:
+			return make_fixed_size_common_center_cost_function<6>(inputs);
+		case 7:
+			return make_fixed_size_common_center_cost_function<7>(inputs);
+		case 8:
+			return make_fixed_size_common_center_cost_function<8>(inputs);
+		default:
+		{
+			auto cost_function = new ceres::DynamicAutoDiffCostFunction<DynamicDistanceToCommonCenterFunctor>(
+				new DynamicDistanceToCommonCenterFunctor(inputs));
+			cost_function->AddParameterBlock(static_cast<int>(inputs->glints.size()));
+			cost_function->AddParameterBlock(3);
+			cost_function->SetNumResiduals(static_cast<int>(3 * inputs->glints.size()));
+			return cost_function;
+		}
+		}
+	}
+
+	template <int NumGlints>
+	ceres::CostFunction* make_fixed_size_cornea_cost_function(const KqResidualInputs* const inputs)
+	{
+		typedef DistanceBetweenCorneasFunctor<NumGlints> Functor;
+		return new ceres::AutoDiffCostFunction<Functor, Functor::NumResiduals, NumGlints>(new Functor(inputs));
+	}
+
+	/// Returns the cost function for the cornea center, using a fixed size one where one exists for this number of glints.
+	ceres::CostFunction* make_cornea_cost_function(const KqResidualInputs* const inputs)
+	{
+		switch (inputs->glints.size())
 		{
-			cost_function->AddParameterBlock(1);
+		case 2:
+			return make_fixed_size_cornea_cost_function<2>(inputs);
+		case 3:
+			return make_fixed_size_cornea_cost_function<3>(inputs);
+		case 4:
+			return make_fixed_size_cornea_cost_function<4>(inputs);
+		default:
+		{
+			auto cost_function = new ceres::DynamicAutoDiffCostFunction<DynamicDistanceBetweenCorneasFunctor>(
+				new DynamicDistanceBetweenCorneasFunctor(inputs));
+			const size_t num_glints = inputs->glints.size();
+			cost_function->AddParameterBlock(static_cast<int>(num_glints));
+			cost_function->SetNumResiduals(static_cast<int>(3 * (num_glints * num_glints - num_glints) / 2));
+			return cost_function;
+		}
 		}
+	}
 
-		cost_function->SetNumResiduals(3 * 0.5 * (glints->size() * glints->size() - glints->size()));
+	/// \brief The ceres problem for kq with a fixed number of glints and residuals. It is built once, with its cost
+	/// function, parameter blocks and bounds, and rebound to the glints of each frame it solves.
+	class KqProblem
+	{
+	public:
+		KqProblem(size_t num_glints, OneCamSphericalGE::CorneaResiduals residuals) :
+			residuals(residuals),
+			ks(num_glints)
+		{
+			inputs.glints.resize(num_glints);
+			inputs.lights.resize(num_glints);
 
-		std::unique_ptr<double> ks(new double[glints->size()]);
+			if (residuals == OneCamSphericalGE::CommonCenterResiduals)
+			{
+				problem.AddResidualBlock(make_common_center_cost_function(&inputs), nullptr, ks.data(), center);
+			}
+			else
+			{
+				problem.AddResidualBlock(make_cornea_cost_function(&inputs), nullptr, ks.data());
+			}
 
-		std::vector<double*> variables;
-		for (unsigned int i = 0; i < glints->size(); i++) {
-			ks.get()[i] = camera_eye_distance_estimate;
-			variables.push_back(&ks.get()[i]);
+			for (unsigned int i = 0; i < num_glints; i++) {
+				problem.SetParameterLowerBound(ks.data(), i, 2);
+				problem.SetParameterUpperBound(ks.data(), i, 400);
+			}
+
+			options.minimizer_progress_to_stdout = false;
+			options.linear_solver_type = ceres::DENSE_QR;
+			//	options.function_tolerance = 1e-8;
+			//	options.gradient_tolerance = 1e-12;
+			options.max_num_iterations = default_max_iterations;
+			//	options.min_line_search_step_size = 1e-3;
+			//	options.use_nonmonotonic_steps = true;
 		}
 
-		problem.AddResidualBlock(cost_function, nullptr, variables);
+		KqProblem(const KqProblem&) = delete;
+		KqProblem& operator=(const KqProblem&) = delete;
+
+		static const int default_max_iterations = 10000;
 
-		for (unsigned int i = 0; i < glints->size(); i++) {
-			problem.SetParameterLowerBound(variables[i], 0, 2);
-			problem.SetParameterUpperBound(variables[i], 0, 400);
+		/// Solves for the kq of glints, which must have as many glints as this problem. initial_ks holds the initial
+		/// values and receives the result. Returns whether the solution is usable. The solve is limited by budget and stops
+		/// at deadline. Records the summary in telemetry.
+		bool solve(const std::vector<Vec3>& glints, const std::vector<Vec3>& lights, const Vec3& camera_position, double R,
+			double* initial_ks, const SolverBudget& budget, SolverBudget::Clock::time_point deadline, SolverTelemetry& telemetry)
+		{
+			std::copy(glints.begin(), glints.end(), inputs.glints.begin());
+			std::copy(lights.begin(), lights.end(), inputs.lights.begin());
+			inputs.camera_position = camera_position;
+			inputs.R = R;
+			std::copy(initial_ks, initial_ks + ks.size(), ks.begin());
+
+			// the common center starts at the average of the cornea centers for the initial kq
+			if (residuals == OneCamSphericalGE::CommonCenterResiduals)
+			{
+				std::fill(center, center + 3, 0.0);
+				for (unsigned int i = 0; i < ks.size(); i++)
+				{
+					const Vec3 q = calculate_q(ks[i], camera_position, glints[i]);
+					const Vec3 c = calculate_cornea_center(q, lights[i], camera_position, R);
+					for (int j = 0; j < 3; j++)
+					{
+						center[j] += c[j] / ks.size();
+					}
+				}
+			}
+
+			apply_solver_budget(budget, default_max_iterations, deadline, options);
+			ceres::Solver::Summary summary;
+			Solve(options, &problem, &summary);
+			/*	std::cout << summary.FullReport() << std::endl;
+			std::cout << std::endl;
+			std::cout << summary.IsSolutionUsable() << std::endl;
+			std::cout << std::endl;*/
+
+			std::copy(ks.begin(), ks.end(), initial_ks);
+			record_ceres_summary(summary, telemetry, deadline);
+			return summary.IsSolutionUsable();
 		}
 
+	private:
+		const OneCamSphericalGE::CorneaResiduals residuals;
+		/// the parameter blocks and the data the cost function refers to, rebound for each solve
+		KqResidualInputs inputs;
+		std::vector<double> ks;
+		double center[3] = { 0, 0, 0 };
+
+		ceres::Problem problem;
 		ceres::Solver::Options options;
-		options.minimizer_progress_to_stdout = false;
-		options.linear_solver_type = ceres::DENSE_QR;
-		//	options.function_tolerance = 1e-8;
-		//	options.gradient_tolerance = 1e-12;
-		options.max_num_iterations = 1e4;
-		//	options.min_line_search_step_size = 1e-3;
-		//	options.use_nonmonotonic_steps = true;
-
-		ceres::Solver::Summary summary;
-		Solve(options, &problem, &summary);
-		/*	std::cout << summary.FullReport() << std::endl;
-		std::cout << std::endl;
-		std::cout << summary.IsSolutionUsable() << std::endl;
-		std::cout << std::endl;*/
-
-		/*
-		for (int i = 0; i < glints->size(); i++)
-		std::cout << variables[i] << ", ";
-		std::cout << std::endl;
-		*/
-		//TODO: Solution usability should really be checked here.
+	};
+
+	class KqProblems
+	{
+	public:
+		/// The problem for the number of glints and residuals, built on first use.
+		KqProblem& problem(size_t num_glints, OneCamSphericalGE::CorneaResiduals residuals)
+		{
+			std::unique_ptr<KqProblem>& problem = problems[residuals == OneCamSphericalGE::CommonCenterResiduals][num_glints];
+			if (!problem)
+			{
+				problem.reset(new KqProblem(num_glints, residuals));
+			}
+			return *problem;
+		}
+
+		/// The valid glints of the frame in WCS, their lights and their kq, reused across frames.
+		std::vector<Vec3> glints_wcs;
+		std::vector<Vec3> selected_lights;
+		std::vector<double> ks;
+
+		/// The budget of the frame being solved and the point in time its solve has to stop, set by the estimator.
+		SolverBudget budget;
+		SolverBudget::Clock::time_point deadline = SolverBudget::Clock::time_point::max();
+
+	private:
+		std::unique_ptr<KqProblem> problems[2][max_glints_per_camera + 1];
+	};
+
+	/// Solves for kq for any number of glints with ceres. ks holds the initial values and receives the result.
+	/// Returns whether the solution is usable. Records the summary of the solve in telemetry. Uses the problem and the
+	/// budget of problems if not null, otherwise builds one for this solve only, without a budget.
+	bool solve_kq_ceres(const std::vector<Vec3>* const glints,
+		const std::vector<Vec3>* const lights,
+		const Vec3& camera_position, double R, OneCamSphericalGE::CorneaResiduals residuals, double* ks,
+		SolverTelemetry& telemetry, KqProblems* problems)
+	{
+		if (problems && glints->size() <= max_glints_per_camera)
+			return problems->problem(glints->size(), residuals).solve(*glints, *lights, camera_position, R, ks, problems->budget,
+				problems->deadline, telemetry);
 
+		KqProblem problem(glints->size(), residuals);
+		return problem.solve(*glints, *lights, camera_position, R, ks, SolverBudget(), SolverBudget::Clock::time_point::max(),
+			telemetry);
+	}
+
+	/// Solves for kq with the given solver. ks holds the initial values and receives the result.
+	/// Returns whether the solution is usable. If telemetry is not null, it receives how the solve went.
+	bool solve_kq(const std::vector<Vec3>* const glints,
+		const std::vector<Vec3>* const lights,
+		const Vec3& camera_position, double R, 
+		OneCamSphericalGE::CorneaCenterSolver solver, OneCamSphericalGE::CorneaResiduals residuals,
+		std::vector<double>& ks, SolverTelemetry* telemetry, KqProblems* problems)
+	{
+		SolverTelemetry local_telemetry;
+		SolverTelemetry& solve_telemetry = telemetry ? *telemetry : local_telemetry;
+		solve_telemetry = SolverTelemetry();
+
+		if (solver == OneCamSphericalGE::TwoGlintNewtonSolver && glints->size() == 2)
+		{
+			const double initial_ks[2] = { ks[0], ks[1] };
+			if (solve_two_glint_kq_newton(glints->data(), lights->data(), camera_position, R, ks.data(), solve_telemetry))
+			{
+				solve_telemetry.solver = SolverTelemetry::SpecializedSolver;
+				solve_telemetry.termination = SolverTelemetry::Converged;
+				return true;
+			}
+
+			ks[0] = initial_ks[0];
+			ks[1] = initial_ks[1];
+			solve_telemetry.fell_back = true;
+		}
+
+		return solve_kq_ceres(glints, lights, camera_position, R, residuals, ks.data(), solve_telemetry, problems);
+	}
+
+	/// Returns the average of the cornea centers resulting from each of the glints for the given kq.
+	Vec3 calculate_cornea_center_wcs(const std::vector<Vec3>* const glints,
+		const std::vector<Vec3>* const lights,
+		const Vec3& camera_position, double R, const std::vector<double>& ks)
+	{
 		Vec3 c_total = make_vec3(0, 0, 0);
 		for (unsigned int i = 0; i < glints->size(); i++)
 		{
-			Vec3 q = calculate_q(variables[i][0], camera_position, (*glints)[i]);
-			Vec3 c = calculate_cornea_center(q, (*lights)[i], camera_position, R);
-			c_total += c;
+			const Vec3 q = calculate_q(ks[i], camera_position, (*glints)[i]);
+			c_total += calculate_cornea_center(q, (*lights)[i], camera_position, R);
 		}
 
 		return c_total / static_cast<double>(glints->size());
 	}
 
-	Vec3 calculate_cornea_center(std::vector<Vec2> glints, const EyeAndCameraParameters& parameters)
+	/// \param	tracked_kq	If not null, the kq per glint of the previous frame (NaN where unknown) used as initial values, 
+	///						receives the kq of this frame.
+	/// \param	telemetry	Receives how the solve for kq went.
+	/// \param	usable	Receives whether the solution is usable.
+	/// \param	solved_kq	If not null, receives the kq of this frame like tracked_kq, without being used as initial values.
+	/// \param	problems	The problems and buffers reused across frames.
+	Vec3 calculate_cornea_center(const PupilCenterGlintInput::Glints& glints, const EyeAndCameraParameters& parameters, 
+		OneCamSphericalGE::CorneaCenterSolver solver, OneCamSphericalGE::CorneaResiduals residuals,
+		std::vector<double>* tracked_kq, SolverTelemetry& telemetry, bool& usable, KqProblems& problems, 
+		std::vector<double>* solved_kq = nullptr)
 	{
-		std::vector<Vec3> glints_wcs;
+		std::vector<Vec3>& glints_wcs = problems.glints_wcs;
 		/*for (const auto& glint : glints)
 		{
 			glints_wcs.push_back(parameters.cameras[0].ics_to_wcs(glint));
 		}*/
 
-		std::vector<Vec3> selected_lights;
+		std::vector<Vec3>& selected_lights = problems.selected_lights;
+		std::vector<double>& ks = problems.ks;
+		glints_wcs.clear();
+		selected_lights.clear();
+		ks.clear();
+
+		const bool use_tracked_kq = tracked_kq && tracked_kq->size() == glints.size();
+
+		Vec3 all_glints_wcs[max_glints_per_camera];
+		parameters.cameras[0].ics_to_wcs(glints.begin(), glints.end(), all_glints_wcs);
 
 		for(int i = 0; i < glints.size(); i++)
 		{
 			if (!glintValid(glints[i]))
 				continue;
-			glints_wcs.push_back(parameters.cameras[0].ics_to_wcs(glints[i]));
+			glints_wcs.push_back(all_glints_wcs[i]);
 			selected_lights.push_back(parameters.light_positions[i]);
+			ks.push_back(use_tracked_kq && std::isfinite((*tracked_kq)[i]) ? (*tracked_kq)[i] : parameters.distance_to_camera_estimate);
+		}
+
+		usable = solve_kq(&glints_wcs, &selected_lights, parameters.cameras[0].position(), parameters.R, solver, residuals, ks, &telemetry,
+			&problems);
+
+		for (std::vector<double>* kq_per_glint : { tracked_kq, solved_kq })
+		{
+			if (!kq_per_glint)
+				continue;
+			kq_per_glint->assign(glints.size(), std::numeric_limits<double>::quiet_NaN());
+			if (usable)
+			{
+				unsigned int index = 0;
+				for (int i = 0; i < glints.size(); i++)
+				{
+					if (glintValid(glints[i]))
+						(*kq_per_glint)[i] = ks[index++];
+				}
+			}
 		}
 
 		return calculate_cornea_center_wcs(&glints_wcs,
 			&selected_lights,
-			parameters.cameras[0].position,
-			parameters.R, parameters.distance_to_camera_estimate);
+			parameters.cameras[0].position(),
+			parameters.R, ks);
 	}
 
 
-	Vec3 calculate_p(const Vec3& camera_position, const Vec3& pupil_por_wcs, const Vec3& center_of_cornea, double R, double K, double n1, double n2)
+	/// Returns the average of the cornea centers resulting from each of the valid glints for the given kq per glint,
+	/// without solving for kq.
+	Vec3 calculate_cornea_center_for_kq(const PupilCenterGlintInput::Glints& glints, const EyeAndCameraParameters& parameters,
+		const std::vector<double>& kq)
 	{
-		Vec3 iota = calculate_iota(camera_position, pupil_por_wcs, center_of_cornea, R, n1, n2);
-		double rc_dot_iota = dot((pupil_por_wcs - center_of_cornea), iota);
-		double kp = -1 * rc_dot_iota - sqrt(rc_dot_iota*rc_dot_iota - (R * R - K * K));
-		return pupil_por_wcs + kp * iota;
+		const Vec3& camera_position = parameters.cameras[0].position();
+		Vec3 all_glints_wcs[max_glints_per_camera];
+		parameters.cameras[0].ics_to_wcs(glints.begin(), glints.end(), all_glints_wcs);
+
+		Vec3 c_total = make_vec3(0, 0, 0);
+		int num_glints = 0;
+		for (int i = 0; i < glints.size(); i++)
+		{
+			if (!glintValid(glints[i]))
+				continue;
+			const Vec3 q = calculate_q(kq[i], camera_position, all_glints_wcs[i]);
+			c_total += calculate_cornea_center(q, parameters.light_positions[i], camera_position, parameters.R);
+			num_glints++;
+		}
+
+		return c_total / static_cast<double>(num_glints);
 	}
 
-	Vec3 calculate_optic_axis_unit_vector(const Vec3& pupil_wcs, const Vec3& camera_position, const Vec3& center_of_cornea, 
-		double R, double K, double n1, double n2, bool use_chen_noise_reduction)
+
+	/// The stages of the latest estimate of an input, each with the parameters it was computed with.
+	struct OneCamSphericalGE::StageCache : EstimationCache
 	{
-		const Vec3 pupil_por_wcs = calculate_r(camera_position, pupil_wcs, center_of_cornea, R);
+		bool has_cornea_center = false;
+		PinholeCameraModel camera;
+		std::vector<Vec3> light_positions;
+		double R = 0;
+		double distance_to_camera_estimate = 0;
+		Vec3 cornea_center;
+		SolverTelemetry solver;
+
+		bool has_optic_axis = false;
+		double K = 0;
+		double n1 = 0;
+		double n2 = 0;
+		Vec3 optic_axis;
+
+		bool cornea_center_valid_for(const EyeAndCameraParameters& parameters) const
+		{
+			return has_cornea_center && camera == parameters.cameras[0] && light_positions == parameters.light_positions
+				&& R == parameters.R && distance_to_camera_estimate == parameters.distance_to_camera_estimate;
+		}
 
-		Vec3 pupil_center_wcs = calculate_p(camera_position, pupil_por_wcs, center_of_cornea, R, K, n1, n2);
+		void set_cornea_center(const EyeAndCameraParameters& parameters, const Vec3& center, const SolverTelemetry& telemetry)
+		{
+			has_cornea_center = true;
+			camera = parameters.cameras[0];
+			light_positions = parameters.light_positions;
+			R = parameters.R;
+			distance_to_camera_estimate = parameters.distance_to_camera_estimate;
+			cornea_center = center;
+			solver = telemetry;
+			has_optic_axis = false;
+		}
 
-		if(use_chen_noise_reduction)
+		bool optic_axis_valid_for(const EyeAndCameraParameters& parameters) const
 		{
-			double cxpx = center_of_cornea[0] - pupil_center_wcs[0];
-			double cypy = center_of_cornea[1] - pupil_center_wcs[1];
-			pupil_center_wcs[2] = center_of_cornea[2] - sqrt(K*K - cxpx * cxpx - cypy*cypy);
+			return has_optic_axis && K == parameters.K && n1 == parameters.n1 && n2 == parameters.n2;
 		}
 
-		return normalized(pupil_center_wcs - center_of_cornea);
+		void set_optic_axis(const EyeAndCameraParameters& parameters, const Vec3& axis)
+		{
+			has_optic_axis = true;
+			K = parameters.K;
+			n1 = parameters.n1;
+			n2 = parameters.n2;
+			optic_axis = axis;
+		}
+	};
+
+	OneCamSphericalGE::OneCamSphericalGE(bool use_chen_noise_reduction, CorneaCenterSolver cornea_center_solver):
+	use_chen_noise_reduction(use_chen_noise_reduction),
+	cornea_center_solver(cornea_center_solver)
+	{
+		
 	}
 
+	void OneCamSphericalGE::Session::setCorneaCenterFilter(Vec3Filter filter)
+	{
+		cornea_center_filter = filter;
+	}
 
-	OneCamSphericalGE::OneCamSphericalGE(bool use_chen_noise_reduction):
-	use_chen_noise_reduction(use_chen_noise_reduction)
+	void OneCamSphericalGE::Session::setPupilCenterFilter(Vec3Filter filter)
 	{
-		
+		pupil_center_filter = filter;
+	}
+
+	void OneCamSphericalGE::Session::setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters)
+	{
+		telemetry_counters = std::move(counters);
+	}
+
+	void OneCamSphericalGE::Session::resetTracking()
+	{
+		tracked_kq.clear();
+		last_solved.valid = false;
 	}
 
 	void OneCamSphericalGE::setCorneaCenterFilter(Vec3Filter filter)
 	{
-		cornea_center_filter = filter;
+		own_session.setCorneaCenterFilter(filter);
 	}
 
 	void OneCamSphericalGE::setPupilCenterFilter(Vec3Filter filter)
 	{
-		pupil_center_filter = filter;
+		own_session.setPupilCenterFilter(filter);
+	}
+
+	void OneCamSphericalGE::setCorneaResiduals(CorneaResiduals residuals)
+	{
+		cornea_residuals = residuals;
+	}
+
+	void OneCamSphericalGE::setSolverBudget(const SolverBudget& budget)
+	{
+		solver_budget = budget;
+	}
+
+	void OneCamSphericalGE::setTracking(bool enabled)
+	{
+		tracking = enabled;
+		resetTracking();
+	}
+
+	void OneCamSphericalGE::resetTracking()
+	{
+		own_session.resetTracking();
+	}
+
+	void OneCamSphericalGE::setCorneaCenterReuse(double max_glint_motion_px, bool first_order_update)
+	{
+		reuse_max_glint_motion_px = max_glint_motion_px;
+		reuse_first_order_update = first_order_update;
+		own_session.last_solved.valid = false;
+	}
+
+	void OneCamSphericalGE::setStageTiming(bool enabled)
+	{
+		stage_timing = enabled;
+	}
+
+	void OneCamSphericalGE::setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters)
+	{
+		telemetry_counters = std::move(counters);
+	}
+
+	std::unique_ptr<OneCamSphericalGE::GazeEstimationMethod> OneCamSphericalGE::clone() const
+	{
+		return std::unique_ptr<GazeEstimationMethod>(new OneCamSphericalGE(*this));
 	}
 
 	DefaultGazeEstimationResult OneCamSphericalGE::estimate(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters)
 	{
-		if (data.data.size() != 1 || data.data[0].glints.size() < 2)
+		return estimate(data, PreparedParameters(parameters));
+	}
+
+	void OneCamSphericalGE::estimate_range(const PupilCenterGlintInputs* first, const PupilCenterGlintInputs* last, 
+		DefaultGazeEstimationResult* results, const EyeAndCameraParameters& parameters)
+	{
+		const PreparedParameters prepared(parameters);
+		if (stage_timing)
+		{
+			for (; first != last; ++first, ++results)
+			{
+				*results = estimate(*first, prepared);
+			}
+			return;
+		}
+
+		typedef Vec3Lanes<double, default_batch_width> Batch;
+		const Batch camera_position = parameters.cameras.size() == 1
+			? Batch::broadcast(parameters.cameras[0].position()) : Batch();
+
+		while (first != last)
+		{
+			// the cornea center and the pupil of each frame, then the axes of the valid frames together
+			DefaultGazeEstimationResult* const block = results;
+			DefaultGazeEstimationResult* lanes[default_batch_width];
+			Batch pupil_wcs;
+			Batch cornea_center;
+			int count = 0;
+			for (; first != last && count < default_batch_width; ++first, ++results)
+			{
+				DefaultGazeEstimationResult& result = *results;
+				if (!check_inputs(*first, parameters, result, own_session))
+					continue;
+
+				SolverTelemetry solver;
+				bool usable = false;
+				const Vec3 frame_cornea_center = estimate_cornea_center(*first, parameters, solver, usable, own_session);
+				if (!usable)
+				{
+					result = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::SolverFailed);
+					result.telemetry.solver = solver;
+					continue;
+				}
+
+				result = DefaultGazeEstimationResult();
+				result.is_valid = true;
+				result.center_of_cornea = frame_cornea_center;
+				result.telemetry.solver = solver;
+				cornea_center.set(count, result.center_of_cornea);
+				pupil_wcs.set(count, estimate_pupil_wcs(*first, parameters, own_session));
+				lanes[count++] = &result;
+			}
+
+			if (count > 0)
+			{
+				// unused lanes repeat the first frame, so that they stay finite
+				for (int lane = count; lane < default_batch_width; lane++)
+				{
+					cornea_center.set(lane, cornea_center.get(0));
+					pupil_wcs.set(lane, pupil_wcs.get(0));
+				}
+
+				const Batch optic_axis = calculate_optic_axis_unit_vector(pupil_wcs, camera_position, cornea_center,
+					prepared.eye(), use_chen_noise_reduction);
+				const Batch visual_axis = calculate_visual_axis_unit_vector(optic_axis, prepared.nu_ecs());
+				for (int lane = 0; lane < count; lane++)
+				{
+					lanes[lane]->optical_axis = optic_axis.get(lane);
+					lanes[lane]->visual_axis = visual_axis.get(lane);
+				}
+			}
+
+			for (DefaultGazeEstimationResult* result = block; result != results; ++result)
+			{
+				record(*result, own_session);
+			}
+		}
+	}
+
+	DefaultGazeEstimationResult OneCamSphericalGE::estimate(const PupilCenterGlintInputs& data, const PreparedParameters& prepared)
+	{
+		const DefaultGazeEstimationResult result = estimate_frame(data, prepared, nullptr, own_session);
+		record(result, own_session);
+		return result;
+	}
+
+	std::unique_ptr<EstimationCache> OneCamSphericalGE::make_cache() const
+	{
+		return std::unique_ptr<EstimationCache>(new StageCache());
+	}
+
+	DefaultGazeEstimationResult OneCamSphericalGE::estimate_cached(const PupilCenterGlintInputs& data, 
+		const EyeAndCameraParameters& parameters, EstimationCache& cache)
+	{
+		if (tracking || reuse_max_glint_motion_px > 0 || own_session.cornea_center_filter || own_session.pupil_center_filter)
+			return estimate(data, parameters);
+
+		const DefaultGazeEstimationResult result = estimate_frame(data, PreparedParameters(parameters), &static_cast<StageCache&>(cache),
+			own_session);
+		record(result, own_session);
+		return result;
+	}
+
+	std::unique_ptr<EstimationSession> OneCamSphericalGE::make_session() const
+	{
+		std::unique_ptr<Session> session(new Session());
+		session->cornea_center_filter = own_session.cornea_center_filter;
+		session->pupil_center_filter = own_session.pupil_center_filter;
+		return std::move(session);
+	}
+
+	DefaultGazeEstimationResult OneCamSphericalGE::estimate_in_session(const PupilCenterGlintInputs& data,
+		const EyeAndCameraParameters& parameters, EstimationSession& session) const
+	{
+		Session& own = static_cast<Session&>(session);
+		const DefaultGazeEstimationResult result = estimate_frame(data, PreparedParameters(parameters), nullptr, own);
+		record(result, own);
+		return result;
+	}
+
+	void OneCamSphericalGE::record(const DefaultGazeEstimationResult& result, const Session& session) const
+	{
+		TelemetryCounters* counters = session.telemetry_counters ? session.telemetry_counters.get() : telemetry_counters.get();
+		if (counters)
 		{
-			throw std::exception("this method must have one pair of pupil center/glint info with info about at least two glints.");
+			counters->record(result.telemetry, result.is_valid);
+		}
+	}
+
+	bool OneCamSphericalGE::check_inputs(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+		DefaultGazeEstimationResult& result, Session& session) const
+	{
+		if (data.data.size() != 1)
+		{
+			session.resetTracking();
+			result = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfInputs);
+			return false;
 		}
 
 		if (parameters.cameras.size() != 1)
 		{
-			throw std::exception("this method can only handle a single camera");
+			session.resetTracking();
+			result = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfCameras);
+			return false;
 		}
 
 		int valid_glints = 0;
@@ -228,35 +764,170 @@ namespace gazeestimation {
 		}
 
 		if (valid_glints < 2)
-			throw std::exception("There need to be at least 2 valid glints present.");
-
-		const PinholeCameraModel camera = parameters.cameras[0];
+		{
+			session.resetTracking();
+			result = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::NotEnoughValidGlints);
+			return false;
+		}
+		return true;
+	}
 
-		Vec3 cornea_center = calculate_cornea_center(data.data[0].glints, parameters);
+	Vec3 OneCamSphericalGE::estimate_cornea_center(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+		SolverTelemetry& telemetry, bool& usable, Session& session) const
+	{
+		const PupilCenterGlintInput::Glints& glints = data.data[0].glints;
+		Vec3 cornea_center;
+		if (reuse_max_glint_motion_px > 0 && can_reuse_cornea_center(glints, parameters, session))
+		{
+			telemetry = SolverTelemetry();
+			telemetry.reused = true;
+			usable = true;
+			cornea_center = reuse_first_order_update ? calculate_cornea_center_for_kq(glints, parameters, session.last_solved.kq)
+				: session.last_solved.cornea_center;
+		}
+		else if (reuse_max_glint_motion_px > 0)
+		{
+			KqProblems& problems = session.kq_problems.get();
+			problems.budget = solver_budget;
+			problems.deadline = solver_budget.deadline();
+			Session::SolvedCorneaCenter& solved = session.last_solved;
+			cornea_center = calculate_cornea_center(glints, parameters, cornea_center_solver, cornea_residuals,
+				tracking ? &session.tracked_kq : nullptr, telemetry, usable, problems, &solved.kq);
+
+			// the kq are all NaN if the solution is not usable
+			solved.valid = false;
+			for (int i = 0; i < glints.size(); i++)
+			{
+				if (glintValid(glints[i]))
+				{
+					solved.valid = std::isfinite(solved.kq[i]);
+					break;
+				}
+			}
+			if (solved.valid)
+			{
+				solved.glints = glints;
+				solved.cornea_center = cornea_center;
+				solved.camera = parameters.cameras[0];
+				solved.light_positions = parameters.light_positions;
+				solved.R = parameters.R;
+				solved.distance_to_camera_estimate = parameters.distance_to_camera_estimate;
+			}
+		}
+		else
+		{
+			KqProblems& problems = session.kq_problems.get();
+			problems.budget = solver_budget;
+			problems.deadline = solver_budget.deadline();
+			cornea_center = calculate_cornea_center(glints, parameters, cornea_center_solver, cornea_residuals,
+				tracking ? &session.tracked_kq : nullptr, telemetry, usable, problems);
+		}
 		
-		if(cornea_center_filter)
+		// an unusable solution is not passed to the filter, so that it does not end up in its state
+		if(session.cornea_center_filter && usable)
 		{
-			cornea_center = cornea_center_filter(cornea_center);
+			cornea_center = session.cornea_center_filter(cornea_center);
 		}
+		return cornea_center;
+	}
 
+	bool OneCamSphericalGE::can_reuse_cornea_center(const PupilCenterGlintInput::Glints& glints,
+		const EyeAndCameraParameters& parameters, const Session& session) const
+	{
+		const Session::SolvedCorneaCenter& solved = session.last_solved;
+		if (!solved.valid || solved.glints.size() != glints.size() || solved.camera != parameters.cameras[0]
+			|| solved.light_positions != parameters.light_positions || solved.R != parameters.R
+			|| solved.distance_to_camera_estimate != parameters.distance_to_camera_estimate)
+			return false;
+
+		const double max_squared_motion = reuse_max_glint_motion_px * reuse_max_glint_motion_px;
+		for (int i = 0; i < glints.size(); i++)
+		{
+			const bool valid = glintValid(glints[i]);
+			if (valid != glintValid(solved.glints[i]))
+				return false;
+			if (valid && squared_length_vec2(glints[i] - solved.glints[i]) > max_squared_motion)
+				return false;
+		}
+		return true;
+	}
 
-		Vec3 pupil_wcs = camera.ics_to_wcs(data.data[0].pupil_center);
+	Vec3 OneCamSphericalGE::estimate_pupil_wcs(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+		const Session& session) const
+	{
+		Vec3 pupil_wcs = parameters.cameras[0].ics_to_wcs(data.data[0].pupil_center);
 
-		if(pupil_center_filter)
+		if(session.pupil_center_filter)
 		{
-			pupil_wcs = pupil_center_filter(pupil_wcs);
+			pupil_wcs = session.pupil_center_filter(pupil_wcs);
 		}
+		return pupil_wcs;
+	}
 
-		const Vec3 optic_axis_unit_vector = calculate_optic_axis_unit_vector(pupil_wcs, parameters.cameras[0].position, cornea_center,
-			parameters.R, parameters.K, parameters.n1, parameters.n2, use_chen_noise_reduction);
+	DefaultGazeEstimationResult OneCamSphericalGE::estimate_frame(const PupilCenterGlintInputs& data, const PreparedParameters& prepared,
+		StageCache* cache, Session& session) const
+	{
+		const EyeAndCameraParameters& parameters = prepared.parameters();
+		DefaultGazeEstimationResult error;
+		if (!check_inputs(data, parameters, error, session))
+			return error;
+
+		FrameTelemetry telemetry;
+		StageTimer timer(stage_timing);
+
+		Vec3 cornea_center;
+		if (cache && cache->cornea_center_valid_for(parameters))
+		{
+			cornea_center = cache->cornea_center;
+			telemetry.solver = cache->solver;
+		}
+		else
+		{
+			bool usable = false;
+			cornea_center = estimate_cornea_center(data, parameters, telemetry.solver, usable, session);
+			if (!usable)
+			{
+				DefaultGazeEstimationResult failed = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::SolverFailed);
+				failed.telemetry = telemetry;
+				return failed;
+			}
+
+			if (cache)
+			{
+				cache->set_cornea_center(parameters, cornea_center, telemetry.solver);
+			}
+		}
+
+		telemetry.cornea_center_us = timer.lap();
+
+		Vec3 optic_axis_unit_vector;
+		if (cache && cache->optic_axis_valid_for(parameters))
+		{
+			optic_axis_unit_vector = cache->optic_axis;
+		}
+		else
+		{
+			const Vec3 pupil_wcs = estimate_pupil_wcs(data, parameters, session);
+
+			optic_axis_unit_vector = calculate_optic_axis_unit_vector(pupil_wcs, parameters.cameras[0].position(), cornea_center,
+				prepared.eye(), use_chen_noise_reduction);
+
+			if (cache)
+			{
+				cache->set_optic_axis(parameters, optic_axis_unit_vector);
+			}
+		}
+		telemetry.optic_axis_us = timer.lap();
 
-		const Vec3 visual_axis_unit_vector = calculate_visual_axis_unit_vector(optic_axis_unit_vector, parameters.alpha, parameters.beta);
+		const Vec3 visual_axis_unit_vector = calculate_visual_axis_unit_vector(optic_axis_unit_vector, prepared.nu_ecs());
+		telemetry.visual_axis_us = timer.lap();
 
 		DefaultGazeEstimationResult result;
 		result.is_valid = true;
 		result.center_of_cornea = cornea_center;
 		result.optical_axis = optic_axis_unit_vector;
 		result.visual_axis = visual_axis_unit_vector;
+		result.telemetry = telemetry;
 		return result;
 	}
 
@@ -10,9 +10,14 @@
 #define ONE_CAMERA_SPHERICAL_HPP_INCLUDED
 
 #include "GazeEstimationTypes.hpp"
+#include "PreparedParameters.hpp"
+#include "SolverContext.hpp"
 
 namespace gazeestimation {
 
+	/// The ceres problems for kq of an estimator, defined in OneCameraSpherical.cpp.
+	class KqProblems;
+
 
 	class OneCamSphericalGE : public GazeEstimationMethod<EyeAndCameraParameters, PupilCenterGlintInputs, DefaultGazeEstimationResult>
 	{
@@ -21,20 +26,194 @@ namespace gazeestimation {
 		/// specified quantity, it should return the value that should be used from here on.
 		typedef std::function<Vec3(Vec3)> Vec3Filter;
 
+		/// Available methods for finding the distances of the points of reflection from the camera.
+		enum CorneaCenterSolver
+		{
+			/// Numerical minimization with ceres, works for any number of glints.
+			GenericSolver = 0,
+			/// With exactly two valid glints, a few Gauss-Newton iterations without any problem setup. Falls back
+			/// to the generic solver if those do not converge or there are more than two valid glints.
+			TwoGlintNewtonSolver
+		};
+
+		/// \brief The residuals the generic solver minimizes for kq. Both have the same solution, the cost of the common
+		/// center residuals is that of the pairwise ones divided by the number of glints.
+		enum CorneaResiduals
+		{
+			/// the differences between the cornea centers of all pairs of glints, 3 N (N - 1) / 2 residuals for N glints
+			PairwiseResiduals = 0,
+			/// \brief the differences between the cornea center of each glint and a common center that is solved for
+			/// together with kq, 3 N residuals and 3 more variables, which is faster from about 6 lights on
+			CommonCenterResiduals
+		};
+
+		/// \brief The state of a stream of frames estimated with estimate_in_session: its filters, the tracked solution, the
+		/// cornea center kept for reuse, the solver problems and the telemetry counters, so that those estimates leave the
+		/// estimator unchanged. Returned by make_session, whose result can be cast to this to configure the session.
+		class Session : public EstimationSession
+		{
+		public:
+			/// The filters of this session, see OneCamSphericalGE::setCorneaCenterFilter and setPupilCenterFilter.
+			void setCorneaCenterFilter(Vec3Filter filter);
+			void setPupilCenterFilter(Vec3Filter filter);
+			/// \brief Sets the counters the estimates of this session are recorded in instead of those of the estimator,
+			/// nullptr to record into those of the estimator.
+			void setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters);
+			/// Discards the tracked solution and the cornea center kept for reuse, e.g. when the stream starts over.
+			void resetTracking();
+
+		private:
+			friend class OneCamSphericalGE;
+
+			/// The last frame whose cornea center was solved for, before the cornea center filter, see setCorneaCenterReuse.
+			struct SolvedCorneaCenter
+			{
+				bool valid = false;
+				PupilCenterGlintInput::Glints glints;
+				/// kq per glint, NaN for the invalid ones
+				std::vector<double> kq;
+				Vec3 cornea_center;
+
+				PinholeCameraModel camera;
+				std::vector<Vec3> light_positions;
+				double R = 0;
+				double distance_to_camera_estimate = 0;
+			};
+
+			Vec3Filter cornea_center_filter;
+			Vec3Filter pupil_center_filter;
+
+			/// kq per glint from the previous frame, NaN where unknown
+			std::vector<double> tracked_kq;
+			SolvedCorneaCenter last_solved;
+
+			/// one problem per number of glints and residuals, rebound to the glints of each frame
+			SolverContext<KqProblems> kq_problems;
+
+			std::shared_ptr<TelemetryCounters> telemetry_counters;
+		};
+
 		OneCamSphericalGE() = default;
-		explicit OneCamSphericalGE(bool use_chen_noise_reduction);
+		explicit OneCamSphericalGE(bool use_chen_noise_reduction, CorneaCenterSolver cornea_center_solver = GenericSolver);
 
 		/// \brief Provides an extension point to filter the coordinate of the center of cornea in the world coordinate system.
+		/// Sessions made afterwards start out with a copy of the filter.
 		void setCorneaCenterFilter(Vec3Filter filter);
 		/// \brief Provides an extension point to filter the coordinate of the virtual pupil center in the world coordinate system.
+		/// Sessions made afterwards start out with a copy of the filter.
 		void setPupilCenterFilter(Vec3Filter filter);
 
+		/// \brief Selects the residuals of the generic solver, PairwiseResiduals by default.
+		void setCorneaResiduals(CorneaResiduals residuals);
+		/// \brief Limits the generic solver per frame, e.g. to the frame period of the camera, so that a frame it struggles with
+		/// is estimated from its best iterate in time instead of stalling. By default, the generic solver stops after 10000
+		/// iterations.
+		void setSolverBudget(const SolverBudget& budget);
+
+		/// \brief Enables or disables tracking, where the solution of the previous frame is used as the starting point for
+		/// the cornea center. Consecutive calls to estimate must then be consecutive frames of the same eye. 
+		/// Frames that fail validation or whose solution is not usable reset the tracked solution.
+		void setTracking(bool enabled);
+		/// \brief Discards the tracked solution and the cornea center kept for reuse, e.g. when a new recording starts.
+		void resetTracking();
+
+		/// \brief Enables reusing the cornea center of the last frame it was solved for while each glint stays within
+		/// max_glint_motion_px pixels of its position in that frame, as during fixations, so that only the pupil dependent
+		/// stages are recomputed. With first_order_update, the cornea center is recalculated from the new glints with the
+		/// kq of that frame instead, which follows small movements of the eye for a few vector operations per glint.
+		/// Consecutive calls to estimate must then be consecutive frames of the same eye, as with tracking. The cornea
+		/// center filter is still applied to every frame. 0 disables the reuse.
+		void setCorneaCenterReuse(double max_glint_motion_px, bool first_order_update = true);
+
+		/// \brief Enables or disables measuring the wall time of the stages of each estimate into the telemetry of its result.
+		/// The solver telemetry is always filled in.
+		void setStageTiming(bool enabled);
+		/// \brief Sets the counters every estimate of this and of its clones is recorded in, nullptr to record none.
+		void setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters);
+
 		DefaultGazeEstimationResult estimate(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters) override;
+		/// Same as estimate with the parameters the prepared parameters refer to.
+		DefaultGazeEstimationResult estimate(const PupilCenterGlintInputs& data, const PreparedParameters& prepared);
+		/// Prepares the parameters once for all inputs. Unless stage timing is enabled, the optical and visual axes of
+		/// default_batch_width frames at a time are calculated together with the batch calculations, whose visual axis
+		/// can differ from that of estimate in the last bits.
+		void estimate_range(const PupilCenterGlintInputs* first, const PupilCenterGlintInputs* last, DefaultGazeEstimationResult* results,
+			const EyeAndCameraParameters& parameters) override;
+		/// Clones get copies of the configured filters, so filters that share state must be safe to call concurrently.
+		/// Clones record into the same telemetry counters.
+		std::unique_ptr<GazeEstimationMethod> clone() const override;
+
+		/// The cache keeps the cornea center, which depends on the camera, the lights, R and the initial distance, and the
+		/// optical axis, which depends on those and K, n1 and n2, so that changing alpha or beta only recomputes the
+		/// visual axis.
+		std::unique_ptr<EstimationCache> make_cache() const override;
+		/// Does not cache while filters, tracking or the cornea center reuse are enabled, as those depend on the previous
+		/// frames.
+		DefaultGazeEstimationResult estimate_cached(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			EstimationCache& cache) override;
+
+		/// \brief Returns a Session with copies of the filters of this estimator, no tracked solution and no telemetry counters
+		/// of its own. Tracking, the cornea center reuse, the solver and stage timing are those of this estimator.
+		std::unique_ptr<EstimationSession> make_session() const override;
+		/// \brief Same as estimate with the filters and the state between frames of session instead of those of this
+		/// estimator, which is not modified, see GazeEstimationMethod::estimate_in_session.
+		DefaultGazeEstimationResult estimate_in_session(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			EstimationSession& session) const override;
+
+		/// \brief Scalar generic version of estimate, e.g. for automatic differentiation during calibration. The cornea
+		/// center is solved for in double, its derivatives follow from the implicit function theorem. Neither the filters
+		/// nor tracking are applied. Returns false instead of throwing if the input is invalid or there is no usable solution.
+		/// Defined in OneCameraSphericalDifferentiable.hpp.
+		template <typename T>
+		bool estimate_differentiable(const PupilCenterGlintInputs& data, const EyeAndCameraParametersT<T>& parameters,
+			DifferentiableGazeEstimationResult<T>& result) const;
+
+		/// \brief Same as estimate with a generic scalar type for the whole estimation path, e.g. float, which halves the
+		/// memory traffic against double. With the Newton solver and two valid glints, the cornea center is solved for in
+		/// T as well, otherwise kq is solved for in double with the generic solver. Neither the filters nor tracking are
+		/// applied. Returns false if the input is invalid or there is no usable solution.
+		/// Defined in OneCameraSphericalScalar.hpp.
+		template <typename T>
+		bool estimate_scalar(const PupilCenterGlintInputs& data, const EyeAndCameraParametersT<T>& parameters,
+			DifferentiableGazeEstimationResult<T>& result) const;
 	private:
+		struct StageCache;
+
+		/// \param	cache	If not null, reused for the stages whose parameters did not change and updated for the others.
+		/// \param	session	The filters and the state between frames, own_session for the estimates that are not in a session.
+		DefaultGazeEstimationResult estimate_frame(const PupilCenterGlintInputs& data, const PreparedParameters& prepared,
+			StageCache* cache, Session& session) const;
+		void record(const DefaultGazeEstimationResult& result, const Session& session) const;
+
+		/// The stages of estimate_frame, also used by the batch path of estimate_range. check_inputs resets tracking and
+		/// sets result to the error if the input cannot be estimated.
+		bool check_inputs(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			DefaultGazeEstimationResult& result, Session& session) const;
+		/// Solves for the cornea center or reuses that of the last solved frame, and applies the cornea center filter.
+		/// usable receives whether the solution is usable.
+		Vec3 estimate_cornea_center(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			SolverTelemetry& telemetry, bool& usable, Session& session) const;
+		/// The pupil center in the image in WCS, with the pupil center filter applied.
+		Vec3 estimate_pupil_wcs(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			const Session& session) const;
+		/// Whether the glints are close enough to those of the last solved frame, with the same parameters, to reuse it.
+		bool can_reuse_cornea_center(const PupilCenterGlintInput::Glints& glints, const EyeAndCameraParameters& parameters,
+			const Session& session) const;
+
 		bool use_chen_noise_reduction = false;
+		CorneaCenterSolver cornea_center_solver = GenericSolver;
+		CorneaResiduals cornea_residuals = PairwiseResiduals;
+		SolverBudget solver_budget;
+
+		bool tracking = false;
+		double reuse_max_glint_motion_px = 0;
+		bool reuse_first_order_update = true;
+
+		bool stage_timing = false;
+		std::shared_ptr<TelemetryCounters> telemetry_counters;
 
-		Vec3Filter cornea_center_filter;
-		Vec3Filter pupil_center_filter;
+		/// the filters and the state between frames of estimate and the other estimates that are not in a session
+		Session own_session;
 	};
 
 }
@@ -0,0 +1,122 @@
+#ifndef ONE_CAMERA_SPHERICAL_DIFFERENTIABLE_HPP_INCLUDED
+#define ONE_CAMERA_SPHERICAL_DIFFERENTIABLE_HPP_INCLUDED
+
+#include "OneCameraSpherical.hpp"
+
+#include <vector>
+
+#include "ImplicitDifferentiation.hpp"
+#include "OneCameraSphericalScalar.hpp"
+#include "SharedCalculations.hpp"
+#include "Utils.hpp"
+
+namespace gazeestimation {
+
+	template <typename T>
+	bool OneCamSphericalGE::estimate_differentiable(const PupilCenterGlintInputs& data, const EyeAndCameraParametersT<T>& parameters,
+		DifferentiableGazeEstimationResult<T>& result) const
+	{
+		if (data.data.size() != 1 || parameters.cameras.size() != 1)
+			return false;
+
+		const PinholeCameraModelT<T>& camera = parameters.cameras[0];
+		const Vec3T<T>& camera_position = camera.position();
+
+		std::vector<Vec3T<T>> glints_wcs;
+		std::vector<Vec3T<T>> selected_lights;
+		for (size_t i = 0; i < data.data[0].glints.size(); i++)
+		{
+			if (!glintValid(data.data[0].glints[i]))
+				continue;
+			glints_wcs.push_back(camera.ics_to_wcs(data.data[0].glints[i].cast<T>()));
+			selected_lights.push_back(parameters.light_positions[i]);
+		}
+
+		const size_t num_glints = glints_wcs.size();
+		if (num_glints < 2)
+			return false;
+
+		// the inner problem in double
+		std::vector<Vec3> glints_value;
+		std::vector<Vec3> lights_value;
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			glints_value.push_back(value_of(glints_wcs[i]));
+			lights_value.push_back(value_of(selected_lights[i]));
+		}
+		const Vec3 camera_position_value = value_of(camera_position);
+		const double R_value = value_of(parameters.R);
+
+		std::vector<double> ks_value(num_glints, value_of(parameters.distance_to_camera_estimate));
+		if (!solve_kq(&glints_value, &lights_value, camera_position_value, R_value, cornea_center_solver, cornea_residuals, ks_value))
+			return false;
+
+		// The inner problem minimizes f = |r|^2 / 2 over kq, with r the differences between the cornea centers of
+		// the glints in the order of cornea_center_differences. Its gradient is J^T r, where column i of the jacobian J
+		// only depends on kq_i, and its hessian is J^T J plus the second derivatives of r weighted by r.
+		typedef ceres::Jet<double, 1> KqJet;
+		std::vector<Vec3T<T>> cs;
+		std::vector<Vec3T<T>> derivatives;
+		std::vector<Vec3> second_derivatives;
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			const Vec3T<T> q_unit = normalized(camera_position - glints_wcs[i]);
+			const Vec3T<T> q = calculate_q(T(ks_value[i]), camera_position, glints_wcs[i]);
+			cs.push_back(calculate_cornea_center(q, selected_lights[i], camera_position, parameters.R));
+			derivatives.push_back(calculate_cornea_center_derivative(q, q_unit, selected_lights[i], camera_position, parameters.R));
+
+			const Vec3 q_unit_value = value_of(q_unit);
+			const Vec3T<KqJet> q_jet = calculate_q(KqJet(ks_value[i], 0), camera_position_value, glints_value[i]);
+			const Vec3T<KqJet> derivative_jet = calculate_cornea_center_derivative(q_jet, Vec3T<KqJet>(q_unit_value.cast<KqJet>()),
+				Vec3T<KqJet>(lights_value[i].cast<KqJet>()), Vec3T<KqJet>(camera_position_value.cast<KqJet>()), KqJet(R_value));
+			second_derivatives.push_back(make_vec3(derivative_jet[0].v[0], derivative_jet[1].v[0], derivative_jet[2].v[0]));
+		}
+
+		std::vector<T> gradient(num_glints, T(0));
+		Eigen::MatrixXd hessian = Eigen::MatrixXd::Zero(num_glints, num_glints);
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			const Vec3 derivative_i = value_of(derivatives[i]);
+			for (size_t j = 0; j < i; j++)
+			{
+				const Vec3 derivative_j = value_of(derivatives[j]);
+				const Vec3T<T> residual = cs[i] - cs[j];
+				const Vec3 residual_value = value_of(residual);
+
+				gradient[i] += dot(derivatives[i], residual);
+				gradient[j] -= dot(derivatives[j], residual);
+
+				hessian(i, i) += dot(derivative_i, derivative_i) + dot(second_derivatives[i], residual_value);
+				hessian(j, j) += dot(derivative_j, derivative_j) - dot(second_derivatives[j], residual_value);
+				hessian(i, j) -= dot(derivative_i, derivative_j);
+				hessian(j, i) -= dot(derivative_i, derivative_j);
+			}
+		}
+
+		std::vector<T> ks;
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			ks.push_back(T(ks_value[i]));
+		}
+		apply_implicit_derivatives(hessian, gradient.data(), ks.data());
+
+		Vec3T<T> cornea_center(T(0), T(0), T(0));
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			const Vec3T<T> q = calculate_q(ks[i], camera_position, glints_wcs[i]);
+			cornea_center += calculate_cornea_center(q, selected_lights[i], camera_position, parameters.R);
+		}
+		cornea_center /= T(static_cast<double>(num_glints));
+
+		const Vec3T<T> pupil_wcs = camera.ics_to_wcs(data.data[0].pupil_center.cast<T>());
+
+		result.center_of_cornea = cornea_center;
+		result.optical_axis = calculate_optic_axis_unit_vector(pupil_wcs, camera_position, cornea_center,
+			parameters.R, parameters.K, parameters.n1, parameters.n2, use_chen_noise_reduction);
+		result.visual_axis = calculate_visual_axis_unit_vector(result.optical_axis, parameters.alpha, parameters.beta);
+		return true;
+	}
+
+}
+
+#endif
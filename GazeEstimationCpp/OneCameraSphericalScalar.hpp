@@ -0,0 +1,154 @@
+#ifndef ONE_CAMERA_SPHERICAL_SCALAR_HPP_INCLUDED
+#define ONE_CAMERA_SPHERICAL_SCALAR_HPP_INCLUDED
+
+#include "OneCameraSpherical.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "SharedCalculations.hpp"
+#include "Telemetry.hpp"
+#include "Utils.hpp"
+
+namespace gazeestimation {
+
+	/// Solves for kq with the given solver. ks holds the initial values and receives the result.
+	/// Returns whether the solution is usable. If telemetry is not null, it receives how the solve went. The generic
+	/// solver reuses the problem of problems if not null, otherwise it builds one for this solve only.
+	/// Defined in OneCameraSpherical.cpp.
+	bool solve_kq(const std::vector<Vec3>* const glints,
+		const std::vector<Vec3>* const lights,
+		const Vec3& camera_position, double R,
+		OneCamSphericalGE::CorneaCenterSolver solver, OneCamSphericalGE::CorneaResiduals residuals,
+		std::vector<double>& ks, SolverTelemetry* telemetry = nullptr, KqProblems* problems = nullptr);
+
+	/// Solves for kq with exactly two glints by Gauss-Newton on the 2x2 normal equations, with analytic derivatives.
+	/// ks holds the initial values and receives the result. Returns false if this did not converge within a few
+	/// iterations, in which case the contents of ks are unspecified. Adds the iterations it ran to telemetry and sets the
+	/// cost of the last one. The steps have to get below the precision of T relative to kq to converge.
+	template <typename T>
+	bool solve_two_glint_kq_newton(const Vec3T<T>* glints, const Vec3T<T>* lights,
+		const Vec3T<T>& camera_position, const T& R, T* ks, SolverTelemetry& telemetry)
+	{
+		using std::abs;
+		using std::isfinite;
+		const int max_iterations = 20;
+		const T step_tolerance = std::max(T(1e-10), T(16) * std::numeric_limits<T>::epsilon());
+
+		const Vec3T<T> q1_unit = normalized(camera_position - glints[0]);
+		const Vec3T<T> q2_unit = normalized(camera_position - glints[1]);
+
+		for (int iteration = 0; iteration < max_iterations; iteration++)
+		{
+			const Vec3T<T> q1 = camera_position + ks[0] * q1_unit;
+			const Vec3T<T> q2 = camera_position + ks[1] * q2_unit;
+			const Vec3T<T> residual = calculate_cornea_center(q1, lights[0], camera_position, R) - calculate_cornea_center(q2, lights[1], camera_position, R);
+			telemetry.iterations++;
+			telemetry.final_cost = 0.5 * static_cast<double>(squared_length(residual));
+
+			// jacobian of the residual is [a, -b]
+			const Vec3T<T> a = calculate_cornea_center_derivative(q1, q1_unit, lights[0], camera_position, R);
+			const Vec3T<T> b = calculate_cornea_center_derivative(q2, q2_unit, lights[1], camera_position, R);
+
+			const T aa = dot(a, a);
+			const T bb = dot(b, b);
+			const T ab = dot(a, b);
+			const T determinant = aa * bb - ab * ab;
+			if (!(determinant > T(1e-12) * aa * bb))
+				return false;
+
+			// solve (J^T J) step = -J^T residual
+			const T ar = dot(a, residual);
+			const T br = -dot(b, residual);
+			const T step1 = -(bb * ar + ab * br) / determinant;
+			const T step2 = -(ab * ar + aa * br) / determinant;
+
+			ks[0] += step1;
+			ks[1] += step2;
+
+			if (!isfinite(ks[0]) || !isfinite(ks[1]) || ks[0] < 2 || ks[0] > 400 || ks[1] < 2 || ks[1] > 400)
+				return false;
+
+			if (abs(step1) < step_tolerance * ks[0] && abs(step2) < step_tolerance * ks[1])
+				return true;
+		}
+
+		return false;
+	}
+
+	template <typename T>
+	bool OneCamSphericalGE::estimate_scalar(const PupilCenterGlintInputs& data, const EyeAndCameraParametersT<T>& parameters,
+		DifferentiableGazeEstimationResult<T>& result) const
+	{
+		if (data.data.size() != 1 || parameters.cameras.size() != 1)
+			return false;
+		// glint i is a reflection of light i
+		if (data.data[0].glints.size() > parameters.light_positions.size() || data.data[0].glints.size() > max_glints_per_camera)
+			return false;
+
+		const PinholeCameraModelT<T>& camera = parameters.cameras[0];
+		const Vec3T<T>& camera_position = camera.position();
+
+		Vec3T<T> glints_wcs[max_glints_per_camera];
+		Vec3T<T> selected_lights[max_glints_per_camera];
+		size_t num_glints = 0;
+		for (size_t i = 0; i < data.data[0].glints.size(); i++)
+		{
+			if (!glintValid(data.data[0].glints[i]))
+				continue;
+			glints_wcs[num_glints] = camera.ics_to_wcs(data.data[0].glints[i].cast<T>());
+			selected_lights[num_glints] = parameters.light_positions[i];
+			num_glints++;
+		}
+
+		if (num_glints < 2)
+			return false;
+
+		T ks[max_glints_per_camera];
+		std::fill(ks, ks + num_glints, parameters.distance_to_camera_estimate);
+		SolverTelemetry telemetry;
+		const bool solved = cornea_center_solver == TwoGlintNewtonSolver && num_glints == 2
+			&& solve_two_glint_kq_newton(glints_wcs, selected_lights, camera_position, parameters.R, ks, telemetry);
+		if (!solved)
+		{
+			// the generic solver only works in double
+			std::vector<Vec3> glints_value;
+			std::vector<Vec3> lights_value;
+			for (size_t i = 0; i < num_glints; i++)
+			{
+				glints_value.push_back(glints_wcs[i].template cast<double>());
+				lights_value.push_back(selected_lights[i].template cast<double>());
+			}
+			std::vector<double> ks_value(num_glints, static_cast<double>(parameters.distance_to_camera_estimate));
+			if (!solve_kq(&glints_value, &lights_value, camera_position.template cast<double>(), static_cast<double>(parameters.R),
+				GenericSolver, cornea_residuals, ks_value))
+				return false;
+
+			for (size_t i = 0; i < num_glints; i++)
+			{
+				ks[i] = T(ks_value[i]);
+			}
+		}
+
+		Vec3T<T> cornea_center(T(0), T(0), T(0));
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			const Vec3T<T> q = calculate_q(ks[i], camera_position, glints_wcs[i]);
+			cornea_center += calculate_cornea_center(q, selected_lights[i], camera_position, parameters.R);
+		}
+		cornea_center /= T(static_cast<double>(num_glints));
+
+		const Vec3T<T> pupil_wcs = camera.ics_to_wcs(data.data[0].pupil_center.cast<T>());
+
+		result.center_of_cornea = cornea_center;
+		result.optical_axis = calculate_optic_axis_unit_vector(pupil_wcs, camera_position, cornea_center,
+			parameters.R, parameters.K, parameters.n1, parameters.n2, use_chen_noise_reduction);
+		result.visual_axis = calculate_visual_axis_unit_vector(result.optical_axis, parameters.alpha, parameters.beta);
+		return true;
+	}
+
+}
+
+#endif
@@ -5,96 +5,239 @@
 
 
 namespace gazeestimation{
-class PinholeCameraModel
+/// A pinhole camera with a generic scalar type, see PinholeCameraModel for the usual double version.
+template <typename T>
+class PinholeCameraModelT
 {
 private:
-	Vec3 camera_angles;
-	Mat3x3 actual_rotation_matrix;
+	Vec3T<T> camera_angles;
+	Mat3x3T<T> actual_rotation_matrix;
 
-public:
 	// camera intrinsic
-	double principal_point_x;
-	double principal_point_y;
-	double pixel_size_cm_x;
-	double pixel_size_cm_y;
-	double effective_focal_length_cm;
+	Vec2T<T> principal_point;
+	Vec2T<T> pixel_size_cm;
+	T actual_effective_focal_length_cm;
 
 	/// the position in WCS
-	Vec3 position;
+	Vec3T<T> actual_position;
+
+	/// ics_to_wcs(pos) is image_to_world_linear * pos + image_to_world_offset, updated whenever one of the above changes
+	Eigen::Matrix<T, 3, 2> image_to_world_linear;
+	Vec3T<T> image_to_world_offset;
+
+	template <typename U> friend class PinholeCameraModelT;
+
+	void update_image_to_world()
+	{
+		image_to_world_linear.col(0) = actual_rotation_matrix.col(0) * pixel_size_cm[0];
+		image_to_world_linear.col(1) = actual_rotation_matrix.col(1) * pixel_size_cm[1];
+		image_to_world_offset = actual_position - image_to_world_linear * principal_point 
+			- actual_rotation_matrix.col(2) * actual_effective_focal_length_cm;
+	}
 
-	PinholeCameraModel():
-		camera_angles(make_vec3(0,0,0)),
-		actual_rotation_matrix(identity_matrix3x3()), 
-		principal_point_x(0), 
-		principal_point_y(0),
-		pixel_size_cm_x(0),
-		pixel_size_cm_y(0),
-		effective_focal_length_cm(0) { }
+public:
+	PinholeCameraModelT():
+		camera_angles(Vec3T<T>(T(0), T(0), T(0))),
+		actual_rotation_matrix(Mat3x3T<T>::Identity()),
+		principal_point(T(0), T(0)),
+		pixel_size_cm(T(0), T(0)),
+		actual_effective_focal_length_cm(0),
+		actual_position(T(0), T(0), T(0))
+	{
+		update_image_to_world();
+	}
 
-	void set_camera_angles(double x, double y, double z)
+	void set_camera_angles(const T& x, const T& y, const T& z)
 	{
-		camera_angles = make_vec3(x, y, z);
+		camera_angles = Vec3T<T>(x, y, z);
 		actual_rotation_matrix = calculate_extrinsic_rotation_matrix(camera_angles[0], camera_angles[1], camera_angles[2]);
+		update_image_to_world();
+	}
+
+	void set_principal_point(const T& x, const T& y)
+	{
+		principal_point = Vec2T<T>(x, y);
+		update_image_to_world();
+	}
+
+	void set_pixel_size_cm(const T& x, const T& y)
+	{
+		pixel_size_cm = Vec2T<T>(x, y);
+		update_image_to_world();
+	}
+
+	void set_effective_focal_length_cm(const T& focal_length)
+	{
+		actual_effective_focal_length_cm = focal_length;
+		update_image_to_world();
+	}
+
+	/// Sets the position in WCS.
+	void set_position(const Vec3T<T>& position)
+	{
+		actual_position = position;
+		update_image_to_world();
+	}
+
+	/// Returns a copy of this camera with scalar type U.
+	template <typename U>
+	PinholeCameraModelT<U> cast() const
+	{
+		PinholeCameraModelT<U> camera;
+		camera.camera_angles = camera_angles.template cast<U>();
+		camera.actual_rotation_matrix = actual_rotation_matrix.template cast<U>();
+		camera.principal_point = principal_point.template cast<U>();
+		camera.pixel_size_cm = pixel_size_cm.template cast<U>();
+		camera.actual_effective_focal_length_cm = U(actual_effective_focal_length_cm);
+		camera.actual_position = actual_position.template cast<U>();
+		camera.image_to_world_linear = image_to_world_linear.template cast<U>();
+		camera.image_to_world_offset = image_to_world_offset.template cast<U>();
+		return camera;
 	}
 
 
+	/// Whether both cameras have the same intrinsics, position and angles, i.e. map images the same way.
+	bool operator==(const PinholeCameraModelT& other) const
+	{
+		return camera_angles == other.camera_angles
+			&& principal_point == other.principal_point
+			&& pixel_size_cm == other.pixel_size_cm
+			&& actual_effective_focal_length_cm == other.actual_effective_focal_length_cm
+			&& actual_position == other.actual_position;
+	}
+
+	bool operator!=(const PinholeCameraModelT& other) const
+	{
+		return !(*this == other);
+	}
+
 	/// Returns the rotation matrix for this camera.
-	Mat3x3 rotation_matrix() const {
+	const Mat3x3T<T>& rotation_matrix() const {
 		return actual_rotation_matrix;
 	}
 
-	/// Transforms the given vector in this camera's image coordinate system to 
+	/// the position in WCS
+	const Vec3T<T>& position() const
+	{
+		return actual_position;
+	}
+
+	T principal_point_x() const
+	{
+		return principal_point[0];
+	}
+
+	T principal_point_y() const
+	{
+		return principal_point[1];
+	}
+
+	T pixel_size_cm_x() const
+	{
+		return pixel_size_cm[0];
+	}
+
+	T pixel_size_cm_y() const
+	{
+		return pixel_size_cm[1];
+	}
+
+	T effective_focal_length_cm() const
+	{
+		return actual_effective_focal_length_cm;
+	}
+
+	/// Transforms the given vector in this camera's image coordinate system to
 	/// the camera coordinate system
-	Vec3 ics_to_ccs(const Vec2& pos) const
+	Vec3T<T> ics_to_ccs(const Vec2T<T>& pos) const
 	{
-		return make_vec3(
-			(pos[0] - principal_point_x) * pixel_size_cm_x,
-			(pos[1] - principal_point_y) * pixel_size_cm_y,
-			-effective_focal_length_cm
+		return Vec3T<T>(
+			(pos[0] - principal_point[0]) * pixel_size_cm[0],
+			(pos[1] - principal_point[1]) * pixel_size_cm[1],
+			-actual_effective_focal_length_cm
 		);
 	}
 
-	Vec3 ccs_to_wcs(const Vec3& pos) const
+	Vec3T<T> ccs_to_wcs(const Vec3T<T>& pos) const
+	{
+		return actual_rotation_matrix * pos + actual_position;
+	}
+
+	/// Same as ccs_to_wcs(ics_to_ccs(pos)), using the precomputed mapping.
+	Vec3T<T> ics_to_wcs(const Vec2T<T>& pos) const
 	{
-		return rotation_matrix() * pos + position;
+		return image_to_world_linear * pos + image_to_world_offset;
 	}
 
-	Vec3 ics_to_wcs(const Vec2& pos) const
+	Vec3T<T> wcs_to_ccs(const Vec3T<T>& pos) const
 	{
-		return ccs_to_wcs(ics_to_ccs(pos));
+		return actual_rotation_matrix.transpose() * (pos - actual_position);
+	}
+
+	/// Projects the given point in the camera coordinate system onto the image plane and returns its position in
+	/// this camera's image coordinate system. The point must be in front of the camera, i.e. have a positive z, as the
+	/// image plane is at z = -f behind the center of projection.
+	Vec2T<T> ccs_to_ics(const Vec3T<T>& pos) const
+	{
+		const T scale = -actual_effective_focal_length_cm / pos[2];
+		return Vec2T<T>(
+			pos[0] * scale / pixel_size_cm[0] + principal_point[0],
+			pos[1] * scale / pixel_size_cm[1] + principal_point[1]
+		);
 	}
 
-	double camera_angle_x() const
+	/// Same as ccs_to_ics(wcs_to_ccs(pos)), the inverse of ics_to_wcs up to the depth along the ray.
+	Vec2T<T> wcs_to_ics(const Vec3T<T>& pos) const
+	{
+		return ccs_to_ics(wcs_to_ccs(pos));
+	}
+
+	/// Transforms all positions in [first, last) from this camera's image coordinate system to the WCS in one pass,
+	/// out must have room for last - first positions.
+	void ics_to_wcs(const Vec2T<T>* first, const Vec2T<T>* last, Vec3T<T>* out) const
+	{
+		const Eigen::Index count = last - first;
+		if (count == 0)
+			return;
+		const Eigen::Map<const Eigen::Matrix<T, 2, Eigen::Dynamic>> image(first->data(), 2, count);
+		Eigen::Map<Eigen::Matrix<T, 3, Eigen::Dynamic>> world(out->data(), 3, count);
+		world.noalias() = image_to_world_linear * image;
+		world.colwise() += image_to_world_offset;
+	}
+
+	T camera_angle_x() const
 	{
 		return camera_angles[0];
 	}
 
-	double camera_angle_y() const
+	T camera_angle_y() const
 	{
 		return camera_angles[1];
 	}
-	double camera_angle_z() const
+	T camera_angle_z() const
 	{
 		return camera_angles[2];
 	}
 
-	void set_camera_angle_x(double angle)
+	void set_camera_angle_x(const T& angle)
 	{
 		set_camera_angles(angle, camera_angles[1], camera_angles[2]);
 	}
 
-	void set_camera_angle_y(double angle)
+	void set_camera_angle_y(const T& angle)
 	{
 		set_camera_angles(camera_angles[0], angle, camera_angles[2]);
 	}
 
-	void set_camera_angle_z(double angle)
+	void set_camera_angle_z(const T& angle)
 	{
 		set_camera_angles(camera_angles[0], camera_angles[1], angle);
 	}
 
 };
 
+typedef PinholeCameraModelT<double> PinholeCameraModel;
+
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,45 @@
+#ifndef PREPARED_PARAMETERS_HPP_INCLUDED
+#define PREPARED_PARAMETERS_HPP_INCLUDED
+
+#include "GazeEstimationTypes.hpp"
+#include "SharedCalculations.hpp"
+
+namespace gazeestimation {
+
+	/// \brief A set of parameters together with everything derived from them that estimates would otherwise recompute
+	/// per frame. Build it once per set of parameters and hand it to the estimate overloads taking it. Only refers to the
+	/// parameters, so they must outlive this and must not change while it is used.
+	class PreparedParameters
+	{
+	private:
+		const EyeAndCameraParameters* actual_parameters;
+		Vec3 actual_nu_ecs;
+		EyeModelConstants<double> actual_eye;
+
+	public:
+		explicit PreparedParameters(const EyeAndCameraParameters& parameters) :
+			actual_parameters(&parameters),
+			actual_nu_ecs(calculate_nu_ecs(parameters.alpha, parameters.beta)),
+			actual_eye(parameters.R, parameters.K, parameters.n1, parameters.n2) { }
+
+		const EyeAndCameraParameters& parameters() const
+		{
+			return *actual_parameters;
+		}
+
+		/// calculate_nu_ecs(alpha, beta)
+		const Vec3& nu_ecs() const
+		{
+			return actual_nu_ecs;
+		}
+
+		/// R, K and the terms derived from them and the refractive indices
+		const EyeModelConstants<double>& eye() const
+		{
+			return actual_eye;
+		}
+	};
+
+}
+
+#endif
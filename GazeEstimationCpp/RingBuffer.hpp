@@ -0,0 +1,140 @@
+#ifndef RING_BUFFER_HPP_INCLUDED
+#define RING_BUFFER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace gazeestimation {
+
+	/// \brief A lock-free bounded queue for a single producer and any number of consumers. Each slot has a sequence
+	/// number that tells whether it is free for the element at a position or holds it, so an element is only ever
+	/// touched by the thread that claimed its slot. Consumers claim elements by advancing the read position;
+	/// push_overwrite claims the oldest element the same way to drop it, so dropping never races with a consumer.
+	template <typename T>
+	class RingBuffer
+	{
+	public:
+		/// \param	capacity	The number of elements the queue holds, at least 2, as with a single slot the sequence number
+		///						of a slot that holds an element is the same as that of the slot being free for the next one.
+		explicit RingBuffer(size_t capacity) :
+			actual_capacity(capacity),
+			slots(new Slot[capacity])
+		{
+			if (capacity < 2)
+				throw std::invalid_argument("RingBuffer needs a capacity of at least 2.");
+			for (size_t i = 0; i < capacity; i++)
+			{
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		RingBuffer(const RingBuffer&) = delete;
+		RingBuffer& operator=(const RingBuffer&) = delete;
+
+		size_t capacity() const
+		{
+			return actual_capacity;
+		}
+
+		/// Returns the number of queued elements, which may be outdated by the time it returns.
+		size_t size() const
+		{
+			const size_t read = read_position.load(std::memory_order_acquire);
+			const size_t write = write_position.load(std::memory_order_acquire);
+			return write > read ? write - read : 0;
+		}
+
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+		/// Producer only. Appends value if there is room and returns whether it did.
+		bool try_push(const T& value)
+		{
+			const size_t position = write_position.load(std::memory_order_relaxed);
+			Slot& slot = slots[position % actual_capacity];
+			if (slot.sequence.load(std::memory_order_acquire) != position)
+				return false;
+
+			publish(slot, position, value);
+			return true;
+		}
+
+		/// \brief Producer only. Appends value, dropping the oldest element if the queue is full. Returns whether an
+		/// element was dropped. If a consumer is just taking the oldest element, waits for it to finish copying it out.
+		bool push_overwrite(const T& value)
+		{
+			const size_t position = write_position.load(std::memory_order_relaxed);
+			Slot& slot = slots[position % actual_capacity];
+			bool dropped = false;
+			if (slot.sequence.load(std::memory_order_acquire) != position)
+			{
+				// the slot still holds the element at position - capacity, the oldest one
+				size_t oldest = position - actual_capacity;
+				if (read_position.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel))
+				{
+					dropped = true;
+				}
+				else
+				{
+					while (slot.sequence.load(std::memory_order_acquire) != position)
+					{
+						std::this_thread::yield();
+					}
+				}
+			}
+
+			publish(slot, position, value);
+			return dropped;
+		}
+
+		/// Any thread. Moves the oldest element into value and returns true, or returns false if the queue is empty.
+		bool try_pop(T& value)
+		{
+			size_t position = read_position.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				Slot& slot = slots[position % actual_capacity];
+				if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+					return false;
+
+				if (read_position.compare_exchange_weak(position, position + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+				{
+					value = std::move(slot.value);
+					slot.sequence.store(position + actual_capacity, std::memory_order_release);
+					return true;
+				}
+			}
+		}
+
+	private:
+		struct Slot
+		{
+			/// position if free for the element at position, position + 1 if it holds it
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		void publish(Slot& slot, size_t position, const T& value)
+		{
+			slot.value = value;
+			slot.sequence.store(position + 1, std::memory_order_release);
+			write_position.store(position + 1, std::memory_order_release);
+		}
+
+		const size_t actual_capacity;
+		std::unique_ptr<Slot[]> slots;
+
+		// kept apart so that the producer and the consumers do not share a cache line
+		std::atomic<size_t> write_position{ 0 };
+		char padding[64];
+		std::atomic<size_t> read_position{ 0 };
+	};
+
+}
+
+#endif
@@ -4,80 +4,267 @@
 #include "MathTypes.hpp"
 #include "GazeEstimationTypes.hpp"
 
+#include <cmath>
+
+/// All calculations here are generic in the scalar type so that they can be used with the jet type of the optimization
+/// backend as well, e.g. for automatic differentiation during calibration.
 namespace gazeestimation
 {
-	inline Vec3 calculate_nu_ecs(double alpha, double beta)
+	template <typename T>
+	inline Vec3T<T> calculate_nu_ecs(const T& alpha, const T& beta)
 	{
-		return make_vec3(-sin(alpha) * cos(beta), sin(beta), cos(alpha) * cos(beta));
+		using std::sin;
+		using std::cos;
+		return Vec3T<T>(-sin(alpha) * cos(beta), sin(beta), cos(alpha) * cos(beta));
 	}
 
-	inline Vec3 calculate_eye_angles(const Vec3& optic_axis_unit_vector)
+	template <typename T>
+	inline Vec3T<T> calculate_eye_angles(const Vec3T<T>& optic_axis_unit_vector)
 	{
-		return make_vec3(
-			-1 * atan(optic_axis_unit_vector[0] / optic_axis_unit_vector[2]),
+		using std::atan;
+		using std::asin;
+		return Vec3T<T>(
+			-atan(optic_axis_unit_vector[0] / optic_axis_unit_vector[2]),
 			asin(optic_axis_unit_vector[1]),
-			0
+			T(0)
 		);
 	}
 
-	/// Note that this is not equal to a general rotation matrix, as the coordinate system this 
+	/// Note that this is not equal to a general rotation matrix, as the coordinate system this
 	/// transforms from is flipped as well.
-	inline Mat3x3 calculate_eye_rotation_matrix(double theta, double phi, double kappa)
-	{
-		Mat3x3 Rflip, Rtheta, Rphi, Rkappa;
-		Rflip << -1, 0, 0,
-			0, 1, 0,
-			0, 0, -1;
-		Rtheta << std::cos(theta), 0, -std::sin(theta),
-			0, 1, 0,
-			std::sin(theta), 0, std::cos(theta);
-		Rphi << 1, 0, 0,
-			0, std::cos(phi), std::sin(phi),
-			0, -std::sin(phi), std::cos(phi);
-		Rkappa << std::cos(kappa), -std::sin(kappa), 0,
-			std::sin(kappa), std::cos(kappa), 0,
-			0, 0, 1;
+	template <typename T>
+	inline Mat3x3T<T> calculate_eye_rotation_matrix(const T& theta, const T& phi, const T& kappa)
+	{
+		using std::sin;
+		using std::cos;
+		const T zero(0);
+		const T one(1);
+
+		Mat3x3T<T> Rflip, Rtheta, Rphi, Rkappa;
+		Rflip << -one, zero, zero,
+			zero, one, zero,
+			zero, zero, -one;
+		Rtheta << cos(theta), zero, -sin(theta),
+			zero, one, zero,
+			sin(theta), zero, cos(theta);
+		Rphi << one, zero, zero,
+			zero, cos(phi), sin(phi),
+			zero, -sin(phi), cos(phi);
+		Rkappa << cos(kappa), -sin(kappa), zero,
+			sin(kappa), cos(kappa), zero,
+			zero, zero, one;
 
 		return mat_prod(Rflip, mat_prod(Rtheta, mat_prod(Rphi, Rkappa)));
 
 	}
 
-	inline Vec3 calculate_visual_axis_unit_vector(const Vec3& optical_axis_unit_vector, double alpha, double beta)
+	/// Calculates the visual axis from the optical axis and nu_ecs = calculate_nu_ecs(alpha, beta).
+	template <typename T>
+	inline Vec3T<T> calculate_visual_axis_unit_vector(const Vec3T<T>& optical_axis_unit_vector, const Vec3T<T>& nu_ecs)
 	{
-		const Vec3 nu_ecs = calculate_nu_ecs(alpha, beta);
-		Vec3 eye_angles = calculate_eye_angles(optical_axis_unit_vector);
-		const Mat3x3 Reye = calculate_eye_rotation_matrix(eye_angles[0], eye_angles[1], eye_angles[2]);
+		Vec3T<T> eye_angles = calculate_eye_angles(optical_axis_unit_vector);
+		const Mat3x3T<T> Reye = calculate_eye_rotation_matrix(eye_angles[0], eye_angles[1], eye_angles[2]);
 		return mat3vec3_prod(Reye, nu_ecs);
 	}
 
+	template <typename T>
+	inline Vec3T<T> calculate_visual_axis_unit_vector(const Vec3T<T>& optical_axis_unit_vector, const T& alpha, const T& beta)
+	{
+		return calculate_visual_axis_unit_vector(optical_axis_unit_vector, calculate_nu_ecs(alpha, beta));
+	}
+
+	/// The terms of eq. 3.33 that only depend on the refractive indices.
+	template <typename T>
+	struct RefractionConstants
+	{
+		/// (n1 / n2)^2 - 1
+		T n1_n2_squared_minus_one;
+		/// n2 / n1
+		T n2_n1;
+
+		RefractionConstants(const T& n1, const T& n2) :
+			n1_n2_squared_minus_one((n1 / n2) * (n1 / n2) - T(1)),
+			n2_n1(n2 / n1) { }
+	};
+
+	/// The eye parameters the pupil calculations need, together with the terms that only depend on them.
+	template <typename T>
+	struct EyeModelConstants
+	{
+		T R;
+		T K;
+		/// R^2 - K^2
+		T R_squared_minus_K_squared;
+		RefractionConstants<T> refraction;
+
+		EyeModelConstants(const T& R, const T& K, const T& n1, const T& n2) :
+			R(R),
+			K(K),
+			R_squared_minus_K_squared(R * R - K * K),
+			refraction(n1, n2) { }
+	};
+
 
 	/// Calculates iota per eq 3.33
-	inline Vec3 calculate_iota(const Vec3& camera_position, const Vec3& pupil_por_wcs, const Vec3& center_of_cornea, double R, double n1, double n2)
+	template <typename T>
+	inline Vec3T<T> calculate_iota(const Vec3T<T>& camera_position, const Vec3T<T>& pupil_por_wcs, const Vec3T<T>& center_of_cornea,
+		const T& R, const RefractionConstants<T>& refraction)
 	{
-		Vec3 zeta = normalized(camera_position - pupil_por_wcs);
-		Vec3 eta = (pupil_por_wcs - center_of_cornea) / R;
-		double eta_dot_zeta = dot(eta, zeta);
+		using std::sqrt;
+		Vec3T<T> zeta = normalized(camera_position - pupil_por_wcs);
+		Vec3T<T> eta = (pupil_por_wcs - center_of_cornea) / R;
+		T eta_dot_zeta = dot(eta, zeta);
 
-		double a = eta_dot_zeta - sqrt((n1 / n2)*(n1 / n2) - 1 + eta_dot_zeta * eta_dot_zeta);
-		return (n2 / n1) * (a * eta - zeta);
+		T a = eta_dot_zeta - sqrt(refraction.n1_n2_squared_minus_one + eta_dot_zeta * eta_dot_zeta);
+		return refraction.n2_n1 * (a * eta - zeta);
+	}
+
+	template <typename T>
+	inline Vec3T<T> calculate_iota(const Vec3T<T>& camera_position, const Vec3T<T>& pupil_por_wcs, const Vec3T<T>& center_of_cornea,
+		const T& R, const T& n1, const T& n2)
+	{
+		return calculate_iota(camera_position, pupil_por_wcs, center_of_cornea, R, RefractionConstants<T>(n1, n2));
 	}
 
 	/// Calculates kr per eq. 3.29
-	inline double calculate_kr(const Vec3& camera_position, const Vec3& image_pupil_center, const Vec3& cornea_center, double R)
+	template <typename T>
+	inline T calculate_kr(const Vec3T<T>& camera_position, const Vec3T<T>& image_pupil_center, const Vec3T<T>& cornea_center, const T& R)
 	{
-		const double a = squared_length(camera_position - image_pupil_center);
-		const double b = dot(camera_position - image_pupil_center, camera_position - cornea_center);
-		const double c = squared_length(camera_position - cornea_center) - R * R;
+		using std::sqrt;
+		const T a = squared_length(camera_position - image_pupil_center);
+		const T b = dot(camera_position - image_pupil_center, camera_position - cornea_center);
+		const T c = squared_length(camera_position - cornea_center) - R * R;
 
 		return (-b - sqrt(b * b - a * c)) / a;
 	}
 
-	inline Vec3 calculate_r(const Vec3& camera_position, const Vec3& pupil_image_wcs, const Vec3& cornea_wcs, double R)
+	template <typename T>
+	inline Vec3T<T> calculate_r(const Vec3T<T>& camera_position, const Vec3T<T>& pupil_image_wcs, const Vec3T<T>& cornea_wcs, const T& R)
 	{
-		const double kr = calculate_kr(camera_position, pupil_image_wcs, cornea_wcs, R);
+		const T kr = calculate_kr(camera_position, pupil_image_wcs, cornea_wcs, R);
 		return camera_position + kr * (camera_position - pupil_image_wcs);
 	}
 
+	/// Calculates the point of reflection q = o + kq * (o - u) / |o - u| per eq. 3.2 for a glint at u.
+	/// The positions may have a different scalar type than kq, e.g. double while kq is being optimized.
+	template <typename T, typename S>
+	inline Vec3T<T> calculate_q(const T& kq, const Vec3T<S>& o, const Vec3T<S>& u)
+	{
+		return o.template cast<T>() + kq * normalized(o - u).template cast<T>();
+	}
+
+	/// Calculates the cornea center from the point of reflection q of the given light per eq. 3.7.
+	template <typename T, typename S>
+	inline Vec3T<T> calculate_cornea_center(const Vec3T<T>& q, const Vec3T<S>& light, const Vec3T<S>& camera_position, const S& R)
+	{
+		const Vec3T<T> l_q_unit = normalized(light.template cast<T>() - q);
+		const Vec3T<T> o_q_unit = normalized(camera_position.template cast<T>() - q);
+		return q - T(R) * normalized(l_q_unit + o_q_unit);
+	}
+
+	/// Derivative of calculate_cornea_center(calculate_q(kq, o, u), ...) with respect to kq, where q_unit is normalized(o - u).
+	template <typename T>
+	inline Vec3T<T> calculate_cornea_center_derivative(const Vec3T<T>& q, const Vec3T<T>& q_unit, const Vec3T<T>& light,
+		const Vec3T<T>& camera_position, const T& R)
+	{
+		const Vec3T<T> l_q = light - q;
+		const Vec3T<T> o_q = camera_position - q;
+		const T l_q_length = length(l_q);
+		const T o_q_length = length(o_q);
+		const Vec3T<T> l_q_unit = l_q / l_q_length;
+		const Vec3T<T> o_q_unit = o_q / o_q_length;
+
+		// d/dx (x / |x|) = (I - x x^T / |x|^2) / |x|, and dq/dkq = q_unit
+		const Vec3T<T> d_l_q_unit = -(q_unit - dot(l_q_unit, q_unit) * l_q_unit) / l_q_length;
+		const Vec3T<T> d_o_q_unit = -(q_unit - dot(o_q_unit, q_unit) * o_q_unit) / o_q_length;
+
+		const Vec3T<T> sum = l_q_unit + o_q_unit;
+		const T sum_length = length(sum);
+		const Vec3T<T> sum_unit = sum / sum_length;
+		const Vec3T<T> d_sum = d_l_q_unit + d_o_q_unit;
+		const Vec3T<T> d_sum_unit = (d_sum - dot(sum_unit, d_sum) * sum_unit) / sum_length;
+
+		return q_unit - R * d_sum_unit;
+	}
+
+	/// Writes the pairwise differences between the given cornea centers into residual, 3 entries per pair.
+	template <typename T>
+	inline void cornea_center_differences(const Vec3T<T>* const cs, size_t num_glints, T* residual)
+	{
+		size_t index = 0;
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			for (size_t j = 0; j < i; j++)
+			{
+				const Vec3T<T> d = cs[i] - cs[j];
+				residual[index++] = d[0];
+				residual[index++] = d[1];
+				residual[index++] = d[2];
+			}
+		}
+	}
+
+	/// \brief Writes the differences between the given cornea centers and a common center into residual, 3 entries per
+	/// cornea center, for a cost that grows linearly with the number of glints.
+	template <typename T>
+	inline void cornea_center_deviations(const Vec3T<T>* const cs, size_t num_glints, const T* const center, T* residual)
+	{
+		for (size_t i = 0; i < num_glints; i++)
+		{
+			residual[3 * i] = cs[i][0] - center[0];
+			residual[3 * i + 1] = cs[i][1] - center[1];
+			residual[3 * i + 2] = cs[i][2] - center[2];
+		}
+	}
+
+	/// Calculates the pupil center p from its point of refraction per eq. 3.34
+	template <typename T>
+	inline Vec3T<T> calculate_p(const Vec3T<T>& camera_position, const Vec3T<T>& pupil_por_wcs, const Vec3T<T>& center_of_cornea,
+		const EyeModelConstants<T>& eye)
+	{
+		using std::sqrt;
+		Vec3T<T> iota = calculate_iota(camera_position, pupil_por_wcs, center_of_cornea, eye.R, eye.refraction);
+		T rc_dot_iota = dot((pupil_por_wcs - center_of_cornea), iota);
+		T kp = -rc_dot_iota - sqrt(rc_dot_iota*rc_dot_iota - eye.R_squared_minus_K_squared);
+		return pupil_por_wcs + kp * iota;
+	}
+
+	template <typename T>
+	inline Vec3T<T> calculate_p(const Vec3T<T>& camera_position, const Vec3T<T>& pupil_por_wcs, const Vec3T<T>& center_of_cornea,
+		const T& R, const T& K, const T& n1, const T& n2)
+	{
+		return calculate_p(camera_position, pupil_por_wcs, center_of_cornea, EyeModelConstants<T>(R, K, n1, n2));
+	}
+
+	/// Calculates the optic axis of a single camera setup from the pupil image and the cornea center, optionally
+	/// with the noise reduction of Chen et al.
+	template <typename T>
+	inline Vec3T<T> calculate_optic_axis_unit_vector(const Vec3T<T>& pupil_wcs, const Vec3T<T>& camera_position, const Vec3T<T>& center_of_cornea,
+		const EyeModelConstants<T>& eye, bool use_chen_noise_reduction)
+	{
+		using std::sqrt;
+		const Vec3T<T> pupil_por_wcs = calculate_r(camera_position, pupil_wcs, center_of_cornea, eye.R);
+
+		Vec3T<T> pupil_center_wcs = calculate_p(camera_position, pupil_por_wcs, center_of_cornea, eye);
+
+		if(use_chen_noise_reduction)
+		{
+			T cxpx = center_of_cornea[0] - pupil_center_wcs[0];
+			T cypy = center_of_cornea[1] - pupil_center_wcs[1];
+			pupil_center_wcs[2] = center_of_cornea[2] - sqrt(eye.K * eye.K - cxpx * cxpx - cypy*cypy);
+		}
+
+		return normalized(pupil_center_wcs - center_of_cornea);
+	}
+
+	template <typename T>
+	inline Vec3T<T> calculate_optic_axis_unit_vector(const Vec3T<T>& pupil_wcs, const Vec3T<T>& camera_position, const Vec3T<T>& center_of_cornea,
+		const T& R, const T& K, const T& n1, const T& n2, bool use_chen_noise_reduction)
+	{
+		return calculate_optic_axis_unit_vector(pupil_wcs, camera_position, center_of_cornea, EyeModelConstants<T>(R, K, n1, n2),
+			use_chen_noise_reduction);
+	}
+
 }
 
-#endif
\ No newline at end of file
+#endif
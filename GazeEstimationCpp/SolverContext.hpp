@@ -0,0 +1,40 @@
+#ifndef SOLVER_CONTEXT_HPP_INCLUDED
+#define SOLVER_CONTEXT_HPP_INCLUDED
+
+#include <memory>
+
+namespace gazeestimation {
+
+	/// \brief Holds the solver state an estimator builds on first use and reuses for later frames, e.g. ceres problems
+	/// that are rebound to the data of each frame instead of being set up again. Copies start out empty, so that the
+	/// estimator stays copyable and its clones, which may run concurrently, never share the state. Context only needs
+	/// to be a complete type where get is called.
+	template <class Context>
+	class SolverContext
+	{
+	public:
+		SolverContext() = default;
+		SolverContext(const SolverContext&) {}
+		SolverContext& operator=(const SolverContext&)
+		{
+			context.reset();
+			return *this;
+		}
+
+		/// The context, default constructed on first use.
+		Context& get()
+		{
+			if (!context)
+				context = std::make_shared<Context>();
+			return *context;
+		}
+
+	private:
+		/// shared_ptr for its deleter, which is bound where the context is created rather than where the holder is
+		/// destroyed; the context is never shared
+		std::shared_ptr<Context> context;
+	};
+
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SOLVER_UTILS_HPP_INCLUDED
+#define SOLVER_UTILS_HPP_INCLUDED
+
+#include "GazeEstimationTypes.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <ceres/ceres.h>
+
+namespace gazeestimation {
+	/// \brief Sets the limits of budget on options before a solve, with default_max_iterations where budget leaves the
+	/// iteration cap at the default. The time limit is what is left until deadline, see SolverBudget::deadline.
+	inline void apply_solver_budget(const SolverBudget& budget, int default_max_iterations, SolverBudget::Clock::time_point deadline,
+		ceres::Solver::Options& options)
+	{
+		static const ceres::Solver::Options defaults;
+		options.max_num_iterations = budget.max_iterations > 0 ? budget.max_iterations : default_max_iterations;
+		options.function_tolerance = budget.function_tolerance > 0 ? budget.function_tolerance : defaults.function_tolerance;
+		options.gradient_tolerance = budget.gradient_tolerance > 0 ? budget.gradient_tolerance : defaults.gradient_tolerance;
+		options.parameter_tolerance = budget.parameter_tolerance > 0 ? budget.parameter_tolerance : defaults.parameter_tolerance;
+		if (deadline == SolverBudget::Clock::time_point::max())
+		{
+			options.max_solver_time_in_seconds = defaults.max_solver_time_in_seconds;
+		}
+		else
+		{
+			// a deadline that has passed already still evaluates the initial values once
+			const double remaining = std::chrono::duration<double>(deadline - SolverBudget::Clock::now()).count();
+			options.max_solver_time_in_seconds = std::max(remaining, 0.0);
+		}
+	}
+
+	/// \brief Adds the outcome of a ceres solve to telemetry, with ceres as the solver that produced the solution. A solve
+	/// that did not converge by deadline is recorded as SolverTelemetry::DeadlineExceeded.
+	inline void record_ceres_summary(const ceres::Solver::Summary& summary, SolverTelemetry& telemetry,
+		SolverBudget::Clock::time_point deadline = SolverBudget::Clock::time_point::max())
+	{
+		telemetry.solver = SolverTelemetry::CeresSolver;
+		switch (summary.termination_type)
+		{
+		case ceres::CONVERGENCE:
+		case ceres::USER_SUCCESS:
+			telemetry.termination = SolverTelemetry::Converged;
+			break;
+		case ceres::NO_CONVERGENCE:
+			telemetry.termination = SolverBudget::Clock::now() >= deadline ? SolverTelemetry::DeadlineExceeded
+				: SolverTelemetry::NoConvergence;
+			break;
+		default:
+			telemetry.termination = SolverTelemetry::Failed;
+			break;
+		}
+		telemetry.iterations += summary.num_successful_steps + summary.num_unsuccessful_steps;
+		telemetry.final_cost = summary.final_cost;
+	}
+}
+
+#endif
\ No newline at end of file
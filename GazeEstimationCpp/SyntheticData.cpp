@@ -0,0 +1,294 @@
+#include "SyntheticData.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "BinaryRecording.hpp"
+#include "SharedCalculations.hpp"
+
+namespace gazeestimation {
+
+	namespace {
+		const int bisection_iterations = 60;
+
+		/// An orthonormal basis of the plane through the cornea center spanned by the directions to a and b, with e1
+		/// towards a. Returns false if the directions are (nearly) the same, in which case only e1 is set.
+		bool plane_basis(const Vec3& cornea_center, const Vec3& a, const Vec3& b, Vec3& e1, Vec3& e2, double& angle_b)
+		{
+			e1 = normalized(a - cornea_center);
+			const Vec3 towards_b = normalized(b - cornea_center);
+			const Vec3 orthogonal = towards_b - dot(towards_b, e1) * e1;
+			if (length(orthogonal) < 1e-12)
+				return false;
+			e2 = normalized(orthogonal);
+			angle_b = std::atan2(dot(towards_b, e2), dot(towards_b, e1));
+			return true;
+		}
+
+		Vec3 on_sphere(const Vec3& cornea_center, double R, const Vec3& e1, const Vec3& e2, double angle)
+		{
+			return cornea_center + R * (std::cos(angle) * e1 + std::sin(angle) * e2);
+		}
+
+		/// Whether the point is in front of the camera and its image can thus be taken.
+		bool in_front_of(const PinholeCameraModel& camera, const Vec3& point)
+		{
+			return camera.wcs_to_ccs(point)[2] > 0;
+		}
+
+		bool in_image(const PinholeCameraModel& camera, const Vec2& position)
+		{
+			return position[0] >= 0 && position[1] >= 0
+				&& position[0] <= 2 * camera.principal_point_x() && position[1] <= 2 * camera.principal_point_y();
+		}
+	}
+
+	Vec3 calculate_reflection_point(const Vec3& cornea_center, double R, const Vec3& light, const Vec3& camera_position)
+	{
+		Vec3 e1, e2;
+		double angle_light = 0;
+		if (!plane_basis(cornea_center, camera_position, light, e1, e2, angle_light))
+			return cornea_center + R * e1;
+
+		// the normal goes from the direction of the camera at angle 0 to that of the light at angle_light, the angle of
+		// incidence minus the angle of reflection changes its sign once in between
+		const auto imbalance = [&](double angle)
+		{
+			const Vec3 normal = std::cos(angle) * e1 + std::sin(angle) * e2;
+			const Vec3 q = cornea_center + R * normal;
+			return dot(normal, normalized(camera_position - q)) - dot(normal, normalized(light - q));
+		};
+
+		double low = 0;
+		double high = angle_light;
+		for (int iteration = 0; iteration < bisection_iterations; iteration++)
+		{
+			const double middle = 0.5 * (low + high);
+			if ((imbalance(middle) > 0) == (imbalance(low) > 0))
+				low = middle;
+			else
+				high = middle;
+		}
+		return on_sphere(cornea_center, R, e1, e2, 0.5 * (low + high));
+	}
+
+	bool calculate_refraction_point(const Vec3& cornea_center, const Vec3& pupil_center, const Vec3& camera_position,
+		double R, double n1, double n2, Vec3& refraction_point)
+	{
+		Vec3 e1, e2;
+		double angle_pupil = 0;
+		if (!plane_basis(cornea_center, camera_position, pupil_center, e1, e2, angle_pupil))
+		{
+			refraction_point = cornea_center + R * e1;
+			return true;
+		}
+
+		// between the direction of the camera and that of the pupil, the refracted ray turns from one side of the
+		// direction to the pupil center to the other
+		const RefractionConstants<double> refraction(n1, n2);
+		const Vec3 plane_normal = cross_product(e1, e2);
+		const auto side = [&](double angle)
+		{
+			const Vec3 r = on_sphere(cornea_center, R, e1, e2, angle);
+			const Vec3 iota = calculate_iota(camera_position, r, cornea_center, R, refraction);
+			return dot(cross_product(iota, pupil_center - r), plane_normal);
+		};
+
+		double low = 0;
+		double high = angle_pupil;
+		const double side_low = side(low);
+		const double side_high = side(high);
+		if (!std::isfinite(side_low) || !std::isfinite(side_high) || (side_low > 0) == (side_high > 0))
+			return false;
+
+		for (int iteration = 0; iteration < bisection_iterations; iteration++)
+		{
+			const double middle = 0.5 * (low + high);
+			const double side_middle = side(middle);
+			if (!std::isfinite(side_middle))
+				return false;
+			if ((side_middle > 0) == (side_low > 0))
+				low = middle;
+			else
+				high = middle;
+		}
+		refraction_point = on_sphere(cornea_center, R, e1, e2, 0.5 * (low + high));
+		return true;
+	}
+
+	Vec3 calculate_optical_axis_unit_vector(const Vec3& visual_axis_unit_vector, const Vec3& nu_ecs)
+	{
+		const int max_iterations = 100;
+		const double tolerance = 1e-14;
+
+		// the optical axis has the form of nu_ecs in its eye angles, with the sign of z of the visual axis
+		const double sign = visual_axis_unit_vector[2] < 0 ? -1 : 1;
+		const auto from_angles = [sign](const Vec3& angles)
+		{
+			return make_vec3(-sign * std::sin(angles[0]) * std::cos(angles[1]), std::sin(angles[1]),
+				sign * std::cos(angles[0]) * std::cos(angles[1]));
+		};
+
+		// alpha and beta are small, so the visual axis follows the eye angles of the optical axis nearly one to one
+		const Vec3 target_angles = calculate_eye_angles(visual_axis_unit_vector);
+		Vec3 angles = target_angles;
+		for (int iteration = 0; iteration < max_iterations; iteration++)
+		{
+			const Vec3 visual_axis = calculate_visual_axis_unit_vector(from_angles(angles), nu_ecs);
+			const Vec3 correction = target_angles - calculate_eye_angles(visual_axis);
+			angles += correction;
+			if (correction.cwiseAbs().maxCoeff() < tolerance)
+				break;
+		}
+		return from_angles(angles);
+	}
+
+	SyntheticFrameGenerator::SyntheticFrameGenerator(const EyeAndCameraParameters& parameters, const Scene& scene,
+		unsigned int seed) :
+		actual_parameters(parameters),
+		nu_ecs(calculate_nu_ecs(parameters.alpha, parameters.beta)),
+		actual_scene(scene),
+		random(seed),
+		normal(0, 1),
+		unit(0, 1)
+	{
+		if (parameters.cameras.size() > max_cameras)
+			throw std::invalid_argument("SyntheticFrameGenerator: more cameras than the inputs have room for.");
+		if (parameters.light_positions.size() > max_glints_per_camera)
+			throw std::invalid_argument("SyntheticFrameGenerator: more lights than the inputs have room for glints.");
+	}
+
+	const EyeAndCameraParameters& SyntheticFrameGenerator::parameters() const
+	{
+		return actual_parameters;
+	}
+
+	void SyntheticFrameGenerator::set_noise(const Noise& noise)
+	{
+		actual_noise = noise;
+	}
+
+	const SyntheticFrameGenerator::Noise& SyntheticFrameGenerator::noise() const
+	{
+		return actual_noise;
+	}
+
+	void SyntheticFrameGenerator::set_scene(const Scene& scene)
+	{
+		actual_scene = scene;
+	}
+
+	const SyntheticFrameGenerator::Scene& SyntheticFrameGenerator::scene() const
+	{
+		return actual_scene;
+	}
+
+	bool SyntheticFrameGenerator::generate(const Vec3& cornea_center, const Vec3& gaze_target, PupilCenterGlintInputs& frame,
+		SyntheticFrameTruth* truth)
+	{
+		const EyeAndCameraParameters& parameters = actual_parameters;
+		const Vec3 visual_axis = normalized(gaze_target - cornea_center);
+		const Vec3 optical_axis = calculate_optical_axis_unit_vector(visual_axis, nu_ecs);
+		const Vec3 pupil_center = cornea_center + parameters.K * optical_axis;
+
+		frame.data.resize(parameters.cameras.size());
+		for (size_t camera_index = 0; camera_index < parameters.cameras.size(); camera_index++)
+		{
+			const PinholeCameraModel& camera = parameters.cameras[camera_index];
+			const Vec3& camera_position = camera.position();
+			PupilCenterGlintInput& input = frame.data[camera_index];
+
+			// the eye has to face the camera for the pupil to be seen
+			if (dot(optical_axis, camera_position - cornea_center) <= 0 || !in_front_of(camera, cornea_center))
+				return false;
+
+			Vec3 refraction_point;
+			if (!calculate_refraction_point(cornea_center, pupil_center, camera_position, parameters.R, parameters.n1,
+				parameters.n2, refraction_point))
+				return false;
+			const Vec2 pupil_image = camera.wcs_to_ics(refraction_point);
+			if (!in_image(camera, pupil_image))
+				return false;
+			input.pupil_center = perturb(pupil_image, actual_noise.pupil_sigma);
+
+			input.glints.resize(parameters.light_positions.size());
+			for (size_t light_index = 0; light_index < parameters.light_positions.size(); light_index++)
+			{
+				const Vec3& light = parameters.light_positions[light_index];
+				const Vec3 q = calculate_reflection_point(cornea_center, parameters.R, light, camera_position);
+				// the cornea only covers the front of the sphere, and has to be lit
+				if (dot(q - cornea_center, optical_axis) <= 0 || dot(q - cornea_center, light - q) <= 0)
+					return false;
+				const Vec2 glint_image = camera.wcs_to_ics(q);
+				if (!in_image(camera, glint_image))
+					return false;
+
+				if (actual_noise.glint_dropout > 0 && unit(random) < actual_noise.glint_dropout)
+				{
+					input.glints[light_index] = make_vec2(-1, -1);
+				}
+				else
+				{
+					input.glints[light_index] = perturb(glint_image, actual_noise.glint_sigma);
+				}
+			}
+		}
+
+		if (truth)
+		{
+			truth->cornea_center = cornea_center;
+			truth->gaze_target = gaze_target;
+			truth->pupil_center = pupil_center;
+			truth->optical_axis = optical_axis;
+			truth->visual_axis = visual_axis;
+		}
+		return true;
+	}
+
+	void SyntheticFrameGenerator::next(PupilCenterGlintInputs& frame, SyntheticFrameTruth& truth)
+	{
+		const int max_draws = 1000;
+		const Scene& scene = actual_scene;
+		for (int draw = 0; draw < max_draws; draw++)
+		{
+			const Vec3 cornea_center = make_vec3(uniform(scene.eye_min[0], scene.eye_max[0]),
+				uniform(scene.eye_min[1], scene.eye_max[1]), uniform(scene.eye_min[2], scene.eye_max[2]));
+			const Vec3 gaze_target = make_vec3(uniform(scene.target_min[0], scene.target_max[0]),
+				uniform(scene.target_min[1], scene.target_max[1]), uniform(scene.target_min[2], scene.target_max[2]));
+			if (generate(cornea_center, gaze_target, frame, &truth))
+				return;
+		}
+		throw std::runtime_error("SyntheticFrameGenerator: no eye of the scene can be seen by all cameras.");
+	}
+
+	double SyntheticFrameGenerator::uniform(double min, double max)
+	{
+		return min + (max - min) * unit(random);
+	}
+
+	Vec2 SyntheticFrameGenerator::perturb(const Vec2& position, double sigma)
+	{
+		if (sigma <= 0)
+			return position;
+		return make_vec2(position[0] + sigma * normal(random), position[1] + sigma * normal(random));
+	}
+
+	size_t write_synthetic_recording(SyntheticFrameGenerator& generator, size_t num_frames, const char* filename)
+	{
+		const EyeAndCameraParameters& parameters = generator.parameters();
+		BinaryRecordingWriter writer(filename, static_cast<unsigned int>(parameters.cameras.size()),
+			static_cast<unsigned int>(parameters.light_positions.size()), true);
+
+		PupilCenterGlintInputs frame;
+		SyntheticFrameTruth truth;
+		for (size_t i = 0; i < num_frames; i++)
+		{
+			generator.next(frame, truth);
+			writer.write(frame, make_vec2(truth.gaze_target[0], truth.gaze_target[1]));
+		}
+
+		writer.finish();
+		return num_frames;
+	}
+
+}
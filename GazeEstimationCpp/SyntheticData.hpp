@@ -0,0 +1,105 @@
+#ifndef SYNTHETIC_DATA_HPP_INCLUDED
+#define SYNTHETIC_DATA_HPP_INCLUDED
+
+#include <random>
+
+#include "GazeEstimationTypes.hpp"
+
+/// The forward model of the spherical cornea model, from an eye in the scene to its pupil and glints in the images,
+/// to generate recordings for arbitrary setups of cameras and lights.
+namespace gazeestimation {
+
+	/// \brief Returns the point of reflection of the given light on the cornea as seen from the camera, where the normal
+	/// of the cornea bisects the directions to the light and the camera (the inverse of eq. 3.7).
+	Vec3 calculate_reflection_point(const Vec3& cornea_center, double R, const Vec3& light, const Vec3& camera_position);
+
+	/// \brief Finds the point of refraction on the cornea of the ray from the pupil center to the camera, so that
+	/// calculate_p applied to it gives pupil_center again. Returns false if there is none, e.g. as the pupil faces away
+	/// from the camera.
+	bool calculate_refraction_point(const Vec3& cornea_center, const Vec3& pupil_center, const Vec3& camera_position,
+		double R, double n1, double n2, Vec3& refraction_point);
+
+	/// \brief Returns the optical axis whose visual axis per calculate_visual_axis_unit_vector is the given one, the
+	/// inverse of calculate_visual_axis_unit_vector.
+	Vec3 calculate_optical_axis_unit_vector(const Vec3& visual_axis_unit_vector, const Vec3& nu_ecs);
+
+	/// The state of the eye a synthetic frame was generated from.
+	struct SyntheticFrameTruth
+	{
+		Vec3 cornea_center;
+		Vec3 gaze_target;
+		Vec3 pupil_center;
+		Vec3 optical_axis;
+		Vec3 visual_axis;
+	};
+
+	/// \brief Generates frames for the setup and eye of a set of parameters: one input per camera with one glint per light,
+	/// in the order of the lights, so the frames can be estimated with the same parameters. Image positions can be
+	/// perturbed with gaussian noise, and glints can be dropped (marked invalid) at random. Images are taken to extend
+	/// from 0 to twice the principal point, as that is usually at their center.
+	class SyntheticFrameGenerator
+	{
+	public:
+		/// Noise added to the image positions, in pixels.
+		struct Noise
+		{
+			double glint_sigma = 0;
+			double pupil_sigma = 0;
+			/// probability of each glint to be missing, as during a partial occlusion
+			double glint_dropout = 0;
+		};
+
+		/// The boxes next draws cornea centers and gaze targets from, uniformly. Give min and max the same z for
+		/// targets on a screen plane.
+		struct Scene
+		{
+			Vec3 eye_min;
+			Vec3 eye_max;
+			Vec3 target_min;
+			Vec3 target_max;
+		};
+
+		/// \brief Throws std::invalid_argument if the parameters have more cameras or lights than the inputs have room for.
+		/// The parameters are copied.
+		SyntheticFrameGenerator(const EyeAndCameraParameters& parameters, const Scene& scene, unsigned int seed = 0);
+
+		const EyeAndCameraParameters& parameters() const;
+
+		void set_noise(const Noise& noise);
+		const Noise& noise() const;
+
+		void set_scene(const Scene& scene);
+		const Scene& scene() const;
+
+		/// \brief Generates the frame of an eye with its cornea center at cornea_center that looks at gaze_target into
+		/// frame, reusing its storage. Returns false if the eye cannot be seen by every camera, e.g. as it looks away or
+		/// is outside of an image. truth receives the state of the eye unless it is null.
+		bool generate(const Vec3& cornea_center, const Vec3& gaze_target, PupilCenterGlintInputs& frame,
+			SyntheticFrameTruth* truth = nullptr);
+
+		/// \brief Generates a frame for a random eye position and gaze target of the scene, drawing again for eyes that
+		/// cannot be seen. Throws std::runtime_error if no eye of the scene could be seen in a number of draws.
+		void next(PupilCenterGlintInputs& frame, SyntheticFrameTruth& truth);
+
+	private:
+		double uniform(double min, double max);
+		Vec2 perturb(const Vec2& position, double sigma);
+
+		EyeAndCameraParameters actual_parameters;
+		Vec3 nu_ecs;
+		Noise actual_noise;
+		Scene actual_scene;
+
+		std::mt19937 random;
+		std::normal_distribution<double> normal;
+		std::uniform_real_distribution<double> unit;
+	};
+
+	/// \brief Writes num_frames frames drawn from generator into a binary recording, see BinaryRecordingWriter, with x and
+	/// y of the gaze targets as truth. Frames are written as they are generated, so recordings of any length can be
+	/// written. Returns num_frames.
+	size_t write_synthetic_recording(SyntheticFrameGenerator& generator, size_t num_frames, const char* filename);
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+#include "Telemetry.hpp"
+
+namespace gazeestimation {
+
+	namespace {
+		uint64_t to_ns(double us)
+		{
+			return static_cast<uint64_t>(us * 1e3 + 0.5);
+		}
+	}
+
+	void TelemetryCounters::record(const FrameTelemetry& telemetry, bool valid)
+	{
+		frames.fetch_add(1, std::memory_order_relaxed);
+		if (!valid)
+			invalid_frames.fetch_add(1, std::memory_order_relaxed);
+		const SolverTelemetry& solver = telemetry.solver;
+		if (solver.termination != SolverTelemetry::NotRun && solver.termination != SolverTelemetry::Converged)
+			not_converged.fetch_add(1, std::memory_order_relaxed);
+		if (solver.termination == SolverTelemetry::DeadlineExceeded)
+			deadline_exceeded.fetch_add(1, std::memory_order_relaxed);
+		if (solver.fell_back)
+			fallbacks.fetch_add(1, std::memory_order_relaxed);
+		if (solver.reused)
+			reused.fetch_add(1, std::memory_order_relaxed);
+		iterations.fetch_add(static_cast<uint64_t>(solver.iterations), std::memory_order_relaxed);
+		cornea_center_ns.fetch_add(to_ns(telemetry.cornea_center_us), std::memory_order_relaxed);
+		optic_axis_ns.fetch_add(to_ns(telemetry.optic_axis_us), std::memory_order_relaxed);
+		visual_axis_ns.fetch_add(to_ns(telemetry.visual_axis_us), std::memory_order_relaxed);
+	}
+
+	TelemetryTotals TelemetryCounters::totals() const
+	{
+		TelemetryTotals totals;
+		totals.frames = frames.load(std::memory_order_relaxed);
+		totals.invalid_frames = invalid_frames.load(std::memory_order_relaxed);
+		totals.not_converged = not_converged.load(std::memory_order_relaxed);
+		totals.deadline_exceeded = deadline_exceeded.load(std::memory_order_relaxed);
+		totals.fallbacks = fallbacks.load(std::memory_order_relaxed);
+		totals.reused = reused.load(std::memory_order_relaxed);
+		totals.iterations = iterations.load(std::memory_order_relaxed);
+		totals.cornea_center_us = cornea_center_ns.load(std::memory_order_relaxed) * 1e-3;
+		totals.optic_axis_us = optic_axis_ns.load(std::memory_order_relaxed) * 1e-3;
+		totals.visual_axis_us = visual_axis_ns.load(std::memory_order_relaxed) * 1e-3;
+		return totals;
+	}
+
+	void TelemetryCounters::reset()
+	{
+		frames.store(0, std::memory_order_relaxed);
+		invalid_frames.store(0, std::memory_order_relaxed);
+		not_converged.store(0, std::memory_order_relaxed);
+		deadline_exceeded.store(0, std::memory_order_relaxed);
+		fallbacks.store(0, std::memory_order_relaxed);
+		reused.store(0, std::memory_order_relaxed);
+		iterations.store(0, std::memory_order_relaxed);
+		cornea_center_ns.store(0, std::memory_order_relaxed);
+		optic_axis_ns.store(0, std::memory_order_relaxed);
+		visual_axis_ns.store(0, std::memory_order_relaxed);
+	}
+
+}
@@ -0,0 +1,144 @@
+#ifndef TELEMETRY_HPP_INCLUDED
+#define TELEMETRY_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace gazeestimation {
+
+	/// How the numerical solve for the cornea center of a frame went.
+	struct SolverTelemetry
+	{
+		enum Solver
+		{
+			/// no solve was attempted, e.g. because the frame was invalid
+			NoSolver = 0,
+			/// the fixed size solver for two glints or two lights with analytic derivatives
+			SpecializedSolver,
+			/// ceres, either configured or as the fallback of the specialized solver
+			CeresSolver,
+			/// the fixed iteration Gauss-Newton of a batched estimator, run for several frames at once
+			BatchedSolver
+		};
+
+		enum Termination
+		{
+			NotRun = 0,
+			Converged,
+			/// the iteration limit was reached, the solution may still be usable
+			NoConvergence,
+			/// the solver gave up, the solution is not usable
+			Failed,
+			/// the deadline of the SolverBudget was reached, the solution is the best iterate so far
+			DeadlineExceeded
+		};
+
+		/// the solver that produced the solution
+		Solver solver = NoSolver;
+		Termination termination = NotRun;
+		/// whether the specialized solver did not converge and ceres was run from the initial values instead
+		bool fell_back = false;
+		/// whether no solve was run as the solution of an earlier frame was reused, see OneCamSphericalGE::setCorneaCenterReuse
+		bool reused = false;
+		/// iterations of all solvers run for the frame
+		int iterations = 0;
+		/// 1/2 of the squared norm of the residuals at the solution
+		double final_cost = 0;
+
+		/// Whether the solve stopped at the iteration limit or the deadline before it converged, see SolverBudget.
+		bool budget_exhausted() const
+		{
+			return termination == NoConvergence || termination == DeadlineExceeded;
+		}
+	};
+
+	/// Telemetry of a single estimate. The stage durations are only measured if timing was enabled on the estimator
+	/// and are 0 otherwise.
+	struct FrameTelemetry
+	{
+		SolverTelemetry solver;
+		/// wall time of the stages in microseconds
+		double cornea_center_us = 0;
+		double optic_axis_us = 0;
+		double visual_axis_us = 0;
+	};
+
+	/// Measures the wall time of consecutive stages, does nothing if disabled so it can stay on the hot path.
+	class StageTimer
+	{
+	private:
+		typedef std::chrono::steady_clock Clock;
+		bool enabled;
+		Clock::time_point last;
+
+	public:
+		explicit StageTimer(bool enabled) : enabled(enabled)
+		{
+			if (enabled)
+				last = Clock::now();
+		}
+
+		/// Returns the microseconds since construction or the previous call, 0 if disabled.
+		double lap()
+		{
+			if (!enabled)
+				return 0;
+			const Clock::time_point now = Clock::now();
+			const double elapsed = std::chrono::duration<double, std::micro>(now - last).count();
+			last = now;
+			return elapsed;
+		}
+	};
+
+	/// \brief A copy of the values of TelemetryCounters, read one counter at a time, so frames recorded meanwhile may only
+	/// be counted in some of them, see TelemetryCounters::totals.
+	struct TelemetryTotals
+	{
+		uint64_t frames = 0;
+		uint64_t invalid_frames = 0;
+		uint64_t not_converged = 0;
+		/// the frames of not_converged that stopped at the deadline of their SolverBudget
+		uint64_t deadline_exceeded = 0;
+		uint64_t fallbacks = 0;
+		uint64_t reused = 0;
+		uint64_t iterations = 0;
+		double cornea_center_us = 0;
+		double optic_axis_us = 0;
+		double visual_axis_us = 0;
+	};
+
+	/// \brief Counters aggregated over all estimates of the estimators they are set on. Updated with relaxed atomics,
+	/// so they can be read while estimates run and shared between the clones estimate_batch makes.
+	class TelemetryCounters
+	{
+	public:
+		TelemetryCounters() = default;
+		TelemetryCounters(const TelemetryCounters&) = delete;
+		TelemetryCounters& operator=(const TelemetryCounters&) = delete;
+
+		/// Adds a frame with the given telemetry, valid is whether an estimate could be made.
+		void record(const FrameTelemetry& telemetry, bool valid);
+
+		/// Returns the current values. Counters of frames being recorded concurrently may be partially included.
+		TelemetryTotals totals() const;
+
+		void reset();
+
+	private:
+		std::atomic<uint64_t> frames{ 0 };
+		std::atomic<uint64_t> invalid_frames{ 0 };
+		std::atomic<uint64_t> not_converged{ 0 };
+		std::atomic<uint64_t> deadline_exceeded{ 0 };
+		std::atomic<uint64_t> fallbacks{ 0 };
+		std::atomic<uint64_t> reused{ 0 };
+		std::atomic<uint64_t> iterations{ 0 };
+		// in nanoseconds, as there is no atomic addition of doubles
+		std::atomic<uint64_t> cornea_center_ns{ 0 };
+		std::atomic<uint64_t> optic_axis_ns{ 0 };
+		std::atomic<uint64_t> visual_axis_ns{ 0 };
+	};
+
+}
+
+#endif
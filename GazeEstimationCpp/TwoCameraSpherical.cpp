@@ -4,9 +4,17 @@
 // https://tspace.library.utoronto.ca/handle/1807/24349
 #include "TwoCameraSpherical.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Cholesky>
+
 #include <ceres/ceres.h>
 
 #include "PinholeCameraModel.hpp"
+#include "SolverUtils.hpp"
+#include "TwoCameraSphericalScalar.hpp"
 #include "Utils.hpp"
 #include "SharedCalculations.hpp"
 
@@ -21,9 +29,9 @@ namespace gazeestimation {
 		double scale_r;
 
 	public:
-		/// \param	glints	List of glints so that glint i of camera j is at index j * glints_per_camera + i 
-		/// \param	lights	List of the positions of the lights. The number and ordering of the lights must match the glints.
-		/// \param	camera_positions	The positions of the cameras.
+		/// \param	glints	List of the valid glints of all cameras in WCS, camera by camera
+		/// \param	lights	The position of the light of each glint.
+		/// \param	camera_positions	The position of the camera of each glint.
 		/// \param	scale_r	A scaling factor for R. The true R used by this is variable_R / scale_R.
 		ROptimizingCorneaDistance(const std::vector<Vec3>& glints,
 									const std::vector<Vec3>& lights, 
@@ -33,203 +41,636 @@ namespace gazeestimation {
 
 		bool operator()(double const* const* variables, double* residual) const {
 			double R =  *variables[0]/ scale_r;
-			const unsigned int glints_per_camera = lights.size();
 
 			// calculate the cornea centers that result from each of the glints under these variables
-			// i and j swapped here to match the notation in the text
 			std::vector<Vec3> cornea_centers;
-			for(unsigned int j = 0; j < camera_positions.size(); j++)
+			cornea_centers.reserve(glints.size());
+			for(unsigned int i = 0; i < glints.size(); i++)
 			{
-				const Vec3 camera_position = camera_positions[j];
-				for(unsigned int i = 0; i < lights.size(); i++)
-				{
-					// k_i = *variables[1+i] 
-					Vec3 q_ij = camera_position + *variables[1 + j * glints_per_camera + i] * normalized(camera_position - glints[j * glints_per_camera + i]);
-					Vec3 c_ij = q_ij - R *  normalized(normalized(lights[i] - q_ij) + normalized(camera_position - q_ij));
-					cornea_centers.push_back(c_ij);
-				}
+				// k_i = *variables[1+i] 
+				const Vec3 q_ij = calculate_q(*variables[1 + i], camera_positions[i], glints[i]);
+				cornea_centers.push_back(calculate_cornea_center(q_ij, lights[i], camera_positions[i], R));
 			}
 
-			//TODO: only use unique pairs here.
-			for(unsigned int i = 0; i < cornea_centers.size(); i++)
+			cornea_center_differences(cornea_centers.data(), cornea_centers.size(), residual);
+						
+			return true;
+		}
+	};
+
+	/// \brief Same as ROptimizingCorneaDistance with the residuals between the cornea center resulting from each glint and
+	/// a common center, which is the average of the cornea centers at the solution, so R and the ks are the same from
+	/// 3 residuals per glint instead of a number that grows with the square of the glints. Expects the common center in
+	/// the parameter block after those of the ks.
+	class ROptimizingCommonCenterDistance
+	{
+	private:
+		const std::vector<Vec3>& glints;
+		const std::vector<Vec3>& lights;
+		const std::vector<Vec3>& camera_positions;
+		double scale_r;
+
+	public:
+		/// The parameters are the same as for ROptimizingCorneaDistance.
+		ROptimizingCommonCenterDistance(const std::vector<Vec3>& glints,
+									const std::vector<Vec3>& lights, 
+									const std::vector<Vec3>& camera_positions,
+									double scale_r)
+			: glints(glints), lights(lights), camera_positions(camera_positions), scale_r(scale_r){}
+
+		bool operator()(double const* const* variables, double* residual) const {
+			double R =  *variables[0]/ scale_r;
+
+			std::vector<Vec3> cornea_centers;
+			cornea_centers.reserve(glints.size());
+			for(unsigned int i = 0; i < glints.size(); i++)
 			{
-				for(unsigned int j = 0; j < cornea_centers.size(); j++)
-				{
-					residual[i * cornea_centers.size() + j] = squared_length(cornea_centers[i] - cornea_centers[j]);
-				}
+				const Vec3 q_ij = calculate_q(*variables[1 + i], camera_positions[i], glints[i]);
+				cornea_centers.push_back(calculate_cornea_center(q_ij, lights[i], camera_positions[i], R));
 			}
+
+			cornea_center_deviations(cornea_centers.data(), cornea_centers.size(), variables[1 + glints.size()], residual);
 						
 			return true;
 		}
 	};
 
-	/// Calculates the cornea center using the methods detailed on p. 74f, employing eq. 3.23
-	/// This does not need a previously calibrated R, or any specific setup, but does minimize numerically.
-	Vec3 calculate_cornea_center_no_R(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters, double& r_out)
+	/// \brief Returns the numerically differentiated cost function of functor for R and one k per glint, with a block of 3
+	/// for the common center after those if common_center.
+	template <typename Functor>
+	ceres::CostFunction* make_no_R_cost_function(Functor* functor, size_t num_glints, bool common_center)
 	{
-		const double scale_R = 100;
-		// reformulate some of the inputs in the interest of keeping the cost functor simpler
-		// the glints are handed over as [camera1 glint1, camera 1 glint2, ..., camera 2 glint 1 ...]
-		std::vector<Vec3> glints;
-		std::vector<Vec3> camera_positions;
-		for(unsigned int i = 0; i < parameters.cameras.size(); i++)
+		auto cost_function = new ceres::DynamicNumericDiffCostFunction<Functor, ceres::CENTRAL>(functor);
+
+		cost_function->AddParameterBlock(1);
+		for (unsigned int i = 0; i < num_glints; i++)
+		{
+			cost_function->AddParameterBlock(1);
+		}
+
+		if (common_center)
 		{
-			for (const auto& glint : data.data[i].glints)
+			cost_function->AddParameterBlock(3);
+			cost_function->SetNumResiduals(static_cast<int>(3 * num_glints));
+		}
+		else
+		{
+			cost_function->SetNumResiduals(static_cast<int>(3 * (num_glints * num_glints - num_glints) / 2));
+		}
+		return cost_function;
+	}
+
+	/// \brief The ceres problem for R and the k_ij with a fixed number of glints and residuals. It is built once, with its
+	/// cost function, parameter blocks and bounds, and rebound to the glints, their lights and their cameras of each frame
+	/// it solves.
+	class NoRProblem
+	{
+	public:
+		NoRProblem(size_t num_glints, TwoCamSphericalGE::CorneaResiduals residuals, double scale_r) :
+			residuals(residuals),
+			scale_r(scale_r),
+			glints(num_glints),
+			lights(num_glints),
+			camera_positions(num_glints),
+			ks(glints.size())
+		{
+			const bool common_center = residuals == TwoCamSphericalGE::CommonCenterResiduals;
+			ceres::CostFunction* cost_function = common_center
+				? make_no_R_cost_function(new ROptimizingCommonCenterDistance(glints, lights, camera_positions, scale_r),
+					glints.size(), true)
+				: make_no_R_cost_function(new ROptimizingCorneaDistance(glints, lights, camera_positions, scale_r),
+					glints.size(), false);
+
+			std::vector<double*> variables;
+			variables.push_back(&R);
+			for (unsigned int i = 0; i < glints.size(); i++) {
+				variables.push_back(&ks[i]);
+			}
+			if (common_center)
 			{
-				glints.emplace_back(parameters.cameras[i].ics_to_wcs(glint));
+				variables.push_back(center.data());
+			}
+
+			problem.AddResidualBlock(cost_function, nullptr, variables);
+			problem.SetParameterLowerBound(&R, 0, 0.3*scale_r);
+			problem.SetParameterUpperBound(&R, 0, 2* scale_r);
+
+			for (unsigned int i = 0; i < glints.size(); i++) {
+				problem.SetParameterLowerBound(variables[1 + i], 0, 2);
+				problem.SetParameterUpperBound(variables[1 + i], 0, 400);		
 			}
-			camera_positions.push_back(parameters.cameras[i].position);
-		}
 
+			options.minimizer_progress_to_stdout = false;
+			options.linear_solver_type = ceres::DENSE_QR;
+			options.max_num_iterations = default_max_iterations;
+		}
 
-		auto distance_corneas = new ROptimizingCorneaDistance(glints, parameters.light_positions, camera_positions, scale_R);
+		NoRProblem(const NoRProblem&) = delete;
+		NoRProblem& operator=(const NoRProblem&) = delete;
 
-		ceres::Problem problem; 
-		auto cost_function = new ceres::DynamicNumericDiffCostFunction<ROptimizingCorneaDistance, ceres::CENTRAL>(distance_corneas);
+		bool matches(size_t num_glints, TwoCamSphericalGE::CorneaResiduals other_residuals) const
+		{
+			return glints.size() == num_glints && residuals == other_residuals;
+		}
 
+		static const int default_max_iterations = 1000;
 
-		cost_function->AddParameterBlock(1);
-		for (unsigned int i = 0; i < glints.size(); i++)
+		/// \brief Solves for R and the k_ij of the frame, which must have as many glints as this problem, with the light and
+		/// the camera position of each glint. r and frame_ks hold the initial values and receive the result. Returns whether the solution is usable. The solve
+		/// is limited by budget and stops at deadline. Records the summary in telemetry.
+		bool solve(const std::vector<Vec3>& frame_glints, const std::vector<Vec3>& frame_lights, 
+			const std::vector<Vec3>& frame_camera_positions, double& r, std::vector<double>& frame_ks, const SolverBudget& budget,
+			SolverBudget::Clock::time_point deadline, SolverTelemetry& telemetry)
 		{
-			cost_function->AddParameterBlock(1);
+			std::copy(frame_glints.begin(), frame_glints.end(), glints.begin());
+			std::copy(frame_lights.begin(), frame_lights.end(), lights.begin());
+			std::copy(frame_camera_positions.begin(), frame_camera_positions.end(), camera_positions.begin());
+			std::copy(frame_ks.begin(), frame_ks.end(), ks.begin());
+
+			// the common center starts at the average of the cornea centers for the initial values
+			if (residuals == TwoCamSphericalGE::CommonCenterResiduals)
+			{
+				center = make_vec3(0, 0, 0);
+				for (unsigned int i = 0; i < glints.size(); i++)
+				{
+					const Vec3 q_ij = calculate_q(ks[i], camera_positions[i], glints[i]);
+					center += calculate_cornea_center(q_ij, lights[i], camera_positions[i], r);
+				}
+				center /= static_cast<double>(glints.size());
+			}
+
+			R = r*scale_r; // scale the R for the cost function
+
+			apply_solver_budget(budget, default_max_iterations, deadline, options);
+			ceres::Solver::Summary summary;
+			Solve(options, &problem, &summary);
+			record_ceres_summary(summary, telemetry, deadline);
+			r = R / scale_r;
+			std::copy(ks.begin(), ks.end(), frame_ks.begin());
+			return summary.IsSolutionUsable();
 		}
 
+	private:
+		const TwoCamSphericalGE::CorneaResiduals residuals;
+		const double scale_r;
+		/// the parameter blocks and the data the cost function refers to, per glint, rebound for each solve
+		std::vector<Vec3> glints;
+		std::vector<Vec3> lights;
+		std::vector<Vec3> camera_positions;
+		double R = 0;
+		std::vector<double> ks;
+		Vec3 center = make_vec3(0, 0, 0);
 
-		cost_function->SetNumResiduals(glints.size() * glints.size());
+		ceres::Problem problem;
+		ceres::Solver::Options options;
+	};
 
-		double R = parameters.R*scale_R; // scale the R for the cost function
-		std::unique_ptr<double> ks(new double[glints.size()]);
-		
-		std::vector<double*> variables;
-		variables.push_back(&R);
-		for (unsigned int i = 0; i < glints.size(); i++) {
-			ks.get()[i] = parameters.distance_to_camera_estimate;
-			variables.push_back(&ks.get()[i]);
+	class NoRProblems
+	{
+	public:
+		/// The problem for the number of glints and residuals, built on first use.
+		NoRProblem& problem(size_t num_glints, TwoCamSphericalGE::CorneaResiduals residuals, double scale_r)
+		{
+			for (const auto& problem : problems)
+			{
+				if (problem->matches(num_glints, residuals))
+					return *problem;
+			}
+			problems.emplace_back(new NoRProblem(num_glints, residuals, scale_r));
+			return *problems.back();
 		}
 
-		problem.AddResidualBlock(cost_function, nullptr, variables);
-		problem.SetParameterLowerBound(&R, 0, 0.3*scale_R);
-		problem.SetParameterUpperBound(&R, 0, 2* scale_R);
+		/// The valid glints of the frame in WCS with the positions of their lights and cameras and their k_ij, reused
+		/// across frames.
+		std::vector<Vec3> glints;
+		std::vector<Vec3> lights;
+		std::vector<Vec3> camera_positions;
+		std::vector<double> ks;
+
+		/// The budget of the frame being solved and the point in time its solve has to stop, set by the estimator.
+		SolverBudget budget;
+		SolverBudget::Clock::time_point deadline = SolverBudget::Clock::time_point::max();
 
-		for (unsigned int i = 0; i < glints.size(); i++) {
-			problem.SetParameterLowerBound(variables[i], 0, 2);
-			problem.SetParameterUpperBound(variables[i], 0, 400);		
+	private:
+		std::vector<std::unique_ptr<NoRProblem>> problems;
+	};
+
+	/// Calculates the cornea center using the methods detailed on p. 74f, employing eq. 3.23
+	/// This does not need a previously calibrated R, or any specific setup, but does minimize numerically.
+	/// Each camera must have a glint per light, in the order of the lights. Only the valid glints are used.
+	/// \param	r	The initial value for R, receives the estimated R.
+	/// \param	ks	The initial values for k_ij per glint of all cameras, camera by camera, NaN where unknown, receives the 
+	///				solution, NaN for the invalid glints. If this does not hold a value per glint, the initial values are
+	///				taken from parameters.distance_to_camera_estimate.
+	/// \param	usable	Receives whether the solution is usable.
+	/// \param	telemetry	Receives how the solve went.
+	/// \param	problems	If not null, the problems, buffers and budget reused across frames, otherwise the problem is built
+	///						for this frame only, without a budget.
+	Vec3 calculate_cornea_center_no_R(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters, 
+		TwoCamSphericalGE::CorneaCenterSolver solver, TwoCamSphericalGE::CorneaResiduals residuals, double& r,
+		std::vector<double>& ks, bool& usable, SolverTelemetry& telemetry, NoRProblems* problems)
+	{
+		const double scale_R = 100;
+		const size_t num_lights = parameters.light_positions.size();
+		const size_t num_all_glints = parameters.cameras.size() * num_lights;
+		const bool use_ks = ks.size() == num_all_glints;
+
+		// reformulate some of the inputs in the interest of keeping the cost functor simpler
+		// the valid glints are handed over as [camera1 glint1, camera 1 glint2, ..., camera 2 glint 1 ...], each with the
+		// position of its light and camera
+		std::vector<Vec3> frame_glints;
+		std::vector<Vec3> frame_lights;
+		std::vector<Vec3> frame_camera_positions;
+		std::vector<double> frame_selected_ks;
+		std::vector<Vec3>& glints = problems ? problems->glints : frame_glints;
+		std::vector<Vec3>& lights = problems ? problems->lights : frame_lights;
+		std::vector<Vec3>& camera_positions = problems ? problems->camera_positions : frame_camera_positions;
+		std::vector<double>& selected_ks = problems ? problems->ks : frame_selected_ks;
+		glints.clear();
+		lights.clear();
+		camera_positions.clear();
+		selected_ks.clear();
+		for(unsigned int j = 0; j < parameters.cameras.size(); j++)
+		{
+			const PupilCenterGlintInput::Glints& camera_glints = data.data[j].glints;
+			Vec3 all_glints_wcs[max_glints_per_camera];
+			parameters.cameras[j].ics_to_wcs(camera_glints.begin(), camera_glints.end(), all_glints_wcs);
+			for (unsigned int i = 0; i < num_lights; i++)
+			{
+				if (!glintValid(camera_glints[i]))
+					continue;
+				const double k = use_ks ? ks[j * num_lights + i] : std::numeric_limits<double>::quiet_NaN();
+				glints.push_back(all_glints_wcs[i]);
+				lights.push_back(parameters.light_positions[i]);
+				camera_positions.push_back(parameters.cameras[j].position());
+				selected_ks.push_back(std::isfinite(k) ? k : parameters.distance_to_camera_estimate);
+			}
 		}
 
-		ceres::Solver::Options options;
-		options.minimizer_progress_to_stdout = false;
-		options.linear_solver_type = ceres::DENSE_QR;
-		options.max_num_iterations = 1000;
-		
-		ceres::Solver::Summary summary;
-		Solve(options, &problem, &summary);
+		double R = r;
+		usable = false;
+		telemetry = SolverTelemetry();
+		// with all glints valid, the glints are ordered and paired with the lights and cameras as the solver expects
+		if (solver == TwoCamSphericalGE::TwoLightSolver && parameters.cameras.size() == 2 && num_lights == 2 
+			&& glints.size() == 4)
+		{
+			const std::vector<double> initial_ks = selected_ks;
+			const Vec3 solver_camera_positions[2] = { parameters.cameras[0].position(), parameters.cameras[1].position() };
+			usable = solve_two_camera_two_light(glints.data(), parameters.light_positions.data(), solver_camera_positions, R,
+				selected_ks.data(), telemetry);
+			if (usable)
+			{
+				telemetry.solver = SolverTelemetry::SpecializedSolver;
+				telemetry.termination = SolverTelemetry::Converged;
+			}
+			else
+			{
+				R = r;
+				selected_ks = initial_ks;
+				telemetry.fell_back = true;
+			}
+		}
 
+		if (!usable)
+		{
+			if (problems)
+			{
+				usable = problems->problem(glints.size(), residuals, scale_R).solve(glints, lights, camera_positions, R, selected_ks,
+					problems->budget, problems->deadline, telemetry);
+			}
+			else
+			{
+				NoRProblem problem(glints.size(), residuals, scale_R);
+				usable = problem.solve(glints, lights, camera_positions, R, selected_ks, SolverBudget(),
+					SolverBudget::Clock::time_point::max(), telemetry);
+			}
+		}
 
 		// calculate the cornea centers that result from each of the glints under these variables
-		// i and j swapped here to match the notation in the text
 		Vec3 cornea_center = make_vec3(0, 0, 0); 
-		const unsigned int num_glints = parameters.light_positions.size();
-		R = R / scale_R;
-		for (unsigned int j = 0; j < camera_positions.size(); j++)
+		for (unsigned int i = 0; i < glints.size(); i++)
 		{
-			const Vec3 camera_position = camera_positions[j];
-			for (unsigned int i = 0; i < parameters.light_positions.size(); i++)
+			const Vec3 q_ij = calculate_q(selected_ks[i], camera_positions[i], glints[i]);
+			cornea_center += calculate_cornea_center(q_ij, lights[i], camera_positions[i], R);
+		}
+
+		cornea_center /= static_cast<double>(glints.size());
+
+		ks.assign(num_all_glints, std::numeric_limits<double>::quiet_NaN());
+		size_t index = 0;
+		for (unsigned int j = 0; j < parameters.cameras.size(); j++)
+		{
+			for (unsigned int i = 0; i < num_lights; i++)
 			{
-				// k_i = *variables[1+i] 
-				Vec3 q_ij = camera_position + ks.get()[j * num_glints + i] * normalized(camera_position - glints[j * num_glints + i]);
-				Vec3 c_ij = q_ij - R *  normalized(normalized(parameters.light_positions[i] - q_ij) + normalized(camera_position - q_ij));
-				cornea_center += c_ij;
+				if (glintValid(data.data[j].glints[i]))
+					ks[j * num_lights + i] = selected_ks[index++];
 			}
 		}
-
-		cornea_center /= glints.size();
 		
-		r_out = R;
+		r = R;
 
 		return cornea_center;
 	}
 
-	/// Calculates optic axis per section 3.3.1 (without relying on any eye parameters, with explicit refraction model).
-	/// only works as long as eye optic axis has no intersection with line between camera_position1 and camera_position2
-	Vec3 calculate_optic_axis_unit_vector_explicit_refraction_i(const Vec3& camera1_pos, const Vec3& camera2_pos, 
-						const Vec3& cornea_center, const Vec3& pupil1_image_wcs, const Vec3& pupil2_image_wcs)
+	/// The stages of the latest estimate of an input, each with the parameters it was computed with.
+	struct TwoCamSphericalGE::StageCache : EstimationCache
+	{
+		bool has_cornea_center = false;
+		std::vector<PinholeCameraModel> cameras;
+		std::vector<Vec3> light_positions;
+		double R = 0;
+		double distance_to_camera_estimate = 0;
+		Vec3 cornea_center;
+		double estimated_R = 0;
+		SolverTelemetry solver;
+
+		bool has_optic_axis = false;
+		double n1 = 0;
+		double n2 = 0;
+		Vec3 optic_axis;
+
+		bool cornea_center_valid_for(const EyeAndCameraParameters& parameters) const
+		{
+			return has_cornea_center && cameras == parameters.cameras && light_positions == parameters.light_positions
+				&& R == parameters.R && distance_to_camera_estimate == parameters.distance_to_camera_estimate;
+		}
+
+		void set_cornea_center(const EyeAndCameraParameters& parameters, const Vec3& center, double center_R, 
+			const SolverTelemetry& telemetry)
+		{
+			has_cornea_center = true;
+			cameras = parameters.cameras;
+			light_positions = parameters.light_positions;
+			R = parameters.R;
+			distance_to_camera_estimate = parameters.distance_to_camera_estimate;
+			cornea_center = center;
+			estimated_R = center_R;
+			solver = telemetry;
+			has_optic_axis = false;
+		}
+
+		bool optic_axis_valid_for(const EyeAndCameraParameters& parameters) const
+		{
+			return has_optic_axis && n1 == parameters.n1 && n2 == parameters.n2;
+		}
+
+		void set_optic_axis(const EyeAndCameraParameters& parameters, const Vec3& axis)
+		{
+			has_optic_axis = true;
+			n1 = parameters.n1;
+			n2 = parameters.n2;
+			optic_axis = axis;
+		}
+	};
+
+	TwoCamSphericalGE::TwoCamSphericalGE(OpticAxisReconstructionMethod method, CorneaCenterSolver cornea_center_solver): 
+	optic_axis_method(method),
+	cornea_center_solver(cornea_center_solver)
 	{
 		
-		Vec3 optic_axis = normalized(cross_product(
-			cross_product(camera1_pos - pupil1_image_wcs, cornea_center - camera1_pos),
-			cross_product(camera2_pos - pupil2_image_wcs, cornea_center - camera2_pos)));
+	}
 
-		// there are two possible results here, make sure we choose the one that points outside of the eye in the correct direction. As our scene plane is at z=0
-		if (cornea_center[2] > 0 && optic_axis[2] > 0)
-			optic_axis = -optic_axis;
+	void TwoCamSphericalGE::setCorneaResiduals(CorneaResiduals residuals)
+	{
+		cornea_residuals = residuals;
+	}
 
-		return optic_axis;
+	void TwoCamSphericalGE::setSolverBudget(const SolverBudget& budget)
+	{
+		solver_budget = budget;
 	}
 
-	const Vec3 calculate_optic_axis_unit_vector_explicit_refraction_ii(const PupilCenterGlintInputs& data,
-		const EyeAndCameraParameters& parameters, const Vec3& cornea_center, double R)
+	void TwoCamSphericalGE::setTracking(bool enabled)
 	{
-		std::vector<Vec3> iotas;
-		std::vector<Vec3> rs;
-		for (unsigned int i = 0; i < parameters.cameras.size(); i++)
+		tracking = enabled;
+		resetTracking();
+	}
+
+	void TwoCamSphericalGE::Session::setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters)
+	{
+		telemetry_counters = std::move(counters);
+	}
+
+	void TwoCamSphericalGE::Session::resetTracking()
+	{
+		tracked_R = std::numeric_limits<double>::quiet_NaN();
+		tracked_ks.clear();
+	}
+
+	void TwoCamSphericalGE::resetTracking()
+	{
+		own_session.resetTracking();
+	}
+
+	void TwoCamSphericalGE::setStageTiming(bool enabled)
+	{
+		stage_timing = enabled;
+	}
+
+	void TwoCamSphericalGE::setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters)
+	{
+		telemetry_counters = std::move(counters);
+	}
+
+	std::unique_ptr<TwoCamSphericalGE::GazeEstimationMethod> TwoCamSphericalGE::clone() const
+	{
+		return std::unique_ptr<GazeEstimationMethod>(new TwoCamSphericalGE(*this));
+	}
+
+	DefaultGazeEstimationResult TwoCamSphericalGE::estimate(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters)
+	{
+		return estimate(data, PreparedParameters(parameters));
+	}
+
+	void TwoCamSphericalGE::estimate_range(const PupilCenterGlintInputs* first, const PupilCenterGlintInputs* last, 
+		DefaultGazeEstimationResult* results, const EyeAndCameraParameters& parameters)
+	{
+		const PreparedParameters prepared(parameters);
+		for (; first != last; ++first, ++results)
 		{
-			const Vec3 pupil_wcs = parameters.cameras[i].ics_to_wcs(data.data[i].pupil_center);
-			//std::cout << "-> "<< pupil_wcs << std::endl;
-			iotas.push_back(normalized(calculate_iota(parameters.cameras[i].position, pupil_wcs, cornea_center, R, parameters.n1, parameters.n2)));
-			rs.push_back(calculate_r(parameters.cameras[i].position, pupil_wcs, cornea_center, R));
+			*results = estimate(*first, prepared);
 		}
+	}
 
-		Vec3 pupil_center = shortest_line_segment(rs[0], iotas[0], rs[1], iotas[1]);
-		return normalized(pupil_center - cornea_center);
+	DefaultGazeEstimationResult TwoCamSphericalGE::estimate(const PupilCenterGlintInputs& data, const PreparedParameters& prepared)
+	{
+		const DefaultGazeEstimationResult result = estimate_frame(data, prepared, nullptr, own_session);
+		record(result, own_session);
+		return result;
 	}
 
-	TwoCamSphericalGE::TwoCamSphericalGE(OpticAxisReconstructionMethod method): 
-	optic_axis_method(method)
+	std::unique_ptr<EstimationCache> TwoCamSphericalGE::make_cache() const
 	{
-		
+		return std::unique_ptr<EstimationCache>(new StageCache());
 	}
 
-	DefaultGazeEstimationResult TwoCamSphericalGE::estimate(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters)
+	DefaultGazeEstimationResult TwoCamSphericalGE::estimate_cached(const PupilCenterGlintInputs& data,
+		const EyeAndCameraParameters& parameters, EstimationCache& cache)
+	{
+		if (tracking)
+			return estimate(data, parameters);
+
+		const DefaultGazeEstimationResult result = estimate_frame(data, PreparedParameters(parameters), &static_cast<StageCache&>(cache),
+			own_session);
+		record(result, own_session);
+		return result;
+	}
+
+	std::unique_ptr<EstimationSession> TwoCamSphericalGE::make_session() const
+	{
+		return std::unique_ptr<EstimationSession>(new Session());
+	}
+
+	DefaultGazeEstimationResult TwoCamSphericalGE::estimate_in_session(const PupilCenterGlintInputs& data,
+		const EyeAndCameraParameters& parameters, EstimationSession& session) const
+	{
+		Session& own = static_cast<Session&>(session);
+		const DefaultGazeEstimationResult result = estimate_frame(data, PreparedParameters(parameters), nullptr, own);
+		record(result, own);
+		return result;
+	}
+
+	void TwoCamSphericalGE::record(const DefaultGazeEstimationResult& result, const Session& session) const
+	{
+		TelemetryCounters* counters = session.telemetry_counters ? session.telemetry_counters.get() : telemetry_counters.get();
+		if (counters)
+		{
+			counters->record(result.telemetry, result.is_valid);
+		}
+	}
+
+	DefaultGazeEstimationResult TwoCamSphericalGE::estimate_frame(const PupilCenterGlintInputs& data, const PreparedParameters& prepared,
+		StageCache* cache, Session& session) const
 	{
-		if (parameters.cameras.size() != 2)
+		const EyeAndCameraParameters& parameters = prepared.parameters();
+		const size_t num_cameras = data.data.size();
+		if (num_cameras < 2)
 		{
-			throw std::exception("this method can only handle a single camera");
+			session.resetTracking();
+			return DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfInputs);
 		}
 
-		double estimated_R = parameters.R;
-		const Vec3 cornea_center = calculate_cornea_center_no_R(data, parameters, estimated_R);
+		if (parameters.cameras.size() != num_cameras)
+		{
+			session.resetTracking();
+			return DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfCameras);
+		}
+
+		for (const auto& camera_data : data.data)
+		{
+			if (camera_data.glints.size() != parameters.light_positions.size())
+			{
+				session.resetTracking();
+				return DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::WrongNumberOfGlints);
+			}
+
+			int valid_glints = 0;
+			for (const auto& glint : camera_data.glints)
+			{
+				if (glintValid(glint))
+					valid_glints++;
+			}
 
-		const Vec3 pupil1_image_wcs = parameters.cameras[0].ics_to_wcs(data.data[0].pupil_center);
-		const Vec3 pupil2_image_wcs = parameters.cameras[1].ics_to_wcs(data.data[1].pupil_center);
+			if (valid_glints < 2)
+			{
+				session.resetTracking();
+				return DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::NotEnoughValidGlints);
+			}
+		}
+
+		const bool use_tracked_solution = tracking && std::isfinite(session.tracked_R);
+		double estimated_R = use_tracked_solution ? session.tracked_R : parameters.R;
+		std::vector<double> ks;
+		if (use_tracked_solution)
+		{
+			ks.swap(session.tracked_ks);
+		}
+
+		FrameTelemetry telemetry;
+		StageTimer timer(stage_timing);
+
+		Vec3 cornea_center;
+		if (cache && cache->cornea_center_valid_for(parameters))
+		{
+			cornea_center = cache->cornea_center;
+			estimated_R = cache->estimated_R;
+			telemetry.solver = cache->solver;
+		}
+		else
+		{
+			bool usable = false;
+			NoRProblems& problems = session.no_R_problems.get();
+			problems.budget = solver_budget;
+			problems.deadline = solver_budget.deadline();
+			cornea_center = calculate_cornea_center_no_R(data, parameters, cornea_center_solver, cornea_residuals, estimated_R, ks, usable, 
+				telemetry.solver, &problems);
+
+			if (!usable)
+			{
+				session.resetTracking();
+				DefaultGazeEstimationResult failed = DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::SolverFailed);
+				failed.telemetry = telemetry;
+				return failed;
+			}
+
+			if (cache)
+			{
+				cache->set_cornea_center(parameters, cornea_center, estimated_R, telemetry.solver);
+			}
+			else if (tracking)
+			{
+				session.tracked_R = estimated_R;
+				session.tracked_ks.swap(ks);
+			}
+		}
+
+		telemetry.cornea_center_us = timer.lap();
+
+		// up to max_cameras, on the stack
+		Vec3 camera_positions[max_cameras];
+		Vec3 pupil_images_wcs[max_cameras];
+		for (size_t i = 0; i < num_cameras; i++)
+		{
+			camera_positions[i] = parameters.cameras[i].position();
+			pupil_images_wcs[i] = parameters.cameras[i].ics_to_wcs(data.data[i].pupil_center);
+		}
 
 		Vec3 optic_axis_unit_vector = make_vec3(0, 0, 0);
-		if(optic_axis_method == ExplicitRefraction1){
+		if (cache && cache->optic_axis_valid_for(parameters))
+		{
+			optic_axis_unit_vector = cache->optic_axis;
+		}
+		else if(optic_axis_method == ExplicitRefraction1){
 			optic_axis_unit_vector = calculate_optic_axis_unit_vector_explicit_refraction_i(
-				parameters.cameras[0].position,
-				parameters.cameras[1].position,
-				cornea_center,
-				pupil1_image_wcs,
-				pupil2_image_wcs
+				camera_positions, pupil_images_wcs, num_cameras, cornea_center
 			);
 		}
 		else if (optic_axis_method == ExplicitRefraction2)
 		{
 			optic_axis_unit_vector = calculate_optic_axis_unit_vector_explicit_refraction_ii(
-				data, parameters, cornea_center, estimated_R
-			);			
+				camera_positions, pupil_images_wcs, num_cameras, cornea_center, estimated_R, prepared.eye().refraction
+			);
 		}
 		else
 		{
-			return DefaultGazeEstimationResult::make_error("configured optic axis reconstruction method does not exist.");
+			return DefaultGazeEstimationResult::make_error(DefaultGazeEstimationResult::InvalidConfiguration);
+		}
+
+		if (cache && !cache->optic_axis_valid_for(parameters))
+		{
+			cache->set_optic_axis(parameters, optic_axis_unit_vector);
 		}
+		telemetry.optic_axis_us = timer.lap();
 		
-		const Vec3 visual_axis_unit_vector = calculate_visual_axis_unit_vector(optic_axis_unit_vector, parameters.alpha, parameters.beta);
+		const Vec3 visual_axis_unit_vector = calculate_visual_axis_unit_vector(optic_axis_unit_vector, prepared.nu_ecs());
+		telemetry.visual_axis_us = timer.lap();
 		
 		DefaultGazeEstimationResult result;
 		result.is_valid = true;
 		result.center_of_cornea = cornea_center;
 		result.optical_axis = optic_axis_unit_vector;
 		result.visual_axis = visual_axis_unit_vector;
+		result.telemetry = telemetry;
 		return result;
 	}
 
@@ -6,11 +6,21 @@
 #ifndef TWO_CAMERA_SPHERICAL_HPP_INCLUDED
 #define TWO_CAMERA_SPHERICAL_HPP_INCLUDED
 
+#include <limits>
+
 #include "GazeEstimationTypes.hpp"
+#include "PreparedParameters.hpp"
+#include "SolverContext.hpp"
 
 namespace gazeestimation {
 
+	/// The ceres problems for R and the k_ij of an estimator, defined in TwoCameraSpherical.cpp.
+	class NoRProblems;
+
 
+	/// \brief Stereo gaze estimation with two or more cameras, up to max_cameras, that each see the glints of all lights.
+	/// The inputs and the cameras of the parameters must be in the same order, and each input must have a glint per light,
+	/// in the order of the lights, marked invalid where it was not found.
 	class TwoCamSphericalGE : public GazeEstimationMethod<EyeAndCameraParameters, PupilCenterGlintInputs, DefaultGazeEstimationResult>
 	{
 	public:
@@ -20,11 +30,126 @@ namespace gazeestimation {
 			ExplicitRefraction2
 		};
 
-		explicit TwoCamSphericalGE(OpticAxisReconstructionMethod method);
+		/// Available methods for finding R and the distances of the points of reflection from the cameras.
+		enum CorneaCenterSolver
+		{
+			/// Numerical minimization with ceres, works for any number of lights.
+			GenericSolver = 0,
+			/// With exactly two cameras and two lights, a few Levenberg-Marquardt iterations on the fixed size problem with analytic 
+			/// derivatives. Falls back to the generic solver if those do not converge or there are more cameras or lights.
+			TwoLightSolver
+		};
+
+		/// \brief The residuals the generic solver minimizes for R and the distances. Both have the same solution, the cost
+		/// of the common center residuals is that of the pairwise ones divided by the number of glints.
+		enum CorneaResiduals
+		{
+			/// the differences between the cornea centers of all pairs of glints, 3 N (N - 1) / 2 residuals for N glints
+			PairwiseResiduals = 0,
+			/// \brief the differences between the cornea center of each glint and a common center that is solved for as
+			/// well, 3 N residuals and 3 more variables, which is faster from about 4 lights on
+			CommonCenterResiduals
+		};
+
+		/// \brief The state of a stream of frames estimated with estimate_in_session: the tracked solution, the solver
+		/// problems and the telemetry counters, so that those estimates leave the estimator unchanged. Returned by
+		/// make_session, whose result can be cast to this to configure the session.
+		class Session : public EstimationSession
+		{
+		public:
+			/// \brief Sets the counters the estimates of this session are recorded in instead of those of the estimator,
+			/// nullptr to record into those of the estimator.
+			void setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters);
+			/// Discards the tracked solution, e.g. when the stream starts over.
+			void resetTracking();
+
+		private:
+			friend class TwoCamSphericalGE;
+
+			/// R and k_ij from the previous frame, R is NaN if there is none
+			double tracked_R = std::numeric_limits<double>::quiet_NaN();
+			std::vector<double> tracked_ks;
+
+			/// one problem per number of cameras, lights, glints and residuals, rebound to the glints of each frame
+			SolverContext<NoRProblems> no_R_problems;
+
+			std::shared_ptr<TelemetryCounters> telemetry_counters;
+		};
+
+		explicit TwoCamSphericalGE(OpticAxisReconstructionMethod method, CorneaCenterSolver cornea_center_solver = GenericSolver);
 		DefaultGazeEstimationResult estimate(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters) override;
+		/// Same as estimate with the parameters the prepared parameters refer to.
+		DefaultGazeEstimationResult estimate(const PupilCenterGlintInputs& data, const PreparedParameters& prepared);
+		/// Prepares the parameters once for all inputs.
+		void estimate_range(const PupilCenterGlintInputs* first, const PupilCenterGlintInputs* last, DefaultGazeEstimationResult* results,
+			const EyeAndCameraParameters& parameters) override;
+		std::unique_ptr<GazeEstimationMethod> clone() const override;
+
+		/// \brief Same as estimate with a generic scalar type for the whole estimation path, e.g. float, which halves the
+		/// memory traffic against double. With the two light solver and two glints per camera, the cornea center is solved
+		/// for in T as well, otherwise in double with the generic solver. Tracking is not applied. Returns false if the 
+		/// input is invalid or there is no usable solution. Defined in TwoCameraSphericalScalar.hpp.
+		template <typename T>
+		bool estimate_scalar(const PupilCenterGlintInputs& data, const EyeAndCameraParametersT<T>& parameters,
+			DifferentiableGazeEstimationResult<T>& result) const;
+
+		/// The cache keeps the cornea center and R, which depend on the cameras, the lights, the initial R and the initial
+		/// distance, and the optical axis, which depends on those and n1 and n2, so that changing alpha, beta or K only
+		/// recomputes the visual axis.
+		std::unique_ptr<EstimationCache> make_cache() const override;
+		/// Does not cache while tracking is enabled, as the starting point then depends on the previous frame.
+		DefaultGazeEstimationResult estimate_cached(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			EstimationCache& cache) override;
+
+		/// \brief Returns a Session with no tracked solution and no telemetry counters of its own. Tracking, the solver and
+		/// stage timing are those of this estimator.
+		std::unique_ptr<EstimationSession> make_session() const override;
+		/// \brief Same as estimate with the state between frames of session instead of that of this estimator, which is not
+		/// modified, see GazeEstimationMethod::estimate_in_session.
+		DefaultGazeEstimationResult estimate_in_session(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters,
+			EstimationSession& session) const override;
+
+		/// \brief Selects the residuals of the generic solver, PairwiseResiduals by default.
+		void setCorneaResiduals(CorneaResiduals residuals);
+		/// \brief Limits the generic solver per frame, e.g. to the frame period of the cameras, so that a frame it struggles
+		/// with is estimated from its best iterate in time instead of stalling. By default, the generic solver stops after
+		/// 1000 iterations.
+		void setSolverBudget(const SolverBudget& budget);
+
+		/// \brief Enables or disables tracking, where the solution of the previous frame is used as the starting point for
+		/// the cornea center and R. Consecutive calls to estimate must then be consecutive frames of the same eye. 
+		/// Frames that fail validation or whose solution is not usable reset the tracked solution.
+		void setTracking(bool enabled);
+		/// \brief Discards the tracked solution, e.g. when a new recording starts.
+		void resetTracking();
+
+		/// \brief Enables or disables measuring the wall time of the stages of each estimate into the telemetry of its result.
+		/// The solver telemetry is always filled in.
+		void setStageTiming(bool enabled);
+		/// \brief Sets the counters every estimate of this and of its clones is recorded in, nullptr to record none.
+		void setTelemetryCounters(std::shared_ptr<TelemetryCounters> counters);
 
 	private:
+		struct StageCache;
+
+		/// \param	cache	If not null, reused for the stages whose parameters did not change and updated for the others.
+		/// \param	session	The state between frames, own_session for the estimates that are not in a session.
+		DefaultGazeEstimationResult estimate_frame(const PupilCenterGlintInputs& data, const PreparedParameters& prepared,
+			StageCache* cache, Session& session) const;
+		void record(const DefaultGazeEstimationResult& result, const Session& session) const;
+
 		OpticAxisReconstructionMethod optic_axis_method;
+		CorneaCenterSolver cornea_center_solver = GenericSolver;
+		CorneaResiduals cornea_residuals = PairwiseResiduals;
+		SolverBudget solver_budget;
+
+		bool tracking = false;
+
+		bool stage_timing = false;
+		std::shared_ptr<TelemetryCounters> telemetry_counters;
+
+		/// the state between frames of estimate and the other estimates that are not in a session
+		Session own_session;
 	};
 
 }
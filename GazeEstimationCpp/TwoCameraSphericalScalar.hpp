@@ -0,0 +1,340 @@
+#ifndef TWO_CAMERA_SPHERICAL_SCALAR_HPP_INCLUDED
+#define TWO_CAMERA_SPHERICAL_SCALAR_HPP_INCLUDED
+
+#include "TwoCameraSpherical.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
+
+#include "SharedCalculations.hpp"
+#include "Telemetry.hpp"
+#include "Utils.hpp"
+
+namespace gazeestimation {
+
+	/// Calculates the cornea center using the methods detailed on p. 74f, employing eq. 3.23
+	/// This does not need a previously calibrated R, or any specific setup, but does minimize numerically.
+	/// Each camera must have a glint per light, in the order of the lights. Only the valid glints are used.
+	/// \param	r	The initial value for R, receives the estimated R.
+	/// \param	ks	The initial values for k_ij per glint of all cameras, camera by camera, NaN where unknown, receives the 
+	///				solution, NaN for the invalid glints. If this does not hold a value per glint, the initial values are
+	///				taken from parameters.distance_to_camera_estimate.
+	/// \param	usable	Receives whether the solution is usable.
+	/// \param	telemetry	Receives how the solve went.
+	/// \param	problems	If not null, the problems and buffers reused across frames, otherwise the problem is built for
+	///						this frame only.
+	/// Defined in TwoCameraSpherical.cpp.
+	Vec3 calculate_cornea_center_no_R(const PupilCenterGlintInputs& data, const EyeAndCameraParameters& parameters, 
+		TwoCamSphericalGE::CorneaCenterSolver solver, TwoCamSphericalGE::CorneaResiduals residuals, double& r,
+		std::vector<double>& ks, bool& usable, SolverTelemetry& telemetry, NoRProblems* problems = nullptr);
+
+	/// Solves for R and k_ij with two cameras and two lights by Levenberg-Marquardt on the 5x5 normal equations of the
+	/// pairwise differences between the cornea centers, with analytic derivatives.
+	/// glints are ordered as for ROptimizingCorneaDistance. R and ks hold the initial values and receive the result.
+	/// Returns false if this did not converge, in which case the contents of R and ks are unspecified.
+	/// Adds the iterations it ran to telemetry and sets the cost of the current solution.
+	/// The steps have to get below the precision of T relative to the variables to converge.
+	template <typename T>
+	bool solve_two_camera_two_light(const Vec3T<T>* glints, const Vec3T<T>* lights,
+		const Vec3T<T>* camera_positions, T& R, T* ks, SolverTelemetry& telemetry)
+	{
+		typedef Eigen::Matrix<T, 5, 1> Vec5;
+		typedef Eigen::Matrix<T, 5, 5> Mat5x5;
+		typedef Eigen::Matrix<T, 3, 5> Mat3x5;
+		const int num_centers = 4;
+		const int max_iterations = 50;
+		const T step_tolerance = std::max(T(1e-10), T(16) * std::numeric_limits<T>::epsilon());
+		const T max_damping = T(1e10);
+
+		Vec3T<T> os[num_centers];
+		Vec3T<T> ls[num_centers];
+		Vec3T<T> q_units[num_centers];
+		for (int index = 0; index < num_centers; index++)
+		{
+			os[index] = camera_positions[index / 2];
+			ls[index] = lights[index % 2];
+			q_units[index] = normalized(os[index] - glints[index]);
+		}
+
+		// x = (R, k_11, k_21, k_12, k_22)
+		Vec5 x;
+		x << R, ks[0], ks[1], ks[2], ks[3];
+
+		const auto in_bounds = [](const Vec5& x)
+		{
+			if (!x.allFinite() || x[0] < T(0.3) || x[0] > T(2))
+				return false;
+			for (int index = 1; index < 5; index++)
+			{
+				if (x[index] < T(2) || x[index] > T(400))
+					return false;
+			}
+			return true;
+		};
+
+		const auto cornea_centers = [&](const Vec5& x, Vec3T<T>* cs)
+		{
+			for (int index = 0; index < num_centers; index++)
+			{
+				cs[index] = calculate_cornea_center(Vec3T<T>(os[index] + x[1 + index] * q_units[index]), ls[index], os[index], x[0]);
+			}
+		};
+
+		const auto cost = [](const Vec3T<T>* cs)
+		{
+			T total = T(0);
+			for (int a = 0; a < num_centers; a++)
+			{
+				for (int b = 0; b < a; b++)
+				{
+					total += squared_length(cs[a] - cs[b]);
+				}
+			}
+			return total;
+		};
+
+		Vec3T<T> cs[num_centers];
+		cornea_centers(x, cs);
+		T current_cost = cost(cs);
+		T damping = T(1e-4);
+		bool converged = false;
+
+		for (int iteration = 0; iteration < max_iterations && !converged; iteration++)
+		{
+			telemetry.iterations++;
+			// dc/dk_ij per glint, dc/dR = (c - q) / R
+			Vec3T<T> d_k[num_centers];
+			Vec3T<T> d_R[num_centers];
+			for (int index = 0; index < num_centers; index++)
+			{
+				const Vec3T<T> q = os[index] + x[1 + index] * q_units[index];
+				d_k[index] = calculate_cornea_center_derivative(q, q_units[index], ls[index], os[index], x[0]);
+				d_R[index] = (cs[index] - q) / x[0];
+			}
+
+			Mat5x5 JtJ = Mat5x5::Zero();
+			Vec5 Jtr = Vec5::Zero();
+			for (int a = 0; a < num_centers; a++)
+			{
+				for (int b = 0; b < a; b++)
+				{
+					Mat3x5 J = Mat3x5::Zero();
+					J.col(0) = d_R[a] - d_R[b];
+					J.col(1 + a) = d_k[a];
+					J.col(1 + b) = -d_k[b];
+					JtJ += J.transpose() * J;
+					Jtr += J.transpose() * (cs[a] - cs[b]);
+				}
+			}
+
+			Mat5x5 augmented = JtJ;
+			augmented.diagonal() *= 1 + damping;
+			const Vec5 step = augmented.ldlt().solve(-Jtr);
+			const Vec5 x_new = x + step;
+
+			if (!in_bounds(x_new))
+			{
+				damping *= 10;
+				if (damping > max_damping)
+					return false;
+				continue;
+			}
+
+			if ((step.array().abs() <= step_tolerance * x.array().abs()).all())
+			{
+				x = x_new;
+				converged = true;
+				continue;
+			}
+
+			Vec3T<T> cs_new[num_centers];
+			cornea_centers(x_new, cs_new);
+			const T new_cost = cost(cs_new);
+			if (new_cost < current_cost)
+			{
+				x = x_new;
+				std::copy(cs_new, cs_new + num_centers, cs);
+				current_cost = new_cost;
+				damping = std::max(damping / 10, T(1e-12));
+			}
+			else
+			{
+				damping *= 10;
+				if (damping > max_damping)
+					return false;
+			}
+		}
+
+		telemetry.final_cost = 0.5 * static_cast<double>(current_cost);
+		if (!converged)
+			return false;
+
+		R = x[0];
+		for (int index = 0; index < num_centers; index++)
+		{
+			ks[index] = x[1 + index];
+		}
+		return true;
+	}
+
+	/// Calculates optic axis per section 3.3.1 (without relying on any eye parameters, with explicit refraction model).
+	/// The optic axis lies in the plane of each camera, its pupil image and the cornea center, with more than two cameras
+	/// it is the direction closest to all of those planes in the least squares sense.
+	/// only works as long as eye optic axis has no intersection with the lines between the cameras
+	template <typename T>
+	Vec3T<T> calculate_optic_axis_unit_vector_explicit_refraction_i(const Vec3T<T>* camera_positions, 
+						const Vec3T<T>* pupil_images_wcs, size_t num_cameras, const Vec3T<T>& cornea_center)
+	{
+		Vec3T<T> optic_axis;
+		if (num_cameras == 2)
+		{
+			optic_axis = normalized(cross_product(
+				cross_product(camera_positions[0] - pupil_images_wcs[0], cornea_center - camera_positions[0]),
+				cross_product(camera_positions[1] - pupil_images_wcs[1], cornea_center - camera_positions[1])));
+		}
+		else
+		{
+			// the eigenvector of the smallest eigenvalue of the sum of the outer products of the unit plane normals
+			Mat3x3T<T> normals = Mat3x3T<T>::Zero();
+			for (size_t i = 0; i < num_cameras; i++)
+			{
+				const Vec3T<T> normal = normalized(cross_product(camera_positions[i] - pupil_images_wcs[i], 
+					cornea_center - camera_positions[i]));
+				normals += normal * normal.transpose();
+			}
+			const Eigen::SelfAdjointEigenSolver<Mat3x3T<T>> solver(normals);
+			optic_axis = solver.eigenvectors().col(0);
+		}
+
+		// there are two possible results here, make sure we choose the one that points outside of the eye in the correct direction. As our scene plane is at z=0
+		if (cornea_center[2] > 0 && optic_axis[2] > 0)
+			optic_axis = -optic_axis;
+
+		return optic_axis;
+	}
+
+	/// Calculates the optic axis as the direction from the cornea center to the pupil center, which is where the
+	/// refracted rays from the cameras come closest in the least squares sense. The pupil images are in the WCS, in the
+	/// order of the cameras, of which there are at most max_cameras.
+	template <typename T>
+	Vec3T<T> calculate_optic_axis_unit_vector_explicit_refraction_ii(const Vec3T<T>* camera_positions,
+		const Vec3T<T>* pupil_images_wcs, size_t num_cameras, const Vec3T<T>& cornea_center, const T& R,
+		const RefractionConstants<T>& refraction)
+	{
+		Vec3T<T> iotas[max_cameras];
+		Vec3T<T> rs[max_cameras];
+		for (size_t i = 0; i < num_cameras; i++)
+		{
+			// iota refracts at the point of refraction r, not at the image of the pupil
+			rs[i] = calculate_r(camera_positions[i], pupil_images_wcs[i], cornea_center, R);
+			iotas[i] = normalized(calculate_iota(camera_positions[i], rs[i], cornea_center, R, refraction));
+		}
+
+		const Vec3T<T> pupil_center = closest_point_to_lines(rs, iotas, num_cameras);
+		return normalized(pupil_center - cornea_center);
+	}
+
+	template <typename T>
+	bool TwoCamSphericalGE::estimate_scalar(const PupilCenterGlintInputs& data, const EyeAndCameraParametersT<T>& parameters,
+		DifferentiableGazeEstimationResult<T>& result) const
+	{
+		const size_t num_cameras = data.data.size();
+		if (num_cameras < 2 || parameters.cameras.size() != num_cameras)
+			return false;
+
+		for (const auto& camera_data : data.data)
+		{
+			if (camera_data.glints.size() != parameters.light_positions.size())
+				return false;
+
+			int valid_glints = 0;
+			for (const auto& glint : camera_data.glints)
+			{
+				if (glintValid(glint))
+					valid_glints++;
+			}
+
+			if (valid_glints < 2)
+				return false;
+		}
+
+		Vec3T<T> camera_positions[max_cameras];
+		for (size_t i = 0; i < num_cameras; i++)
+		{
+			camera_positions[i] = parameters.cameras[i].position();
+		}
+
+		T R = parameters.R;
+		Vec3T<T> cornea_center(T(0), T(0), T(0));
+		SolverTelemetry telemetry;
+		bool solved = false;
+		if (cornea_center_solver == TwoLightSolver && num_cameras == 2 && parameters.light_positions.size() == 2
+			&& data.data[0].glints.size() == 2 && data.data[1].glints.size() == 2)
+		{
+			Vec3T<T> glints[4];
+			T ks[4];
+			for (int index = 0; index < 4; index++)
+			{
+				glints[index] = parameters.cameras[index / 2].ics_to_wcs(data.data[index / 2].glints[index % 2].template cast<T>());
+				ks[index] = parameters.distance_to_camera_estimate;
+			}
+
+			solved = solve_two_camera_two_light(glints, parameters.light_positions.data(), camera_positions, R, ks, telemetry);
+			if (solved)
+			{
+				for (int index = 0; index < 4; index++)
+				{
+					const Vec3T<T> q = calculate_q(ks[index], camera_positions[index / 2], glints[index]);
+					cornea_center += calculate_cornea_center(q, parameters.light_positions[index % 2], camera_positions[index / 2], R);
+				}
+				cornea_center /= T(4);
+			}
+		}
+
+		if (!solved)
+		{
+			// the generic solver only works in double
+			const EyeAndCameraParameters parameters_value = parameters.template cast<double>();
+			double R_value = parameters_value.R;
+			std::vector<double> ks_value;
+			bool usable = false;
+			cornea_center = calculate_cornea_center_no_R(data, parameters_value, GenericSolver, cornea_residuals, R_value, ks_value, usable,
+				telemetry).template cast<T>();
+			if (!usable)
+				return false;
+			R = T(R_value);
+		}
+
+		Vec3T<T> pupil_images_wcs[max_cameras];
+		for (size_t i = 0; i < num_cameras; i++)
+		{
+			pupil_images_wcs[i] = parameters.cameras[i].ics_to_wcs(data.data[i].pupil_center.template cast<T>());
+		}
+
+		if (optic_axis_method == ExplicitRefraction1)
+		{
+			result.optical_axis = calculate_optic_axis_unit_vector_explicit_refraction_i(camera_positions, pupil_images_wcs,
+				num_cameras, cornea_center);
+		}
+		else if (optic_axis_method == ExplicitRefraction2)
+		{
+			result.optical_axis = calculate_optic_axis_unit_vector_explicit_refraction_ii(camera_positions, pupil_images_wcs,
+				num_cameras, cornea_center, R, RefractionConstants<T>(parameters.n1, parameters.n2));
+		}
+		else
+		{
+			return false;
+		}
+
+		result.center_of_cornea = cornea_center;
+		result.visual_axis = calculate_visual_axis_unit_vector(result.optical_axis, parameters.alpha, parameters.beta);
+		return true;
+	}
+
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+namespace gazeestimation
+{
+	WorkerPool::WorkerPool(unsigned int num_workers)
+	{
+		if (num_workers == 0)
+		{
+			num_workers = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		for (unsigned int i = 0; i < num_workers; i++)
+		{
+			workers.emplace_back(&WorkerPool::work, this);
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	unsigned int WorkerPool::size() const
+	{
+		return static_cast<unsigned int>(workers.size());
+	}
+
+	void WorkerPool::run(size_t count, const Task& task)
+	{
+		if (count == 0)
+			return;
+
+		std::lock_guard<std::mutex> run_lock(run_mutex);
+		std::unique_lock<std::mutex> lock(mutex);
+
+		current_task = &task;
+		num_tasks = count;
+		next_task = 0;
+		finished_tasks = 0;
+		first_exception = nullptr;
+
+		work_available.notify_all();
+		work_done.wait(lock, [this] { return finished_tasks == num_tasks; });
+
+		current_task = nullptr;
+		num_tasks = 0;
+		next_task = 0;
+
+		std::exception_ptr exception = first_exception;
+		first_exception = nullptr;
+		lock.unlock();
+
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+	}
+
+	void WorkerPool::work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			work_available.wait(lock, [this] { return stopping || next_task < num_tasks; });
+			if (stopping)
+				return;
+
+			const size_t index = next_task++;
+			const Task* task = current_task;
+			lock.unlock();
+
+			std::exception_ptr exception;
+			try
+			{
+				(*task)(index);
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+
+			lock.lock();
+			if (exception && !first_exception)
+			{
+				first_exception = exception;
+			}
+			if (++finished_tasks == num_tasks)
+			{
+				work_done.notify_all();
+			}
+		}
+	}
+}
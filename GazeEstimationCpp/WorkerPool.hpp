@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_HPP_INCLUDED
+#define WORKER_POOL_HPP_INCLUDED
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gazeestimation {
+
+	/// A fixed set of worker threads that runs batches of independent tasks.
+	class WorkerPool
+	{
+	public:
+		typedef std::function<void(size_t)> Task;
+
+		/// \param	num_workers	The number of worker threads, 0 to use one per hardware thread.
+		explicit WorkerPool(unsigned int num_workers = 0);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		unsigned int size() const;
+
+		/// \brief Runs task(0), ..., task(num_tasks - 1) on the workers and returns once all of them have finished.
+		/// If tasks throw, the first exception is rethrown here after all tasks have finished. Calls from different
+		/// threads are run one after the other; calling this from within a task deadlocks.
+		void run(size_t num_tasks, const Task& task);
+
+	private:
+		void work();
+
+		std::vector<std::thread> workers;
+
+		std::mutex run_mutex;
+		std::mutex mutex;
+		std::condition_variable work_available;
+		std::condition_variable work_done;
+
+		const Task* current_task = nullptr;
+		size_t num_tasks = 0;
+		size_t next_task = 0;
+		size_t finished_tasks = 0;
+		std::exception_ptr first_exception;
+		bool stopping = false;
+	};
+
+}
+
+#endif